@@ -0,0 +1,271 @@
+#ifndef IO_COMPRESSED
+#define IO_COMPRESSED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+
+void process_particle_data(double *pos, int npart_now, double boxsize);
+
+//=======================================================
+// Reader for the compressed snapshots written by
+// MG-PICOLA with COMPRESSED_OUTPUT (src/compressed_output.c)
+// The particles are sorted by ID and stored in blocks
+// coded with an adaptive binary range coder
+//=======================================================
+
+#define COMPRESSED_MAGIC    "PICOLAZ1"
+#define COMPRESSED_NSTREAMS 7
+#define RC_PROB_BITS        11
+#define RC_PROB_INIT        (1 << (RC_PROB_BITS - 1))
+#define RC_MOVE_BITS        5
+#define RC_TOP              (1U << 24)
+
+//=======================================================
+// Compressed header
+//=======================================================
+
+struct compressed_header {
+  char magic[8];
+  int  version;
+  int  nsample;
+  int  block_size;
+  int  num_files;
+  unsigned long long npart;
+  unsigned long long npart_total;
+  double boxsize;
+  double redshift;
+  double pos_tolerance;
+  double vel_tolerance;
+} compressed_header;
+
+//=======================================================
+// Range decoder reading from a memory buffer
+//=======================================================
+
+struct range_decoder {
+  unsigned int range;
+  unsigned int code;
+  const unsigned char *in;
+  size_t pos, size;
+};
+
+inline unsigned char rc_next_byte(range_decoder *rc){
+  return rc->pos < rc->size ? rc->in[rc->pos++] : 0;
+}
+
+void rc_init(range_decoder *rc, const unsigned char *in, size_t size){
+  rc->range = 0xFFFFFFFFU;
+  rc->code  = 0;
+  rc->in    = in;
+  rc->pos   = 0;
+  rc->size  = size;
+  for(int i = 0; i < 5; i++)
+    rc->code = (rc->code << 8) | rc_next_byte(rc);
+}
+
+inline int rc_decode_bit(range_decoder *rc, unsigned short *prob){
+  int bit;
+  unsigned int bound = (rc->range >> RC_PROB_BITS) * (*prob);
+  if(rc->code < bound){
+    rc->range = bound;
+    *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+    bit = 0;
+  } else {
+    rc->code  -= bound;
+    rc->range -= bound;
+    *prob -= *prob >> RC_MOVE_BITS;
+    bit = 1;
+  }
+  while(rc->range < RC_TOP){
+    rc->range <<= 8;
+    rc->code = (rc->code << 8) | rc_next_byte(rc);
+  }
+  return bit;
+}
+
+inline int rc_decode_direct_bit(range_decoder *rc){
+  int bit = 0;
+  rc->range >>= 1;
+  if(rc->code >= rc->range){
+    rc->code -= rc->range;
+    bit = 1;
+  }
+  while(rc->range < RC_TOP){
+    rc->range <<= 8;
+    rc->code = (rc->code << 8) | rc_next_byte(rc);
+  }
+  return bit;
+}
+
+//=======================================================
+// Number of bits (bit-tree) followed by the bits below
+// the leading one
+//=======================================================
+
+unsigned long long rc_decode_number(range_decoder *rc, unsigned short *probs){
+  int m = 1;
+  for(int i = 0; i < 7; i++)
+    m = (m << 1) | rc_decode_bit(rc, &probs[m]);
+  int nbits = m - 128;
+  if(nbits == 0) return 0;
+
+  unsigned long long value = 1;
+  for(int i = nbits - 2; i >= 0; i--)
+    value = (value << 1) | (unsigned long long) rc_decode_direct_bit(rc);
+  return value;
+}
+
+inline long long unzigzag(unsigned long long value){
+  return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+inline float ordered_to_float(long long value){
+  unsigned int bits = value >= 0 ? (unsigned int) value : ((unsigned int)(-(value + 1)) | 0x80000000U);
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline long long float_to_ordered(float value){
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if(bits & 0x80000000U) return -(long long)(bits & 0x7FFFFFFFU) - 1;
+  return (long long) bits;
+}
+
+//=======================================================
+// Decode a block of npart particles. Positions in Mpc/h
+// and velocities in km/s. With zero tolerance the values
+// are the exact floats that were written
+//=======================================================
+
+void decompress_particle_block(const unsigned char *in, size_t nbytes, int npart,
+    unsigned long long *id, double *pos, double *vel){
+  range_decoder rc;
+  unsigned short probs[COMPRESSED_NSTREAMS][128];
+  long long prev[COMPRESSED_NSTREAMS];
+  unsigned long long previd = ~0ULL;
+  unsigned long long nsample = compressed_header.nsample;
+  double boxsize = compressed_header.boxsize;
+  double dx      = boxsize / double(compressed_header.nsample);
+  double postol  = compressed_header.pos_tolerance;
+  double veltol  = compressed_header.vel_tolerance;
+
+  for(int s = 0; s < COMPRESSED_NSTREAMS; s++){
+    for(int i = 0; i < 128; i++) probs[s][i] = RC_PROB_INIT;
+    prev[s] = 0;
+  }
+
+  rc_init(&rc, in, nbytes);
+  for(int n = 0; n < npart; n++){
+    previd = previd + 1 + rc_decode_number(&rc, probs[0]);
+    id[n] = previd;
+
+    unsigned long long q[3] = {previd / (nsample * nsample), (previd / nsample) % nsample, previd % nsample};
+
+    for(int axes = 0; axes < 3; axes++){
+      long long value = prev[1 + axes] + unzigzag(rc_decode_number(&rc, probs[1 + axes]));
+      prev[1 + axes] = value;
+
+      float qpos = float(q[axes] * dx);
+      if(postol == 0.0){
+        pos[3*n+axes] = ordered_to_float(value + float_to_ordered(qpos));
+      } else {
+        double x = double(qpos) + value * 2.0 * postol;
+        if(x <  0.0)     x += boxsize;
+        if(x >= boxsize) x -= boxsize;
+        pos[3*n+axes] = x;
+      }
+    }
+    for(int axes = 0; axes < 3; axes++){
+      long long value = prev[4 + axes] + unzigzag(rc_decode_number(&rc, probs[4 + axes]));
+      prev[4 + axes] = value;
+      vel[3*n+axes] = (veltol == 0.0) ? double(ordered_to_float(value)) : value * 2.0 * veltol;
+    }
+  }
+}
+
+//=======================================================
+// Read compressed header
+//=======================================================
+
+void read_compressed_header(FILE *fd, bool verbose = true){
+  if(fread(&compressed_header, sizeof(compressed_header), 1, fd) != 1 ||
+      strncmp(compressed_header.magic, COMPRESSED_MAGIC, 8) != 0){
+    std::cout << "Error: not a compressed MG-PICOLA file" << std::endl;
+    exit(1);
+  }
+  if(verbose){
+    printf("\n======================================\n");
+    printf("Compressed Header:\n");
+    printf("======================================\n");
+    printf("Npart (file)    = %llu\n", compressed_header.npart);
+    printf("Npart (total)   = %llu\n", compressed_header.npart_total);
+    printf("Nsample         = %i\n",   compressed_header.nsample);
+    printf("z               = %f\n",   compressed_header.redshift);
+    printf("BoxSize (Mpc/h) = %f\n",   compressed_header.boxsize);
+    printf("Pos tolerance   = %e\n",   compressed_header.pos_tolerance);
+    printf("Vel tolerance   = %e\n",   compressed_header.vel_tolerance);
+    printf("======================================\n\n");
+  }
+}
+
+void read_and_bin_particles_compressed(std::string fileprefix, int filenum, int *npart_tot, double *readbuffer, int *nbuffer){
+  std::ostringstream os;
+  os << fileprefix << filenum;
+  std::string filename = os.str();
+  FILE *fp;
+
+  // Open file
+  std::cout << "Opening file: " << filename << std::endl;
+  fp = fopen(filename.c_str(),"r");
+  if(fp == NULL){
+    std::cout << "Error: cannot open " << filename << std::endl;
+    exit(1);
+  }
+
+  // Read header and print it for the first file only
+  read_compressed_header(fp, filenum == 0);
+
+  // Check that buffer is large enough for the positions in a block
+  if(3 * compressed_header.block_size > *nbuffer){
+    std::cout << "Error: increase size of buffer. Trying to read " << 3*compressed_header.block_size << " > nbuffer = " << *nbuffer << std::endl;
+    exit(1);
+  }
+
+  std::cout << "=> Reading file: " << filename << std::endl;
+  std::cout << "=> Filenum = " << filenum << " Npart_loc = " << compressed_header.npart << " Npart_tot = " << *npart_tot+compressed_header.npart << std::endl;
+
+  std::vector<unsigned long long> id(compressed_header.block_size);
+  std::vector<double> vel(3 * compressed_header.block_size);
+  std::vector<unsigned char> data;
+  unsigned long long nread = 0;
+  while(nread < compressed_header.npart){
+    unsigned int npart_block, nbytes;
+    if(fread(&npart_block, sizeof(npart_block), 1, fp) != 1 || fread(&nbytes, sizeof(nbytes), 1, fp) != 1){
+      std::cout << "Error: unexpected end of file " << filename << std::endl;
+      exit(1);
+    }
+    data.resize(nbytes + 1);
+    if(fread(&data[0], 1, nbytes, fp) != nbytes){
+      std::cout << "Error: unexpected end of file " << filename << std::endl;
+      exit(1);
+    }
+
+    decompress_particle_block(&data[0], nbytes, npart_block, &id[0], readbuffer, &vel[0]);
+    process_particle_data(readbuffer, npart_block, compressed_header.boxsize);
+    nread += npart_block;
+  }
+
+  // Update how many particles in total we have read
+  *npart_tot += compressed_header.npart;
+
+  fclose(fp);
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include "io_ramses.h"
 #include "io_gadget.h"
 #include "io_ascii.h"
+#include "io_compressed.h"
 #define pow2(x) ((x)*(x))
 #define pow3(x) ((x)*(x)*(x))
 
@@ -49,7 +50,7 @@ struct Simulation {
   double *nmodes;       // Number of modes in each pofk bin
   string filebase;      // "/path/to/output_0000X/part_0000X.out" or "/path/to/gadget."
   string pofkoutfile;   // Name of pofk output file
-  string datatype;      // RAMSES or GADGET
+  string datatype;      // RAMSES, GADGET, ASCII or COMPRESSED
   fftw_complex *grid;   // FFT grid
   fftw_plan plan;       // FFT execution plan
 } global;
@@ -323,7 +324,7 @@ int main(int argv, char **argc){
   // Initialize parameters
   //======================================
   if(argv < 5){
-    cout << "Run as ./pofk /path/output_0000X/part_0000X.out outfilename ngrid nFiles RAMSES/GADGET" << endl;
+    cout << "Run as ./pofk /path/output_0000X/part_0000X.out outfilename ngrid nFiles RAMSES/GADGET/ASCII/COMPRESSED" << endl;
     exit(1);
   } else {
     global.filebase    = argc[1];
@@ -369,6 +370,8 @@ int main(int argv, char **argc){
       read_and_bin_particles_ramses(global.filebase, i  , &global.npart_tot, global.readbuffer, &global.nbuffer);
     } else if(global.datatype.compare("GADGET") == 0) {
       read_and_bin_particles_gadget(global.filebase, i-1, &global.npart_tot, global.readbuffer, &global.nbuffer);
+    } else if(global.datatype.compare("COMPRESSED") == 0) {
+      read_and_bin_particles_compressed(global.filebase, i-1, &global.npart_tot, global.readbuffer, &global.nbuffer);
     } else if(global.datatype.compare("ASCII") == 0) {
       global.nfiles = 1;
       read_and_bin_particles_ascii(global.filebase, 1, &global.npart_tot, global.readbuffer, &global.nbuffer);
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include "io_compressed.h"
+
+//=======================================================
+// Round-trip test of the compressed MG-PICOLA format:
+// code blocks of particles with compress_particle_block
+// (src/compressed_output.c built with -DCOMPRESSED_CODER_ONLY)
+// and decode them with decompress_particle_block. At zero
+// tolerance the values must be bit identical, otherwise
+// the error must be at most the tolerance
+//=======================================================
+
+extern "C" size_t compress_particle_block(unsigned long long *id, float *pos, float *vel, int npart, int nsample,
+    double boxsize, double pos_tolerance, double vel_tolerance, unsigned char *out);
+
+// Not used here, but io_compressed.h needs it for read_and_bin_particles_compressed
+void process_particle_data(double *pos, int npart_now, double boxsize){}
+
+static unsigned long long rng_state = 12345;
+double rnd(){
+  rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+unsigned int float_bits(float f){
+  unsigned int bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+double periodic(double dx, double boxsize){
+  if(dx >  0.5 * boxsize) dx -= boxsize;
+  if(dx < -0.5 * boxsize) dx += boxsize;
+  return dx;
+}
+
+//=======================================================
+// Make [npart] particles with sorted IDs < nsample^3. Most
+// are close to their Lagrangian position, some have large
+// ID gaps, positions on the other side of the box
+// (wrap-around), -0.0, 0.0 and values just below boxsize
+//=======================================================
+
+void make_particles(int npart, int nsample, double boxsize, std::vector<unsigned long long> &id,
+    std::vector<float> &pos, std::vector<float> &vel){
+  unsigned long long ntot = (unsigned long long) nsample * nsample * nsample;
+  double dx = boxsize / double(nsample);
+  id.resize(npart);
+  pos.resize(3 * npart);
+  vel.resize(3 * npart);
+
+  unsigned long long previd = 0;
+  for(int n = 0; n < npart; n++){
+    double r = rnd();
+    unsigned long long room = ntot - previd - (npart - n);
+    unsigned long long gap = r < 0.8 ? 1 : (r < 0.95 ? 1 + (unsigned long long)(rnd() * 1000) : 1 + (unsigned long long)(rnd() * room / 8));
+    if(gap > room) gap = 1;
+    id[n] = (n == 0) ? (unsigned long long)(rnd() * 10) : previd + gap;
+    previd = id[n];
+
+    unsigned long long q[3] = {id[n] / ((unsigned long long) nsample * nsample), (id[n] / nsample) % nsample, id[n] % nsample};
+    for(int axes = 0; axes < 3; axes++){
+      double x = q[axes] * dx + (rnd() - 0.5) * 4.0 * dx;
+      x = fmod(x + 10.0 * boxsize, boxsize);
+      pos[3*n+axes] = float(x);
+      vel[3*n+axes] = float((rnd() - 0.5) * 2000.0);
+    }
+
+    // Special values
+    int kind = n % 97;
+    if(kind == 1) pos[3*n]   = -0.0f;
+    if(kind == 2) pos[3*n+1] = 0.0f;
+    if(kind == 3) pos[3*n+2] = nextafterf(float(boxsize), 0.0f);
+    if(kind == 4) vel[3*n]   = -0.0f;
+    if(kind == 5) vel[3*n+1] = 1e-40f;
+    if(kind == 6) vel[3*n+2] = -3.0e4f;
+  }
+}
+
+//=======================================================
+// Code and decode one block and count the values that
+// are not bit identical (tolerance 0) or off by more
+// than the tolerance
+//=======================================================
+
+int roundtrip(int npart, int nsample, double boxsize, double postol, double veltol){
+  std::vector<unsigned long long> id, id_out(npart + 1);
+  std::vector<float> pos, vel;
+  std::vector<double> pos_out(3 * npart + 1), vel_out(3 * npart + 1);
+  std::vector<unsigned char> buffer(128 * (size_t) npart + 1024);
+  make_particles(npart, nsample, boxsize, id, pos, vel);
+
+  size_t nbytes = compress_particle_block(id.data(), pos.data(), vel.data(), npart, nsample, boxsize, postol, veltol, buffer.data());
+
+  compressed_header.nsample       = nsample;
+  compressed_header.boxsize       = boxsize;
+  compressed_header.pos_tolerance = postol;
+  compressed_header.vel_tolerance = veltol;
+  decompress_particle_block(buffer.data(), nbytes, npart, id_out.data(), pos_out.data(), vel_out.data());
+
+  int nerror = 0;
+  double maxposerr = 0.0, maxvelerr = 0.0;
+  for(int n = 0; n < npart; n++){
+    if(id_out[n] != id[n]) nerror++;
+    for(int axes = 0; axes < 3; axes++){
+      if(postol == 0.0){
+        if(float_bits(float(pos_out[3*n+axes])) != float_bits(pos[3*n+axes])) nerror++;
+      } else {
+        double err = fabs(periodic(pos_out[3*n+axes] - pos[3*n+axes], boxsize));
+        if(err > maxposerr) maxposerr = err;
+        if(err > postol * (1.0 + 1e-9)) nerror++;
+      }
+      if(veltol == 0.0){
+        if(float_bits(float(vel_out[3*n+axes])) != float_bits(vel[3*n+axes])) nerror++;
+      } else {
+        double err = fabs(vel_out[3*n+axes] - vel[3*n+axes]);
+        if(err > maxvelerr) maxvelerr = err;
+        if(err > veltol * (1.0 + 1e-9)) nerror++;
+      }
+    }
+  }
+
+  printf("npart = %6i  postol = %8.1e  veltol = %8.1e  bytes/particle = %6.2f  max errors = %e %e  %s\n",
+      npart, postol, veltol, npart > 0 ? nbytes / double(npart) : 0.0, maxposerr, maxvelerr, nerror == 0 ? "OK" : "FAILED");
+  return nerror;
+}
+
+int main(){
+  int nerror = 0;
+  int nparts[4] = {0, 1, 1000, 65536};
+  for(int i = 0; i < 4; i++){
+    nerror += roundtrip(nparts[i], 128, 500.0, 0.0,   0.0);
+    nerror += roundtrip(nparts[i], 128, 500.0, 1e-3,  0.1);
+    nerror += roundtrip(nparts[i], 128, 500.0, 0.05,  0.0);
+    nerror += roundtrip(nparts[i], 128, 500.0, 0.0,   5.0);
+  }
+  if(nerror > 0){
+    std::cout << "Round-trip test FAILED with " << nerror << " errors" << std::endl;
+    return 1;
+  }
+  std::cout << "Round-trip test passed" << std::endl;
+  return 0;
+}
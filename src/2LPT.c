@@ -28,6 +28,10 @@
 #include "vars.h"
 #include "proto.h"
 #include "readICfromfile.h"
+#include <sys/resource.h>
+#ifdef COUNTER_BASED_RNG
+#include "philox.h"
+#endif
 
 //================
 // Set some units
@@ -156,6 +160,289 @@ void initialize_parts(void) {
   return;
 }
 
+//======================================================================================================================
+// Print the peak memory (resident set size) so far over the tasks
+//======================================================================================================================
+void report_peak_memory(char *where){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  // ru_maxrss is in kilobytes
+  double peak_mb = usage.ru_maxrss / 1024.0, peak_mb_max = 0.0, peak_mb_sum = 0.0;
+  MPI_Reduce(&peak_mb, &peak_mb_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&peak_mb, &peak_mb_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if(ThisTask == 0){
+    printf("Peak memory %s: %.1f MB max per task, %.1f MB in total\n", where, peak_mb_max, peak_mb_sum);
+    fflush(stdout);
+  }
+}
+
+//======================================================================================================================
+// The wave-vector of the local complex grid cell (i,j,k)
+//======================================================================================================================
+static inline void local_kvec(int i, int j, int k, double *kvec){
+  if((i + Local_x_start) < Nmesh / 2) {
+    kvec[0] = (i + Local_x_start) * 2 * PI / Box;
+  } else {
+    kvec[0] = -(Nmesh - (i + Local_x_start)) * 2 * PI / Box;
+  }
+
+  if(j < Nmesh / 2) {
+    kvec[1] = j * 2 * PI / Box;
+  } else {
+    kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+  }
+
+  if(k < Nmesh / 2) {
+    kvec[2] = k * 2 * PI / Box;
+  } else {
+    kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+  }
+}
+
+#if defined(GENERIC_FNL) || defined(EQUIL_FNL) || defined(ORTHO_FNL)
+//======================================================================================================================
+// Fourier transform [nfields] grids stored interleaved, cfields[nfields * index + f], in place with one batched FFT
+// (FFTW's howmany = nfields) so that all the fields share the same MPI transposes
+//======================================================================================================================
+static void batched_fft_to_real_space(complex_kind *cfields, int nfields){
+  ptrdiff_t n[3] = {Nmesh, Nmesh, Nmesh};
+  plan_kind Inverse_plan = my_fftw_mpi_plan_many_dft_c2r(3, n, nfields, cfields, (float_kind *) cfields, MPI_COMM_WORLD, FFTW_ESTIMATE);
+  my_fftw_execute(Inverse_plan);
+  my_fftw_destroy_plan(Inverse_plan);
+}
+
+static void batched_fft_to_fourier_space(complex_kind *cfields, int nfields){
+  ptrdiff_t n[3] = {Nmesh, Nmesh, Nmesh};
+  plan_kind Forward_plan = my_fftw_mpi_plan_many_dft_r2c(3, n, nfields, (float_kind *) cfields, cfields, MPI_COMM_WORLD, FFTW_ESTIMATE);
+  my_fftw_execute(Forward_plan);
+  my_fftw_destroy_plan(Forward_plan);
+}
+
+//======================================================================================================================
+// Fill the interleaved fields with |k|^kpower[f] * cpot (zero for the k = 0 mode)
+//======================================================================================================================
+static void potential_times_kpowers(complex_kind *cpot, complex_kind *cfields, int nfields, double *kpower){
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int i = 0; i < Local_nx; i++) {
+    for(int j = 0; j < Nmesh; j++) {
+      for(int k = 0; k <= Nmesh / 2; k++) {
+        unsigned int coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
+        double kvec[3];
+        local_kvec(i, j, k, kvec);
+        double kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
+
+        for(int f = 0; f < nfields; f++) {
+          double fac = kmag > 0.0 ? pow(kmag, kpower[f]) : 0.0;
+          cfields[nfields * coord + f][0] = fac * cpot[coord][0];
+          cfields[nfields * coord + f][1] = fac * cpot[coord][1];
+        }
+      }
+    }
+  }
+}
+
+//======================================================================================================================
+// Add the quadratic terms to the potential, cpot += fnl * sum_f |k|^kpower[f] * cfields[f] / Nmesh^3, where cfields 
+// are the forward transformed (interleaved) fields. The zero mode is left untouched and if sphere_cut is set only 
+// the modes we generated (SphereMode) are changed
+//======================================================================================================================
+static void add_quadratic_terms_to_potential(complex_kind *cpot, complex_kind *cfields, int nfields, double *kpower, double fnl, int sphere_cut){
+  unsigned long long nmesh3 = ((unsigned long long) Nmesh) * ((unsigned long long) Nmesh ) * ((unsigned long long) Nmesh);    
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int i = 0; i < Local_nx; i++) {
+    for(int j = 0; j < Nmesh; j++) {
+      for(int k = 0; k <= Nmesh / 2; k++) {
+        unsigned int coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
+        double kvec[3];
+        local_kvec(i, j, k, kvec);
+        double kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
+
+        if(kmag == 0.0) continue;
+        if(sphere_cut) {
+          if(SphereMode == 1) {
+            if(kmag * Box / (2 * PI) > Nsample / 2) continue;
+          } else {
+            if(fabs(kvec[0]) * Box / (2 * PI) > Nsample / 2) continue;
+            if(fabs(kvec[1]) * Box / (2 * PI) > Nsample / 2) continue;
+            if(fabs(kvec[2]) * Box / (2 * PI) > Nsample / 2) continue;
+          }
+        }
+
+        for(int f = 0; f < nfields; f++) {
+          double fac = fnl * pow(kmag, kpower[f]) / (double) nmesh3;
+          cpot[coord][0] += fac * cfields[nfields * coord + f][0];
+          cpot[coord][1] += fac * cfields[nfields * coord + f][1];
+        }
+      }
+    }
+  }
+}
+#endif
+
+#ifdef LOW_MEMORY_2LPT
+//======================================================================================================================
+// Put the derivative d(dis_a)/d(q_b) of the ZA displacement (or the trace sum_a d(dis_a)/d(q_a) if a < 0) into 
+// cgrad and Fourier transform it to real space
+//======================================================================================================================
+static void displacement_gradient_to_real_space(complex_kind *(cdisp[3]), int a, int b, complex_kind *cgrad){
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int i = 0; i < Local_nx; i++) {
+    for(int j = 0; j < Nmesh; j++) {
+      for(int k = 0; k <= Nmesh / 2; k++) {
+        unsigned int coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
+        double kvec[3];
+        local_kvec(i, j, k, kvec);
+
+        // d(dis_a)/d(q_b) -> sqrt(-1) k_b dis_a
+        if(a >= 0) {
+          cgrad[coord][0] = -cdisp[a][coord][1] * kvec[b];
+          cgrad[coord][1] =  cdisp[a][coord][0] * kvec[b];
+        } else {
+          cgrad[coord][0] = -(cdisp[0][coord][1] * kvec[0] + cdisp[1][coord][1] * kvec[1] + cdisp[2][coord][1] * kvec[2]);
+          cgrad[coord][1] =   cdisp[0][coord][0] * kvec[0] + cdisp[1][coord][0] * kvec[1] + cdisp[2][coord][0] * kvec[2];
+        }
+      }
+    }
+  }
+
+  plan_kind Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh, Nmesh, Nmesh, cgrad, (float_kind *) cgrad, MPI_COMM_WORLD, FFTW_ESTIMATE);
+  my_fftw_execute(Inverse_plan);
+  my_fftw_destroy_plan(Inverse_plan);
+}
+
+//======================================================================================================================
+// The second order source sum_{a<b} (dis_a,a dis_b,b - dis_a,b^2) in k-space using only two grids on top of cdisp.
+// We write sum_{a<b} dis_a,a dis_b,b = 1/2 [ (sum_a dis_a,a)^2 - sum_a dis_a,a^2 ] so every term needs one 
+// derivative grid at a time. Returns the same (unnormalized) source as the standard method. If cgrad_out is not 
+// NULL the derivative grid is handed back for reuse instead of being freed
+//======================================================================================================================
+static complex_kind *compute_2LPT_source_low_memory(complex_kind *(cdisp[3]), complex_kind **cgrad_out){
+  complex_kind *csource = malloc(sizeof(complex_kind) * Total_size);
+  complex_kind *cgrad   = malloc(sizeof(complex_kind) * Total_size);
+  float_kind *source = (float_kind *) csource;
+  float_kind *grad   = (float_kind *) cgrad;
+
+  // The derivative grids (a,b) in the order we add them and the weight of the square in the source
+  const int    ab[7][2] = { {-1,-1}, {0,0}, {1,1}, {2,2}, {0,1}, {0,2}, {1,2} };
+  const double weight[7] = { 0.5, -0.5, -0.5, -0.5, -1.0, -1.0, -1.0 };
+
+  if(ThisTask == 0) printf("Fourier transforming displacement gradient (low memory)...\n");
+  for(int n = 0; n < 7; n++){
+    displacement_gradient_to_real_space(cdisp, ab[n][0], ab[n][1], cgrad);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int i = 0; i < Local_nx; i++) {
+      for(int j = 0; j < Nmesh; j++) {
+        for(int k = 0; k < Nmesh; k++) {
+          unsigned int coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
+          double term = weight[n] * grad[coord] * grad[coord];
+          source[coord] = (n == 0 ? term : source[coord] + term);
+        }
+      }
+    }
+  }
+  if(cgrad_out != NULL) *cgrad_out = cgrad;
+  else free(cgrad);
+
+  if(ThisTask == 0) printf("Fourier transforming second order source...\n");
+  plan_kind Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh, Nmesh, Nmesh, source, csource, MPI_COMM_WORLD, FFTW_ESTIMATE);
+  my_fftw_execute(Forward_plan);
+  my_fftw_destroy_plan(Forward_plan);
+
+  return csource;
+}
+
+//======================================================================================================================
+// Solve the Poisson equation for the 2LPT displacement along [axes]: cdisp2 = source * k / (sqrt(-1) k^2)
+// cdisp2 can be the same grid as csource (then the source is overwritten)
+//======================================================================================================================
+static void source_to_2LPT_displacement(complex_kind *csource, complex_kind *cdisp2, int axes){
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int i = 0; i < Local_nx; i++) {
+    for(int j = 0; j < Nmesh; j++) {
+      for(int k = 0; k <= Nmesh / 2; k++) {
+        unsigned int coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
+        double kvec[3];
+        local_kvec(i, j, k, kvec);
+        double kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
+
+        if(kmag2 > 0.0) {
+          double re = csource[coord][0], im = csource[coord][1];
+          cdisp2[coord][0] =  im * kvec[axes] / kmag2;
+          cdisp2[coord][1] = -re * kvec[axes] / kmag2;
+        } else {
+          cdisp2[coord][0] = cdisp2[coord][1] = 0.0;
+        }
+      }
+    }
+  }
+}
+
+#ifndef SCALEDEPENDENT
+//======================================================================================================================
+// Cloud-in-cell interpolation of the real grid [field] (with the extra slice from the right task) to the 
+// Lagrangian position of the local particle (n,m,p)
+//======================================================================================================================
+static double interpolate_grid_to_particle(float_kind *field, int n, int m, int p){
+  double u = (double)((n+Local_p_start)*Nmesh)/(double)Nsample;
+  double v = (double)(m*Nmesh)/(double)Nsample;
+  double w = (double)(p*Nmesh)/(double)Nsample;
+
+  int i = (int) u;
+  int j = (int) v;
+  int k = (int) w;
+
+  if(i == (Local_x_start + Local_nx)) i = (Local_x_start + Local_nx) - 1;
+  if(i < Local_x_start)               i = Local_x_start;
+  if(j == Nmesh)                      j = Nmesh - 1;
+  if(k == Nmesh)                      k = Nmesh - 1;
+
+  u -= i;
+  v -= j;
+  w -= k;
+
+  i -= Local_x_start;
+  int ii = i + 1;
+  int jj = j + 1;
+  int kk = k + 1;
+
+  if(jj >= Nmesh) jj -= Nmesh;
+  if(kk >= Nmesh) kk -= Nmesh;
+
+  return field[(i * Nmesh + j)   * (2 * (Nmesh / 2 + 1)) + k]  * (1 - u) * (1 - v) * (1 - w) +
+         field[(i * Nmesh + j)   * (2 * (Nmesh / 2 + 1)) + kk] * (1 - u) * (1 - v) * (w) +
+         field[(i * Nmesh + jj)  * (2 * (Nmesh / 2 + 1)) + k]  * (1 - u) * (v) * (1 - w) +
+         field[(i * Nmesh + jj)  * (2 * (Nmesh / 2 + 1)) + kk] * (1 - u) * (v) * (w) +
+         field[(ii * Nmesh + j)  * (2 * (Nmesh / 2 + 1)) + k]  * (u) * (1 - v) * (1 - w) +
+         field[(ii * Nmesh + j)  * (2 * (Nmesh / 2 + 1)) + kk] * (u) * (1 - v) * (w) +
+         field[(ii * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + k]  * (u) * (v) * (1 - w) +
+         field[(ii * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + kk] * (u) * (v) * (w);
+}
+
+//======================================================================================================================
+// Fourier transform the displacement field along [axes] in place and get the slice from the right neighbour
+//======================================================================================================================
+static void displacement_to_real_space(complex_kind *cfield){
+  float_kind *field = (float_kind *) cfield;
+  plan_kind Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh, Nmesh, Nmesh, cfield, field, MPI_COMM_WORLD, FFTW_ESTIMATE);
+  my_fftw_execute(Inverse_plan);
+  my_fftw_destroy_plan(Inverse_plan);
+  MPI_Sendrecv(&(field[0]), sizeof(float_kind)*2*alloc_slice, MPI_BYTE, LeftTask, 10,
+      &(field[2*last_slice]), sizeof(float_kind)*2*alloc_slice, MPI_BYTE, RightTask, 10, MPI_COMM_WORLD, &status);
+}
+#endif
+#endif
+
 //======================================================================================================================
 // This is the largest routine in the code and is used to generate the 2LPT initial conditions. 
 // It is adapted from the 2LPTic code provided by Marc. 
@@ -177,20 +464,31 @@ void displacement_fields(void) {
   //====================================
   
   gsl_rng * random_generator;
-  int i, j, k, n, m, p, ii, jj, kk, axes;
+  int i, j, k, ii, jj, axes;
   unsigned int * seedtable, q, coord, bytes;
-  unsigned long long nmesh3; 
-  float_kind *(digrad[6]);
   float_kind *(disp[3]), *(disp2[3]);
-  double u, v, w;
   double phase, ampl;
   double kvec[3], kmag, kmag2;
   double sumdis[3], sumdis2[3];
+  double maxdisp, max_disp_glob;
+  complex_kind *(cdisp[3]), *(cdisp2[3]);
+#if !(defined(LOW_MEMORY_2LPT) && defined(SCALEDEPENDENT))
+  int n, m, p;
+  double dis[3], dis2[3];
+#endif
+#if !(defined(LOW_MEMORY_2LPT) && defined(SCALEDEPENDENT)) || defined(LOCAL_FNL)
+  unsigned long long nmesh3; 
+#endif
+#ifndef LOW_MEMORY_2LPT
+  int kk;
+  float_kind *(digrad[6]);
+  double u, v, w;
   double f1, f2, f3, f4, f5, f6, f7, f8;
-  double dis[3], dis2[3], maxdisp, max_disp_glob;
   complex_kind *(cdigrad[6]);
-  complex_kind *(cdisp[3]), *(cdisp2[3]);
+#endif
+#if !defined(LOW_MEMORY_2LPT) || defined(LOCAL_FNL)
   plan_kind Forward_plan, Inverse_plan;
+#endif
 
   //========================================================
   // General parameters for any gaussianity/non-gaussianity
@@ -199,7 +497,9 @@ void displacement_fields(void) {
   double delta;
   double p_of_k;
 #else
+#ifdef LOCAL_FNL
   float_kind *(pot);
+#endif
   double t_of_k;
   double twb, phig, Beta;
   complex_kind *(cpot);
@@ -210,20 +510,18 @@ void displacement_fields(void) {
   //========================================================
 #ifdef GENERIC_FNL
   int ikernel;
-  double kmag0, kmagA, kmagB;
-  double kerCoef, ker0, kerA, kerB;
-  float_kind *(ppA), *(ppB), *(ppC);                                        
-  complex_kind *(cppA), *(cppB), *(cppC);                                  
+  double kmag0;
+  double kerCoef, ker0;
+  float_kind *(ppA), *(ppB);                                        
+  complex_kind *(cppA), *(cppB);                                  
 #endif
 
   //=============================================================
   // Parameters for equilateral or orthogonal fnl non-gaussianity
   //=============================================================
 #if (EQUIL_FNL || ORTHO_FNL)
-  float_kind *(partpot);
-  float_kind *(p1p2p3sym), *(p1p2p3sca), *(p1p2p3nab), *(p1p2p3tre);                                                 
-  complex_kind *(cpartpot);
-  complex_kind *(cp1p2p3sym), *(cp1p2p3sca), *(cp1p2p3nab), *(cp1p2p3tre);
+  float_kind *(potfields);
+  complex_kind *(cpotfields);
 #endif                                               
 
   if(ThisTask == 0) {
@@ -237,10 +535,18 @@ void displacement_fields(void) {
   // Initialize random number generator
   //=============================================================
 
+  // With the counter-based RNG the random numbers are computed directly from the mode (i,j,k) 
+  // unless we want the phases of the seedtable. Then the modes can be generated in parallel
+  int use_seedtable = 1;
+#ifdef COUNTER_BASED_RNG
+  use_seedtable = UseSeedTable;
+#endif
+
   random_generator = gsl_rng_alloc(gsl_rng_ranlxd1);
   gsl_rng_set(random_generator, Seed);
-  if(!(seedtable = malloc(Nmesh * Nmesh * sizeof(unsigned int)))) FatalError((char *)"2LPT.c", 223);
-  for(i = 0; i < Nmesh / 2; i++) {
+  seedtable = NULL;
+  if(use_seedtable && !(seedtable = malloc(Nmesh * Nmesh * sizeof(unsigned int)))) FatalError((char *)"2LPT.c", 223);
+  for(i = 0; use_seedtable && i < Nmesh / 2; i++) {
     for(j = 0; j < i; j++)     seedtable[i * Nmesh + j] = (unsigned int)(0x7fffffff * gsl_rng_uniform(random_generator));
     for(j = 0; j < i + 1; j++) seedtable[j * Nmesh + i] = (unsigned int)(0x7fffffff * gsl_rng_uniform(random_generator));
     for(j = 0; j < i; j++)     seedtable[(Nmesh - 1 - i) * Nmesh + j] = (unsigned int)(0x7fffffff * gsl_rng_uniform(random_generator));
@@ -262,8 +568,8 @@ void displacement_fields(void) {
   }
 
   // Allocate memory and initialize arrays
-  for(axes = 0, bytes = 0; axes < 3; axes++) {
-    cdisp[axes] = malloc(bytes += sizeof(complex_kind) * Total_size);
+  for(axes = 0; axes < 3; axes++) {
+    cdisp[axes] = malloc(bytes = sizeof(complex_kind) * Total_size);
     disp[axes] = (float_kind *) cdisp[axes];
   }
   for(i = 0; i < Local_nx; i++) {
@@ -289,16 +595,29 @@ void displacement_fields(void) {
 
   } else {
     
+#ifdef SCALEDEPENDENT
     //=====================================================================
     // If the power-spectrum we read is assumed to be for LCDM
     // then we need to rescale it. If LCDM then the ratio below is just 1
     //=====================================================================
     double sigma8_mg_over_sigma8_lcdm_pow2 = pow( mg_sigma8_enhancement(1.0), 2);
 
+    // D(k, a=1) / DLCDM(a=1) in the k-bins so that each mode only needs a linear interpolation
+    SplineArrayAtFixedTime growth_ratio_today;
+    if(modified_gravity_active)
+      create_mg_growth_ratio_at_fixed_time(1.0, &growth_ratio_today);
+#endif
+
     //=========================================
-    // Create IC from skratch
+    // Create IC from skratch. Without 
+    // SCALEDEPENDENT the fields are for LCDM, 
+    // the modified gravity P(k) is applied in 
+    // mg_rescale_displacement_fields
     //=========================================
 
+#if defined(COUNTER_BASED_RNG) && defined(_OPENMP)
+    #pragma omp parallel for private(j, k, ii, jj, axes, coord, kvec, kmag, kmag2, phase, ampl, delta, p_of_k) schedule(dynamic) if(!use_seedtable)
+#endif
     for(i = 0; i < Nmesh; i++) {
       ii = Nmesh - i;
       if(ii == Nmesh) ii = 0;
@@ -306,13 +625,19 @@ void displacement_fields(void) {
           (ii >= Local_x_start && ii < (Local_x_start + Local_nx))) {
 
         for(j = 0; j < Nmesh; j++) {
-          gsl_rng_set(random_generator, seedtable[i * Nmesh + j]); 
+          if(use_seedtable) gsl_rng_set(random_generator, seedtable[i * Nmesh + j]); 
 
           for(k = 0; k < Nmesh / 2; k++) {
-            phase = gsl_rng_uniform(random_generator) * 2 * PI;
-            do {
-              ampl = gsl_rng_uniform(random_generator);
-            } while(ampl == 0);
+            if(use_seedtable) {
+              phase = gsl_rng_uniform(random_generator) * 2 * PI;
+              do {
+                ampl = gsl_rng_uniform(random_generator);
+              } while(ampl == 0);
+            } else {
+#ifdef COUNTER_BASED_RNG
+              philox_random_mode(Seed, i, j, k, &phase, &ampl);
+#endif
+            }
 
             if(i == Nmesh / 2 || j == Nmesh / 2 || k == Nmesh / 2) continue;
             if(i == 0 && j == 0 && k == 0) continue;
@@ -349,11 +674,15 @@ void displacement_fields(void) {
             p_of_k  = PowerSpec(kmag);
             p_of_k *= -log(ampl);
 
+#ifdef SCALEDEPENDENT
             //====================================================================================
             // The power-spectrum we read in is assumed to be for LCDM so rescale it to get MG P(k)
             //====================================================================================
-            if(modified_gravity_active)
-              p_of_k *= mg_pofk_ratio(kmag, 1.0);
+            if(modified_gravity_active){
+              double growth_ratio;
+              splinearray_lookup_at_fixed_time(&growth_ratio_today, &kmag, &growth_ratio, 1);
+              p_of_k *= growth_ratio * growth_ratio;
+            }
             
             //=============================================
             // Since we generate at a = 1 here we need to 
@@ -363,6 +692,7 @@ void displacement_fields(void) {
             //=============================================
             if( ! input_sigma8_is_for_lcdm)
               p_of_k /= sigma8_mg_over_sigma8_lcdm_pow2;
+#endif
 
             delta = pow(Box,-1.5) * sqrt(p_of_k);  // keep at redshift 0.0
 
@@ -420,6 +750,10 @@ void displacement_fields(void) {
         }
       }
     }
+#ifdef SCALEDEPENDENT
+    if(modified_gravity_active)
+      free_splinearray_at_fixed_time(&growth_ratio_today);
+#endif
   }
 
   //=========================================
@@ -438,7 +772,9 @@ void displacement_fields(void) {
   //=========================================
   bytes = 0;
   cpot = malloc(bytes += sizeof(complex_kind) * Total_size);
+#ifdef LOCAL_FNL
   pot = (float_kind *) cpot;
+#endif
   for(i = 0; i < Local_nx; i++) {
     for(j = 0; j < Nmesh; j++)     {
       for(k = 0; k <= Nmesh / 2; k++) {
@@ -455,6 +791,9 @@ void displacement_fields(void) {
   //==========================================================
   Beta = 1.5 * Omega / FnlTime / ( INVERSE_H0_MPCH * INVERSE_H0_MPCH );
 
+#if defined(COUNTER_BASED_RNG) && defined(_OPENMP)
+  #pragma omp parallel for private(j, k, ii, jj, coord, kvec, kmag, kmag2, phase, ampl, phig) schedule(dynamic) if(!use_seedtable)
+#endif
   for(i = 0; i < Nmesh; i++) {
     ii = Nmesh - i;
     if(ii == Nmesh) ii = 0;
@@ -462,13 +801,19 @@ void displacement_fields(void) {
         (ii >= Local_x_start && ii < (Local_x_start + Local_nx))) {
 
       for(j = 0; j < Nmesh; j++) {
-        gsl_rng_set(random_generator, seedtable[i * Nmesh + j]);
+        if(use_seedtable) gsl_rng_set(random_generator, seedtable[i * Nmesh + j]);
 
         for(k = 0; k < Nmesh / 2; k++) {
-          phase = gsl_rng_uniform(random_generator) * 2* PI;
-          do {
-            ampl = gsl_rng_uniform(random_generator);
-          } while(ampl == 0);
+          if(use_seedtable) {
+            phase = gsl_rng_uniform(random_generator) * 2* PI;
+            do {
+              ampl = gsl_rng_uniform(random_generator);
+            } while(ampl == 0);
+          } else {
+#ifdef COUNTER_BASED_RNG
+            philox_random_mode(Seed, i, j, k, &phase, &ampl);
+#endif
+          }
 
           if(i == Nmesh / 2 || j == Nmesh / 2 || k == Nmesh / 2) continue; 
           if(i == 0 && j == 0 && k == 0) continue;
@@ -564,215 +909,62 @@ void displacement_fields(void) {
   //==========================================================
 #ifdef GENERIC_FNL
 
-  // Allocate memory
-  cppA = (complex_kind *) calloc(Total_size, sizeof(complex_kind));
-  cppB = (complex_kind *) calloc(Total_size, sizeof(complex_kind));
-  cppC = (complex_kind *) calloc(Total_size, sizeof(complex_kind));
+  read_kernel_table();
+  group_kernel_table();
+
+  //=======================================================================
+  // Eq A1 of Scoccimarro et al 1108.5512, only k dependence is relevant since 
+  // normalization terms in the power cancel because ker0+kerA+kerB == 0
+  // Every distinct field k^((ns-4) kerA) * pot is computed once and all of 
+  // them are Fourier transformed together (interleaved, batched FFT). This
+  // needs NKernelExponents complex grids so the memory grows with the table
+  //=======================================================================
+  double *kpower = malloc(sizeof(double) * NKernelExponents);
+  for(ikernel = 0; ikernel < NKernelExponents; ikernel++) kpower[ikernel] = (PrimordialIndex - 4.0) * KernelExponents[ikernel];
+
+  cppA = malloc(sizeof(complex_kind) * Total_size * NKernelExponents);
   ppA  = (float_kind *) cppA;
+  cppB = malloc(sizeof(complex_kind) * Total_size);
   ppB  = (float_kind *) cppB;
-  ppC  = (float_kind *) cppC;
-
-  read_kernel_table();
-
-  for(ikernel = 0; ikernel < NKernelTable; ikernel++) {
-    kerCoef=KernelTable[ikernel].Coef;
-    ker0=KernelTable[ikernel].ker0;
-    kerA=KernelTable[ikernel].kerA;
-    kerB=KernelTable[ikernel].kerB;
-
-    if (ThisTask == 0) printf("\nKernel table line %d\n-------------------\n", ikernel);
-
-    if(fabs(ker0+kerA+kerB) < 0.000000001) {
-      if(ker0+kerA+kerB != 0.0) ker0 = - ( kerA + kerB );
-      if(ThisTask == 0) printf("Adjusting ker0 = - (kerA + kerB), ker0=%f, kerA=%f, kerB=%f\n", ker0,kerA,kerB);
-    } else {
-      if(ThisTask == 0) printf("\nERROR: ker0 + kerA + kerB does not equal 0\n"); 
-      FatalError((char *)"2LPT.c", 534);
-    }
-
-    if(ThisTask == 0) printf("Values: %lf %lf %lf %lf\n",kerCoef,ker0,kerA,kerB);
-
-    for(ii = 0; ii < Local_nx; ii++) {
-      for(j = 0; j < Nmesh; j++)       {
-        for(k = 0; k <= Nmesh / 2 ; k++) {
-          i = ii + Local_x_start;
-          coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-          cppA[coord][0] = 0.0;
-          cppA[coord][1] = 0.0;
-          cppB[coord][0] = 0.0;
-          cppB[coord][1] = 0.0;
-
-          if((i == 0) && (j == 0) && (k == 0)) continue;
-
-          if(i < Nmesh / 2) {
-            kvec[0] = i * 2 * PI / Box;
-          } else {
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-          }
 
-          if(j < Nmesh / 2) {
-            kvec[1] = j * 2 * PI / Box;
-          } else {
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-          }
-
-          if(k < Nmesh / 2) {
-            kvec[2] = k * 2 * PI / Box;
-          } else {
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-          }
-
-          kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-          kmag = sqrt(kmag2);
-
-          if(SphereMode == 1) {
-            if(kmag * Box / (2 * PI) > Nsample / 2) continue;  // select a sphere in k-space
-          } else {
-            if(fabs(kvec[0]) * Box / (2 * PI) > Nsample / 2) continue;
-            if(fabs(kvec[1]) * Box / (2 * PI) > Nsample / 2) continue;
-            if(fabs(kvec[2]) * Box / (2 * PI) > Nsample / 2) continue;
-          }
-
-          //=======================================================================
-          // Eq A1 of Scoccimarro et al 1108.5512, only k dependence is relevant since 
-          // normalization terms in the power cancel because ker0+kerA+kerB == 0
-          //=======================================================================
-          kmagA = exp((PrimordialIndex - 4.0) * kerA * log(kmag2) * 0.5); 
-          kmagB = exp((PrimordialIndex - 4.0) * kerB * log(kmag2) * 0.5);
-
-          cppA[coord][0] = kmagA * cpot[coord][0];
-          cppA[coord][1] = kmagA * cpot[coord][1];
-
-          cppB[coord][0] = kmagB * cpot[coord][0];
-          cppB[coord][1] = kmagB * cpot[coord][1]; 
-        }
-      }
+  if(ThisTask == 0) printf("Fourier transforming %d initial potentials k^A * pot to configuration...\n", NKernelExponents);
+  potential_times_kpowers(cpot, cppA, NKernelExponents, kpower);
+  batched_fft_to_real_space(cppA, NKernelExponents);
+
+  //=======================================================================
+  // The rows are sorted on ker0 so we add up Coef * A * B in real space for 
+  // all rows with the same ker0 and then transform and apply k^ker0 once
+  //=======================================================================
+  for(ikernel = 0; ikernel < NKernelTable; ) {
+    ker0 = KernelTable[ikernel].ker0;
+    for(q = 0; q < 2 * Total_size; q++) ppB[q] = 0.0;
+
+    for(; ikernel < NKernelTable && fabs(KernelTable[ikernel].ker0 - ker0) < 0.000000001; ikernel++) {
+      kerCoef = KernelTable[ikernel].Coef;
+      float_kind *A = ppA + KernelTable[ikernel].indA;
+      float_kind *B = ppA + KernelTable[ikernel].indB;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for(unsigned int r = 0; r < 2 * Total_size; r++) ppB[r] += kerCoef * A[NKernelExponents * r] * B[NKernelExponents * r];
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    if(ThisTask == 0) printf("Fourier transforming initial potential ppA to configuration...\n");
-    Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh,Nmesh,Nmesh,cppA,ppA,MPI_COMM_WORLD,FFTW_ESTIMATE);
-    my_fftw_execute(Inverse_plan);
-    my_fftw_destroy_plan(Inverse_plan);
-
-    if(ThisTask == 0) printf("Fourier transforming initial potential ppB to configuration...\n");
-    Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh,Nmesh,Nmesh,cppB,ppB,MPI_COMM_WORLD,FFTW_ESTIMATE);
-    my_fftw_execute(Inverse_plan);
-    my_fftw_destroy_plan(Inverse_plan);
-
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    //===============================
-    // add the terms in real space
-    //===============================
-    for(i = 0; i < Local_nx; i++) {
-      for(j = 0; j < Nmesh; j++)    {
-        for(k = 0; k < Nmesh; k++)    {
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k; 
-          ppA[coord] = ppA[coord]*ppB[coord];                     // ppA simply accoumulates A*B
-        }
-      }
-    } 
-
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    if(ThisTask == 0) printf("Fourier transforming convolution to fourier space...\n");
-    Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,ppA,cppA,MPI_COMM_WORLD,FFTW_ESTIMATE);
-    my_fftw_execute(Forward_plan);
-    my_fftw_destroy_plan(Forward_plan);
+    if(ThisTask == 0) printf("Fourier transforming convolution with ker0 = %lf to fourier space...\n", ker0);
+    batched_fft_to_fourier_space(cppB, 1);
 
     //=======================================================================
-    // apply ker0 to the convolution of A and B
-    // remove the N^3 I got by forward fourier transforming and put zero to zero mode
+    // apply ker0 to the convolution of A and B, remove the N^3 I got by 
+    // forward fourier transforming and add to the potential
     //=======================================================================
-    nmesh3 = ((unsigned long long) Nmesh) * ((unsigned long long) Nmesh ) * ((unsigned long long) Nmesh);    
-    for(ii = 0; ii < Local_nx; ii++) {
-      for(j = 0; j < Nmesh; j++)       {
-        for(k = 0; k <= Nmesh / 2 ; k++) {
-          i = ii + Local_x_start;
-          coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-          //=============================================
-          // coord = 0 is the fundamental mode in k-space
-          //=============================================
-          if(i == 0 && j == 0 && k == 0) {
-            cppC[coord][0]=0.; 
-            cppC[coord][1]=0.; 
-            continue; 
-          }   
-
-          if(i < Nmesh / 2) {
-            kvec[0] = i * 2 * PI / Box;
-          } else {
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-          }
-
-          if(j < Nmesh / 2) {
-            kvec[1] = j * 2 * PI / Box;
-          } else {
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-          }
-
-          if(k < Nmesh / 2) {
-            kvec[2] = k * 2 * PI / Box;
-          } else {
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-          }
-
-          kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-          kmag = sqrt(kmag2);
-
-          if(SphereMode == 1) {
-            if(kmag * Box / (2 * PI) > Nsample / 2) continue;  // select a sphere in k-space
-          } else {
-            if(fabs(kvec[0]) * Box / (2 * PI) > Nsample / 2) continue;
-            if(fabs(kvec[1]) * Box / (2 * PI) > Nsample / 2) continue;
-            if(fabs(kvec[2]) * Box / (2 * PI) > Nsample / 2) continue;
-          }
-
-          //================================================================================
-          // Eq A1 of Scoccimarro et al 1108.5512, only the k dependence is relevant since 
-          // normalization terms in the power cancel because ker0+kerA+kerB == 0
-          //================================================================================
-
-          //================================================================================
-          // All ikernel terms are accomulated to cppC
-          //================================================================================
-          kmag0 = exp((PrimordialIndex - 4.0) * ker0 * log(kmag2) * 0.5); 
-
-          cppC[coord][0] = cppC[coord][0] + kerCoef * kmag0 * cppA[coord][0] / (double) nmesh3;   //cppA accumulated A*B earlier
-          cppC[coord][1] = cppC[coord][1] + kerCoef * kmag0 * cppA[coord][1] / (double) nmesh3;   //cppA accumulated A*B earlier               
-        }
-      }
-    }
-    MPI_Barrier(MPI_COMM_WORLD);
+    kmag0 = (PrimordialIndex - 4.0) * ker0;
+    add_quadratic_terms_to_potential(cpot, cppB, 1, &kmag0, Fnl, 1);
   }
-
-  //==========================================
-  // add the linear (i.e, non quadratic) part
-  //==========================================
-  for(ii = 0; ii < Local_nx; ii++) {
-    for(j = 0; j < Nmesh; j++)       {
-      for(k = 0; k <= Nmesh / 2; k++)  {
-        i = ii + Local_x_start;
-        coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-        //=================================================
-        // cpot has linear part + cppC has quadratic part 
-        //=================================================
-        cpot[coord][0] = cpot[coord][0] + Fnl * cppC[coord][0];   
-        cpot[coord][1] = cpot[coord][1] + Fnl * cppC[coord][1];             
-      }
-    }
-  } 
   MPI_Barrier(MPI_COMM_WORLD);
 
   // Free up memory
   free(cppA);
   free(cppB);
-  free(cppC);
+  free(kpower);
 
   //===================================================================================
   // Specific type of non-gaussianity (local, equilateral or orthogonal) for n_s=1 only
@@ -831,223 +1023,54 @@ void displacement_fields(void) {
   //=================================================
 #else
 
-  // Allocate memory for partpotential
-  cpartpot   = malloc(bytes = sizeof(complex_kind) * Total_size);
-  cp1p2p3sym = malloc(bytes = sizeof(complex_kind) * Total_size);
-  cp1p2p3sca = malloc(bytes = sizeof(complex_kind) * Total_size);
-  cp1p2p3nab = malloc(bytes = sizeof(complex_kind) * Total_size);
-  cp1p2p3tre = malloc(bytes = sizeof(complex_kind) * Total_size);
-  partpot    = (float_kind *) cpartpot;
-  p1p2p3sym  = (float_kind *) cp1p2p3sym;
-  p1p2p3sca  = (float_kind *) cp1p2p3sca;
-  p1p2p3nab  = (float_kind *) cp1p2p3nab;
-  p1p2p3tre  = (float_kind *) cp1p2p3tre;
-
-  // Initialize
-  for(i = 0; i < Local_nx; i++) {
-    for(j = 0; j < Nmesh; j++)     {
-      for(k = 0; k <= Nmesh / 2; k++) {
-        coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-        cp1p2p3sym[coord][0] = 0;
-        cp1p2p3sym[coord][1] = 0;
-        cp1p2p3sca[coord][0] = 0;
-        cp1p2p3sca[coord][1] = 0;
-        cp1p2p3nab[coord][0] = 0;
-        cp1p2p3nab[coord][1] = 0;
-        cp1p2p3tre[coord][0] = 0;
-        cp1p2p3tre[coord][1] = 0;
-        cpartpot[coord][0] = 0;
-        cpartpot[coord][1] = 0;
-      }
-    }
-  }
-
-  // multiply by k  
-  for(ii = 0; ii < Local_nx; ii++) {
-    for(j = 0; j < Nmesh; j++)       {
-      for(k = 0; k <= Nmesh / 2; k++)  {
-
-        i = ii + Local_x_start;
-        coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-        if(i < Nmesh / 2) {
-          kvec[0] = i * 2 * PI / Box;
-        } else {
-          kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-        }
-
-        if(j < Nmesh / 2) {
-          kvec[1] = j * 2 * PI / Box;
-        } else {
-          kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-        }
-
-        if(k < Nmesh / 2) {
-          kvec[2] = k * 2 * PI / Box;
-        } else {
-          kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-        }
-
-        kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-        kmag = sqrt(kmag2);
-
-        cpartpot[coord][0] = kmag * cpot[coord][0];
-        cpartpot[coord][1] = kmag * cpot[coord][1];
-
-        cp1p2p3nab[coord][0] = kmag2 * cpot[coord][0];
-        cp1p2p3nab[coord][1] = kmag2 * cpot[coord][1]; 
-      }
-    }
-  }
-  MPI_Barrier(MPI_COMM_WORLD);
-
   //=================================================
-  // Fourier transform back to real space
+  // The potential, |k| pot and k^2 pot interleaved
+  // and transformed to real space together
   //=================================================
+  double kpower[3] = {0.0, 1.0, 2.0};
+  cpotfields = malloc(sizeof(complex_kind) * Total_size * 3);
+  potfields  = (float_kind *) cpotfields;
 
-  if(ThisTask == 0) printf("Fourier transforming initial potential to configuration...\n");
-  Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh,Nmesh,Nmesh,cpot,pot,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Inverse_plan);
-  my_fftw_destroy_plan(Inverse_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming partpotential to configuration...\n");
-  Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh,Nmesh,Nmesh,cpartpot,partpot,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Inverse_plan);
-  my_fftw_destroy_plan(Inverse_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming nabpotential to configuration...\n");
-  Inverse_plan = my_fftw_mpi_plan_dft_c2r_3d(Nmesh,Nmesh,Nmesh,cp1p2p3nab,p1p2p3nab,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Inverse_plan);
-  my_fftw_destroy_plan(Inverse_plan);
-
-  MPI_Barrier(MPI_COMM_WORLD);
+  if(ThisTask == 0) printf("Fourier transforming initial potential, partpotential and nabpotential to configuration...\n");
+  potential_times_kpowers(cpot, cpotfields, 3, kpower);
+  batched_fft_to_real_space(cpotfields, 3);
 
   //=================================================
-  // Multiplying terms in real space
+  // Multiplying terms in real space and combine them
+  // by the k-factor they get in fourier space
+  // 1       : pot^2
+  // 1/|k|   : pot * partpot
+  // 1/k^2   : partpot^2 and pot * nabpot
   //=================================================
-  for(i = 0; i < Local_nx; i++) {
-    for(j = 0; j < Nmesh; j++)    {
-      for(k = 0; k < Nmesh; k++)    {
-        coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k; 
-        p1p2p3sym[coord] = partpot[coord]*partpot[coord];
-        p1p2p3sca[coord] = pot[coord]*partpot[coord];   
-        p1p2p3nab[coord] = pot[coord]*p1p2p3nab[coord];
-        p1p2p3tre[coord] = p1p2p3nab[coord]*partpot[coord];
-        partpot[coord] = pot[coord]*pot[coord];                 // NOTE: now partpot is potential squared
-      }
-    }
+#ifdef EQUIL_FNL
+  const double coef_pot2 = -3.0, coef_sym = -2.0, coef_sca = 4.0,  coef_nab = 2.0;
+#endif
+#ifdef ORTHO_FNL 
+  const double coef_pot2 = -9.0, coef_sym = -8.0, coef_sca = 10.0, coef_nab = 8.0;
+#endif
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(unsigned int r = 0; r < 2 * Total_size; r++) {
+    double phi     = potfields[3 * r];
+    double partphi = potfields[3 * r + 1];
+    double nabphi  = potfields[3 * r + 2];
+    potfields[3 * r]     = coef_pot2 * phi * phi;
+    potfields[3 * r + 1] = coef_sca * phi * partphi;
+    potfields[3 * r + 2] = coef_sym * partphi * partphi + coef_nab * phi * nabphi;
   }
 
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  if(ThisTask == 0) printf("Fourier transforming potential ...\n");
-  Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,pot,cpot,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Forward_plan);
-  my_fftw_destroy_plan(Forward_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming squared potential ...\n");
-  Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,partpot,cpartpot,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Forward_plan);
-  my_fftw_destroy_plan(Forward_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming p1p2p3sym potential ...\n");
-  Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,p1p2p3sym,cp1p2p3sym,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Forward_plan);
-  my_fftw_destroy_plan(Forward_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming p1p2p3sca potential ...\n");
-  Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,p1p2p3sca,cp1p2p3sca,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Forward_plan);
-  my_fftw_destroy_plan(Forward_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming p1p2p3nab potential ...\n");
-  Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,p1p2p3nab,cp1p2p3nab,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Forward_plan);
-  my_fftw_destroy_plan(Forward_plan);
-
-  if(ThisTask == 0) printf("Fourier transforming p1p2p3tre potential ...\n");
-  Forward_plan = my_fftw_mpi_plan_dft_r2c_3d(Nmesh,Nmesh,Nmesh,p1p2p3tre,cp1p2p3tre,MPI_COMM_WORLD,FFTW_ESTIMATE);
-  my_fftw_execute(Forward_plan);
-  my_fftw_destroy_plan(Forward_plan);
-
-  MPI_Barrier(MPI_COMM_WORLD);
+  if(ThisTask == 0) printf("Fourier transforming the quadratic terms ...\n");
+  batched_fft_to_fourier_space(cpotfields, 3);
 
   //====================================================================================
   // Divide by appropiate k's, sum terms according to non-local model 
-  // remove the N^3 I got by forward fourier transforming and put zero to zero mode 
+  // remove the N^3 I got by forward fourier transforming and keep zero in zero mode 
   //====================================================================================
-  nmesh3 = ((unsigned long long) Nmesh) * ((unsigned long long) Nmesh ) * ((unsigned long long) Nmesh);    
-  for(ii = 0; ii < Local_nx; ii++) {
-    for(j = 0; j < Nmesh; j++)       {
-      for(k = 0; k <= Nmesh / 2 ; k++) {
-        i = ii + Local_x_start;
-        coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
+  double kpower_inv[3] = {0.0, -1.0, -2.0};
+  add_quadratic_terms_to_potential(cpot, cpotfields, 3, kpower_inv, Fnl, 0);
 
-        if(i < Nmesh / 2) {
-          kvec[0] = i * 2 * PI / Box;
-        } else {
-          kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-        }
-
-        if(j < Nmesh / 2) {
-          kvec[1] = j * 2 * PI / Box;
-        } else {
-          kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-        }
-
-        if(k < Nmesh / 2) {
-          kvec[2] = k * 2 * PI / Box;
-        } else {
-          kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-        }
-
-        kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-        kmag = sqrt(kmag2);
-
-        if(i == 0 && j == 0 && k == 0) {
-          cpot[0][0]=0.;
-          cpot[0][1]=0.;
-          continue;
-        }
-
-        //===================     
-        // F_nl equilateral
-        //===================     
-#ifdef EQUIL_FNL
-
-        cpot[coord][0] = cpot[coord][0] + Fnl * (-3*cpartpot[coord][0] - 2*cp1p2p3sym[coord][0] / kmag2 + 4*cp1p2p3sca[coord][0] /kmag + 2*cp1p2p3nab[coord][0] / kmag2);
-        cpot[coord][1] = cpot[coord][1] + Fnl * (-3*cpartpot[coord][1] - 2*cp1p2p3sym[coord][1] / kmag2 + 4*cp1p2p3sca[coord][1] /kmag + 2*cp1p2p3nab[coord][1] / kmag2); 
-        cpot[coord][0] /= (double) nmesh3; 
-        cpot[coord][1] /= (double) nmesh3; 
-
-#endif
-
-        //===================     
-        // F_nl othogonal
-        //===================     
-#ifdef ORTHO_FNL 
-
-        cpot[coord][0] = cpot[coord][0] + Fnl * (-9*cpartpot[coord][0] - 8*cp1p2p3sym[coord][0] / kmag2 + 10*cp1p2p3sca[coord][0] /kmag + 8*cp1p2p3nab[coord][0] / kmag2);
-        cpot[coord][1] = cpot[coord][1] + Fnl * (-9*cpartpot[coord][1] - 8*cp1p2p3sym[coord][1] / kmag2 + 10*cp1p2p3sca[coord][1] /kmag + 8*cp1p2p3nab[coord][1] / kmag2);
-        cpot[coord][0] /= (double) nmesh3; 
-        cpot[coord][1] /= (double) nmesh3; 
-
-#endif
-
-        if(i == 0 && j == 0 && k == 0) {
-          cpot[0][0]=0.;
-          cpot[0][1]=0.;
-          continue;
-        }
-      }
-    }
-  }
-
-  free(cpartpot);
-  free(cp1p2p3sym);
-  free(cp1p2p3sca);
-  free(cp1p2p3nab);
-  free(cp1p2p3tre);
+  free(cpotfields);
 
 #endif
 
@@ -1063,8 +1086,8 @@ void displacement_fields(void) {
   }
 
   // Allocate memory
-  for(axes = 0, bytes = 0; axes < 3; axes++) {
-    cdisp[axes] = malloc(bytes += sizeof(complex_kind) * Total_size);
+  for(axes = 0; axes < 3; axes++) {
+    cdisp[axes] = malloc(bytes = sizeof(complex_kind) * Total_size);
     disp[axes] = (float_kind *) cdisp[axes];
   }
 
@@ -1137,6 +1160,112 @@ void displacement_fields(void) {
     fflush(stdout);
   }
 
+#ifdef LOW_MEMORY_2LPT
+
+  //================================================================
+  // Low memory version: at most cdisp[3] + 2 grids are allocated
+  // The source is accumulated term by term and the buffers of cdisp
+  // are reused for the 2LPT displacements after the ZA readout.
+  // With SCALEDEPENDENT we keep all six k-space displacement grids
+  // so here the 2LPT displacements go in the source grid, the 
+  // derivative grid and one new grid (6 grids in total)
+  //================================================================
+#ifdef SCALEDEPENDENT
+  complex_kind *cgrad;
+  complex_kind *csource = compute_2LPT_source_low_memory(cdisp, &cgrad);
+#else
+  complex_kind *csource = compute_2LPT_source_low_memory(cdisp, NULL);
+#endif
+  report_peak_memory((char *)"after computing the 2LPT source (5 grids)");
+
+  gsl_rng_free(random_generator);
+  free(seedtable);
+
+#ifdef SCALEDEPENDENT
+
+  // Store the initial displacment-field. We hand over the grids instead of copying them
+  if(ThisTask == 0) printf("Store the initial displacementfield...\n");
+  // The last 2LPT displacement is computed in place in the source grid
+  for(axes = 0; axes < 3; axes++) {
+    cdisp2[axes] = (axes == 0 ? cgrad : (axes == 1 ? malloc(sizeof(complex_kind) * Total_size) : csource));
+    disp2[axes]  = (float_kind *) cdisp2[axes];
+    source_to_2LPT_displacement(csource, cdisp2[axes], axes);
+  }
+  for(axes = 0; axes < 3; axes++) {
+    cdisp_store[axes]  = cdisp[axes];
+    disp_store[axes]   = disp[axes];
+    cdisp2_store[axes] = cdisp2[axes];
+    disp2_store[axes]  = disp2[axes];
+  }
+
+  report_peak_memory((char *)"after storing the initial displacementfield");
+  timer_stop(_DisplacementFields);
+  return;
+
+#else
+
+  nmesh3 = ((unsigned long long ) Nmesh ) * ((unsigned long long) Nmesh) *  ((unsigned long long) Nmesh);
+
+  for(axes = 0; axes < 3; axes++) {
+#ifdef MEMORY_MODE
+    ZA[axes]  = malloc(NumPart*sizeof(float));
+    LPT[axes] = malloc(NumPart*sizeof(float));
+#else
+    ZA[axes]  = malloc(NumPart*sizeof(float_kind));
+    LPT[axes] = malloc(NumPart*sizeof(float_kind));
+#endif
+    sumdis[axes] = 0;
+    sumdis2[axes] = 0;    
+  }
+
+  // Read-out the ZA displacements
+  for(axes = 0; axes < 3; axes++) {
+    if(ThisTask == 0) printf("Fourier transforming ZA displacements, axis %d\n",axes);
+    displacement_to_real_space(cdisp[axes]);
+
+    for (n = 0; n < Local_np; n++) {
+      for (m = 0; m < Nsample; m++) {
+        for (p = 0; p < Nsample; p++) {
+          coord = (n * Nsample + m) * (Nsample) + p;
+          dis[axes] = interpolate_grid_to_particle(disp[axes], n, m, p);
+          ZA[axes][coord] = dis[axes];
+          sumdis[axes]   += dis[axes];
+        }
+      }
+    }
+  }
+
+  // Solve the Poisson eq. for the 2nd order displacements reusing the cdisp grids
+  for(axes = 0; axes < 3; axes++) {
+    cdisp2[axes] = cdisp[axes];
+    disp2[axes]  = (float_kind *) cdisp2[axes];
+    source_to_2LPT_displacement(csource, cdisp2[axes], axes);
+  }
+  free(csource);
+
+  // Read-out the 2nd order displacements
+  for(axes = 0; axes < 3; axes++) {
+    if(ThisTask == 0) printf("Fourier transforming 2LPT displacements, axis %d\n",axes);
+    displacement_to_real_space(cdisp2[axes]);
+
+    for (n = 0; n < Local_np; n++) {
+      for (m = 0; m < Nsample; m++) {
+        for (p = 0; p < Nsample; p++) {
+          coord = (n * Nsample + m) * (Nsample) + p;
+          dis2[axes] = interpolate_grid_to_particle(disp2[axes], n, m, p) / (double) nmesh3;
+          LPT[axes][coord] = -3./7.*dis2[axes];
+          sumdis2[axes]   += -3./7.*dis2[axes];
+
+          if(fabs(ZA[axes][coord] - 3./7. * dis2[axes]) > maxdisp) maxdisp = fabs(ZA[axes][coord] - 3./7. * dis2[axes]);
+        }
+      }
+    }
+  }
+
+#endif
+
+#else
+
   // Allocate memory
   for(i = 0; i < 6; i++) {
     cdigrad[i] = malloc(bytes = sizeof(complex_kind) * Total_size);
@@ -1286,6 +1415,7 @@ void displacement_fields(void) {
   gsl_rng_free(random_generator);
   free(seedtable);
   nmesh3 = ((unsigned long long ) Nmesh ) * ((unsigned long long) Nmesh) *  ((unsigned long long) Nmesh);
+  report_peak_memory((char *)"after storing the initial displacementfield");
   timer_stop(_DisplacementFields);
   return;
 
@@ -1406,6 +1536,8 @@ void displacement_fields(void) {
     }
   }
 
+#endif
+
   //======================================================================
   // Make sure the average of the displacements is zero.
   //======================================================================
@@ -1416,7 +1548,9 @@ void displacement_fields(void) {
     sumdis2[axes] /= (double)TotNumPart;
   }
   for(axes = 0; axes < 3; axes++) free(cdisp[axes]);
+#ifndef LOW_MEMORY_2LPT
   for(axes = 0; axes < 3; axes++) free(cdisp2[axes]);
+#endif
 
   for(q = 0; q < NumPart; q++) {
     for(axes = 0; axes < 3; axes++) {
@@ -1433,11 +1567,39 @@ void displacement_fields(void) {
     printf("Maximum displacement = %lf kpc/h (%lf in units of the particle separation)...\n\n",max_disp_glob, max_disp_glob / (Box / Nmesh));
     fflush(stdout);
   }
+  report_peak_memory((char *)"after generating the displacement fields");
 
   timer_stop(_DisplacementFields);
   return;
 }
 
+//====================================================================================
+// Without SCALEDEPENDENT displacement_fields generates the Gaussian IC with the LCDM
+// power-spectrum (this is what we store with UseICCache). Here we rescale them to the
+// modified gravity P(k): P(k) -> P(k) * P_MG(k) / P_LCDM(k) at a = 1, divided by 
+// (sigma8/sigma8_LCDM)^2 if the Sigma8 provided is not for LCDM. This factor is a 
+// constant so ZA is multiplied by its square root and LPT by the factor itself, 
+// which is the same as rescaling P(k) before computing the 2LPT field. With 
+// SCALEDEPENDENT the 2LPT field is not a simple rescaling of the LCDM one so the 
+// MG P(k) is applied when generating the fields (and the IC cache depends on the model)
+//====================================================================================
+void mg_rescale_displacement_fields(void){
+#if defined(GAUSSIAN) && !defined(SCALEDEPENDENT)
+  if(! modified_gravity_active || ReadParticlesFromFile) return;
+
+  double sigma8_fac = input_sigma8_is_for_lcdm ? 1.0 : 1.0 / mg_sigma8_enhancement(1.0);
+  double fac = sqrt(mg_pofk_ratio(1.0, 1.0)) * sigma8_fac;
+  for(int axes = 0; axes < 3; axes++) {
+    for(unsigned int q = 0; q < NumPart; q++) {
+      ZA[axes][q]  *= fac;
+      LPT[axes][q] *= fac * fac;
+    }
+  }
+
+  if(ThisTask == 0) printf("Rescaled the displacement fields to the modified gravity P(k) by a factor %f\n\n", fac);
+#endif
+}
+
 #ifdef SCALEDEPENDENT
 
 void store_initial_displacement_field(complex_kind *(cdisp[3]), complex_kind *(cdisp2[3])){
@@ -1461,7 +1623,7 @@ void store_initial_displacement_field(complex_kind *(cdisp[3]), complex_kind *(c
   // Allocate memory
   for(int axes = 0; axes < 3; axes++){
     cdisp2_store[axes] = malloc(sizeof(complex_kind) * Total_size);
-    disp2_store[axes] = (float_kind *) cdisp_store[axes];
+    disp2_store[axes] = (float_kind *) cdisp2_store[axes];
   }
 
   // Store the second order displacment-field
@@ -1490,22 +1652,8 @@ void free_stored_initial_displacment_field(){
 void from_cdisp_store_to_ZA(double A, double AF, double AFF, int firststep, int LPTorder){
   unsigned long long nmesh3 = ((unsigned long long) Nmesh) * ((unsigned long long) Nmesh ) * ((unsigned long long) Nmesh);    
 
-  // Growth-factor to given LPT order
-  double (*func_growth_D_scaledependent)(double, double) = NULL;
-  double (*func_growth_dDdy_scaledependent)(double, double) = NULL;
-  double (*func_growth_ddDddy_scaledependent)(double, double) = NULL;
   double normfactor = 1.0;
-  if(LPTorder == 1){
-    func_growth_D_scaledependent      = &growth_D_scaledependent;
-    func_growth_dDdy_scaledependent   = &growth_dDdy_scaledependent;
-    func_growth_ddDddy_scaledependent = &growth_ddDddy_scaledependent;
-    normfactor = 1.0; 
-  } else if(LPTorder == 2){
-    func_growth_D_scaledependent      = &growth_D2_scaledependent;
-    func_growth_dDdy_scaledependent   = &growth_dD2dy_scaledependent;
-    func_growth_ddDddy_scaledependent = &growth_ddD2ddy_scaledependent;
-    normfactor = -3.0 / 7.0 / (double) nmesh3; 
-  }
+  if(LPTorder == 2) normfactor = -3.0 / 7.0 / (double) nmesh3; 
 
   if( !(LPTorder == 1 || LPTorder == 2) ){
     printf("Error in from_cdisp_store_to_ZA: LPTorder [%i] is not supported [1] or [2] are only options\n", LPTorder);
@@ -1513,6 +1661,14 @@ void from_cdisp_store_to_ZA(double A, double AF, double AFF, int firststep, int
     exit(1);
   }
 
+  // Growth-factors to given LPT order at the times we need tabulated in k
+  SplineArrayAtFixedTime growth_D_A, growth_D_AFF, growth_dDdy_A, growth_ddDddy_A;
+  create_growth_scaledependent_at_fixed_time(LPTorder, 0, A,   &growth_D_A);
+  create_growth_scaledependent_at_fixed_time(LPTorder, 0, AFF, &growth_D_AFF);
+  create_growth_scaledependent_at_fixed_time(LPTorder, 2, A,   &growth_ddDddy_A);
+  if(firststep == 1)
+    create_growth_scaledependent_at_fixed_time(LPTorder, 1, A, &growth_dDdy_A);
+
   // Pointer to the stored [LPTorder]LPT displacment field in k-space
   complex_kind *(stored_disp_field[3]);
   if(LPTorder == 1){
@@ -1545,46 +1701,60 @@ void from_cdisp_store_to_ZA(double A, double AF, double AFF, int firststep, int
     sumdis_D[axes] = sumdis_dDdy[axes] = sumdis_ddDddy[axes] = 0.0;
   }
 
-  // Multiply by growth-factor D(k, A)
+  // Multiply by growth-factor D(k, A). The growth-factors are looked up for a row of modes at a time
   if(ThisTask == 0) printf("Multiply stored D-field with scaledependent growth-factor\n");
+  int nrow = Nmesh / 2 + 1;
+  double *kmag_row          = malloc(sizeof(double) * nrow);
+  double *growth_D_row      = malloc(sizeof(double) * nrow);
+  double *growth_dDdy_row   = malloc(sizeof(double) * nrow);
+  double *growth_ddDddy_row = malloc(sizeof(double) * nrow);
+  double *growth_temp_row   = malloc(sizeof(double) * nrow);
   for(int i = 0; i < Local_nx; i++) {
     for(int j = 0; j < Nmesh; j++)     {
-      for(int k = 0; k <= Nmesh / 2; k++) {
-        unsigned int coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-        double kvec[3];
-        if((i + Local_x_start) < Nmesh / 2) {
-          kvec[0] = (i + Local_x_start) * 2 * PI / Box;
-        } else {
-          kvec[0] = -(Nmesh - (i + Local_x_start)) * 2 * PI / Box;
-        }
+      double kvec[3];
+      if((i + Local_x_start) < Nmesh / 2) {
+        kvec[0] = (i + Local_x_start) * 2 * PI / Box;
+      } else {
+        kvec[0] = -(Nmesh - (i + Local_x_start)) * 2 * PI / Box;
+      }
 
-        if(j < Nmesh / 2) {
-          kvec[1] = j * 2 * PI / Box;
-        } else {
-          kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-        }
+      if(j < Nmesh / 2) {
+        kvec[1] = j * 2 * PI / Box;
+      } else {
+        kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+      }
 
+      for(int k = 0; k <= Nmesh / 2; k++) {
         if(k < Nmesh / 2) {
           kvec[2] = k * 2 * PI / Box;
         } else {
           kvec[2] = -(Nmesh - k) * 2 * PI / Box;
         }
 
-        // Square norm of wave-vector in units of h/Mpc
-        double kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-        double kmag = sqrt(kmag2);
-
-        // Fetch growth factors
-        double growth_factor_D      = normfactor *  func_growth_D_scaledependent(kmag, A);
-        double growth_factor_dDdy   = normfactor * (func_growth_D_scaledependent(kmag, AFF) - func_growth_D_scaledependent(kmag, A));
-        double growth_factor_ddDddy = normfactor *  func_growth_ddDddy_scaledependent(kmag, A);
-        if(firststep == 1){
-          growth_factor_dDdy  = normfactor * func_growth_dDdy_scaledependent(kmag, A);
-        }
+        // Norm of wave-vector in units of h/Mpc
+        kmag_row[k] = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
+      }
+
+      // Fetch growth factors
+      splinearray_lookup_at_fixed_time(&growth_D_A,      kmag_row, growth_D_row,      nrow);
+      splinearray_lookup_at_fixed_time(&growth_ddDddy_A, kmag_row, growth_ddDddy_row, nrow);
+      if(firststep == 1){
+        splinearray_lookup_at_fixed_time(&growth_dDdy_A, kmag_row, growth_dDdy_row,   nrow);
+      } else {
+        splinearray_lookup_at_fixed_time(&growth_D_AFF,  kmag_row, growth_temp_row,   nrow);
+        for(int k = 0; k < nrow; k++) 
+          growth_dDdy_row[k] = growth_temp_row[k] - growth_D_row[k];
+      }
+
+      for(int k = 0; k <= Nmesh / 2; k++) {
+        unsigned int coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
+
+        double growth_factor_D      = normfactor * growth_D_row[k];
+        double growth_factor_dDdy   = normfactor * growth_dDdy_row[k];
+        double growth_factor_ddDddy = normfactor * growth_ddDddy_row[k];
 
         for(int axes = 0; axes < 3; axes++) {
-          if(kmag2 > 0.0) {
+          if(kmag_row[k] > 0.0) {
             cdisp_D[axes][coord][0]      = stored_disp_field[axes][coord][0] * growth_factor_D;
             cdisp_D[axes][coord][1]      = stored_disp_field[axes][coord][1] * growth_factor_D;
 
@@ -1607,6 +1777,15 @@ void from_cdisp_store_to_ZA(double A, double AF, double AFF, int firststep, int
       }
     }
   }
+  free(kmag_row);
+  free(growth_D_row);
+  free(growth_dDdy_row);
+  free(growth_ddDddy_row);
+  free(growth_temp_row);
+  free_splinearray_at_fixed_time(&growth_D_A);
+  free_splinearray_at_fixed_time(&growth_D_AFF);
+  free_splinearray_at_fixed_time(&growth_ddDddy_A);
+  if(firststep == 1) free_splinearray_at_fixed_time(&growth_dDdy_A);
 
   // Fourier transform to k-space
   for(int axes = 0; axes < 3; axes++) {
@@ -2,6 +2,8 @@
 #include "Spline.h"
 #define MIN(x,y) ((x)>(y) ? (y) : (x))
 
+static void compute_spline(Spline *s, double *x, double *y, int n, double yp1, double ypn, int type);
+
 // Print some info
 void print_spline_info(Spline *s){
   int n = s->n;
@@ -13,15 +15,45 @@ void print_spline_info(Spline *s){
 
 // Make a spline
 void create_spline(Spline *s, double *x, double *y, int n, double yp1, double ypn, int type){
-  double sig, p, *u, un;
-  int i;
 
   // Allocate memory
-  u     = (double *) malloc(n * sizeof(double));
   s->y2 = (double *) malloc(n * sizeof(double));
   s->y  = (double *) malloc(n * sizeof(double));
   s->x  = (double *) malloc(n * sizeof(double));
   s->arrays_allocated = 1;
+
+  compute_spline(s, x, y, n, yp1, ypn, type);
+}
+
+// Make a spline with the x, y and y'' arrays stored in [storage] (3n doubles)
+// The storage is owned by the caller and is not free'd by free_spline
+void create_spline_in_storage(Spline *s, double *x, double *y, int n, double yp1, double ypn, int type, double *storage){
+  s->x  = storage;
+  s->y  = storage + n;
+  s->y2 = storage + 2 * n;
+  s->arrays_allocated = 0;
+
+  compute_spline(s, x, y, n, yp1, ypn, type);
+}
+
+// Point a spline to [storage] already filled by create_spline_in_storage
+void attach_spline_to_storage(Spline *s, int n, int type, double *storage){
+  s->x  = storage;
+  s->y  = storage + n;
+  s->y2 = storage + 2 * n;
+  s->arrays_allocated = 0;
+  s->type = type;
+  s->n = n;
+  s->x_start = s->x[0];
+  s->x_end = s->x[n-1];
+}
+
+// Fill the spline arrays (already allocated) with the (x,y) values and compute y''
+static void compute_spline(Spline *s, double *x, double *y, int n, double yp1, double ypn, int type){
+  double sig, p, *u, un;
+  int i;
+
+  u = (double *) malloc(n * sizeof(double));
   for (i = 0; i<n; i++) {
     s->y[i]  = y[i];
     s->x[i]  = x[i];
@@ -122,6 +154,64 @@ double spline_lookup(Spline *s, double x0){
   return result;
 }
 
+// Get the values y[i] = y(x0[i]) for n values at once. The index of the interval is found
+// with the spacing factors computed once and values outside the range are set to the
+// value at the end-point. We only warn about this the first time it happens
+void spline_lookup_many(Spline *s, double *x0, double *y0, int nx){
+  static int warned_outside = 0;
+  double *x = s->x;
+  double *y = s->y;
+  double *y2 = s->y2;
+  double x_start = s->x_start;
+  double x_end = s->x_end;
+  int type = s->type;
+  int n = s->n;
+  int noutside = 0;
+
+  // Factors to get the index from x0 for linear and logarithmic spacing
+  double index_factor = 0.0;
+  if (type == 1) index_factor = (n-1) / (x_end - x_start);
+  if (type == 2) index_factor = (n-1) / log(x_end / x_start);
+
+  for(int i = 0; i < nx; i++){
+    double xnow = x0[i];
+    if(xnow > x_end || xnow < x_start){
+      y0[i] = (xnow > x_end ? y[n-1] : y[0]);
+      noutside++;
+      continue;
+    }
+
+    int klo, khi, k;
+    if (type == 1) {
+      klo = MIN( (int)((xnow - x_start) * index_factor), n-2);
+    } else if (type == 2) {
+      klo = MIN( (int)(log(xnow / x_start) * index_factor), n-2);
+    } else {
+      klo = 0;
+      khi = n-1;
+      while (khi-klo>1) {
+        k = (khi+klo) >> 1;
+        if (x[k]>xnow) {
+          khi = k;
+        }else {
+          klo = k;
+        }
+      }
+    }
+    khi = klo + 1;
+
+    double h = x[khi]-x[klo];
+    double a = (x[khi]-xnow)/h;
+    double b = (xnow-x[klo])/h;
+    y0[i] = (a*y[klo]+b*y[khi]+((a*a*a-a)*y2[klo]+(b*b*b-b)*y2[khi])*(h*h)/6.0);
+  }
+
+  if(noutside > 0 && ! warned_outside){
+    printf("Warning spline_lookup_many: %i of %i values outside [%f, %f]. Using the end-point values (warning only shown once)\n", noutside, nx, x_start, x_end);
+    warned_outside = 1;
+  }
+}
+
 // Get the derivative of the quantity splines
 double spline_lookup_dy(Spline *s, double x0){
   int klo, khi, k;
@@ -197,10 +287,6 @@ double interpolate_from_splinearray(SplineArray *f, double k, double x){
   double kmax = f->kmax;
   int nk      = f->nk;
 
-  // Index to splines between current k-value
-  int indlow = (int)(log(k/kmin) / log(kmax/kmin) * (nk-1));
-  int indhigh = indlow + 1;
-
   // Bounds-check
   if(k <= kmin) {
     return spline_lookup(f->splinearray[0], x);
@@ -209,13 +295,18 @@ double interpolate_from_splinearray(SplineArray *f, double k, double x){
     return spline_lookup(f->splinearray[nk-1], x);
   }
 
+  // Index to splines between current k-value
+  double index = log(k/kmin) / log(kmax/kmin) * (nk-1);
+  int indlow = (int) index;
+  int indhigh = indlow + 1;
+
   // Linear interpolation. If out of bounds use closest value!
   if(indlow < 0.0){
     return spline_lookup(f->splinearray[0], x);
   } else if(indhigh >= nk){
     return spline_lookup(f->splinearray[nk-1], x);
   } else {
-    double w = ( log(k/kmin) - log(kmax/kmin) * indlow / (nk-1) ) / ( log(kmax/kmin) / (double)(nk-1) );
+    double w = index - indlow;
 
     // Check that linear weight is sensible
     if(w > 1.001 || w < -0.001){
@@ -227,6 +318,58 @@ double interpolate_from_splinearray(SplineArray *f, double k, double x){
   }
 }
 
+//==============================================================
+// Evaluate all the splines in a spline-array at the same x once
+// Lookups of f(k, x) at this x are then linear interpolation in
+// log(k) in the table and no spline lookups
+//==============================================================
+void create_splinearray_at_fixed_time(SplineArray *f, double x, SplineArrayAtFixedTime *g){
+  g->nk          = f->nk;
+  g->kmin        = f->kmin;
+  g->kmax        = f->kmax;
+  g->index_factor = (f->nk - 1) / log(f->kmax / f->kmin);
+  g->y           = malloc(sizeof(double) * f->nk);
+  for(int i = 0; i < f->nk; i++)
+    g->y[i] = spline_lookup(f->splinearray[i], x);
+}
+
+// Set out[i] = f(k[i], x) for n values of k. Gives the same result as interpolate_from_splinearray
+void splinearray_lookup_at_fixed_time(SplineArrayAtFixedTime *g, double *k, double *out, int n){
+  double *y = g->y;
+  double kmin = g->kmin;
+  double kmax = g->kmax;
+  double index_factor = g->index_factor;
+  int nk = g->nk;
+
+  for(int i = 0; i < n; i++){
+    double know = k[i];
+    if(know <= kmin){
+      out[i] = y[0];
+    } else if(know >= kmax){
+      out[i] = y[nk-1];
+    } else {
+      double index = log(know / kmin) * index_factor;
+      int indlow = MIN((int) index, nk-2);
+      double w = index - indlow;
+      out[i] = y[indlow] * (1.0 - w) + y[indlow+1] * w;
+    }
+  }
+}
+
+void free_splinearray_at_fixed_time(SplineArrayAtFixedTime *g){
+  free(g->y);
+  g->y = NULL;
+}
+
+// Set out[i] = f(k[i], x) for n values of k at the same x. Each k-bin spline is evaluated once so 
+// this is faster than interpolate_from_splinearray when n is larger than the number of k-bins
+void splinearray_lookup_fixed_time(SplineArray *f, double x, double *k, double *out, int n){
+  SplineArrayAtFixedTime g;
+  create_splinearray_at_fixed_time(f, x, &g);
+  splinearray_lookup_at_fixed_time(&g, k, out, n);
+  free_splinearray_at_fixed_time(&g);
+}
+
 // Free up memory from a spline-container
 void free_SplineArray(SplineArray *f){
   if(f->is_created){
@@ -34,9 +34,18 @@ typedef struct SplineContainer Spline;
 // Create a spline
 void create_spline(Spline *s, double *x, double *y, int n, double yp1, double ypn, int type);
 
+// Create a spline with the arrays stored in external memory (3n doubles)
+void create_spline_in_storage(Spline *s, double *x, double *y, int n, double yp1, double ypn, int type, double *storage);
+
+// Point a spline to external memory filled by create_spline_in_storage
+void attach_spline_to_storage(Spline *s, int n, int type, double *storage);
+
 // Return y(x0)
 double spline_lookup(Spline *s, double x0);
 
+// Set y0[i] = y(x0[i]) for i = 0, ..., nx-1
+void spline_lookup_many(Spline *s, double *x0, double *y0, int nx);
+
 // Return y'(x0)
 double spline_lookup_dy(Spline *s, double x0);
 
@@ -72,6 +81,28 @@ double interpolate_from_splinearray(SplineArray *f, double k, double x);
 // Free an allocated spline array
 void free_SplineArray(SplineArray *f);
 
+// A spline-array evaluated at a fixed x. Used for looking up f(k, x) for many k at the same time
+struct SplineArrayAtFixedTimeContainer {
+  double kmin;
+  double kmax;
+  double index_factor;    // (nk-1) / log(kmax/kmin)
+  int nk;
+  double *y;              // f(k_i, x) for the nk k-values
+};
+typedef struct SplineArrayAtFixedTimeContainer SplineArrayAtFixedTime;
+
+// Tabulate f(k_i, x) for all the k-values
+void create_splinearray_at_fixed_time(SplineArray *f, double x, SplineArrayAtFixedTime *g);
+
+// Set out[i] = f(k[i], x) for i = 0, ..., n-1 using the tabulated values
+void splinearray_lookup_at_fixed_time(SplineArrayAtFixedTime *g, double *k, double *out, int n);
+
+// Free the tabulated values
+void free_splinearray_at_fixed_time(SplineArrayAtFixedTime *g);
+
+// Set out[i] = f(k[i], x) for i = 0, ..., n-1
+void splinearray_lookup_fixed_time(SplineArray *f, double x, double *k, double *out, int n);
+
 // For trilinear interpolation
 struct InterpolationGridContainer{
   int n[3];
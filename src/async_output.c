@@ -0,0 +1,201 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+
+//==========================================================================//
+// This file contains the asynchronous snapshot writer. Output() writes the //
+// file into memory (open_memstream) instead of to disk and a dedicated     //
+// output thread writes the staged files while the simulation continues.   //
+// The memory used by staged files that are not yet written is capped by   //
+// AsyncOutputMemoryMB. Only the main thread calls MPI, so this needs at   //
+// least MPI_THREAD_FUNNELED. Otherwise the files are written directly      //
+//==========================================================================//
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include "vars.h"
+#include "proto.h"
+
+struct AsyncOutputFile {
+  char filename[300];
+  char *data;
+  size_t size;
+  struct AsyncOutputFile *next;
+};
+
+static pthread_t       async_output_thread;
+static pthread_mutex_t async_output_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  async_output_cond  = PTHREAD_COND_INITIALIZER;
+
+// The queue of staged files waiting to be written (protected by the mutex)
+static struct AsyncOutputFile *async_output_first = NULL;
+static struct AsyncOutputFile *async_output_last  = NULL;
+static size_t async_output_pending_bytes = 0;
+static int    async_output_active = 0;
+static int    async_output_stop  = 0;
+static int    async_output_error = 0;
+static char   async_output_error_file[300];
+
+// The file currently being staged by Output()
+static FILE *async_output_stream = NULL;
+static struct AsyncOutputFile *async_output_staged = NULL;
+
+//====================================================
+// The output thread: write the staged files in the
+// order they were queued until we are told to stop
+//====================================================
+static void *async_output_writer(void *arg) {
+  pthread_mutex_lock(&async_output_mutex);
+  for(;;) {
+    while(async_output_first == NULL && ! async_output_stop)
+      pthread_cond_wait(&async_output_cond, &async_output_mutex);
+    if(async_output_first == NULL) break;
+
+    struct AsyncOutputFile *f = async_output_first;
+    pthread_mutex_unlock(&async_output_mutex);
+
+    FILE *fp = fopen(f->filename, "w");
+    int ok = (fp != NULL);
+    if(ok) {
+      ok = (fwrite(f->data, 1, f->size, fp) == f->size);
+      ok = (fclose(fp) == 0) && ok;
+    }
+
+    pthread_mutex_lock(&async_output_mutex);
+    if(! ok && ! async_output_error) {
+      async_output_error = 1;
+      strcpy(async_output_error_file, f->filename);
+    }
+    async_output_first = f->next;
+    if(async_output_first == NULL) async_output_last = NULL;
+    async_output_pending_bytes -= f->size;
+    free(f->data);
+    free(f);
+    pthread_cond_broadcast(&async_output_cond);
+  }
+  pthread_mutex_unlock(&async_output_mutex);
+  return arg;
+}
+
+//====================================================
+// Start the output thread. [mpi_thread_level] is the
+// thread support provided by MPI_Init_thread. Without
+// MPI_THREAD_FUNNELED it is not safe to have a second
+// thread so we write the files synchronously instead
+//====================================================
+void async_output_init(int mpi_thread_level) {
+  if(mpi_thread_level < MPI_THREAD_FUNNELED) {
+    if(ThisTask == 0) {
+      printf("WARNING: The MPI library does not provide MPI_THREAD_FUNNELED. The snapshots are written synchronously\n");
+      fflush(stdout);
+    }
+    return;
+  }
+  if(pthread_create(&async_output_thread, NULL, async_output_writer, NULL) != 0) {
+    printf("\nERROR: Task %i could not start the output thread.\n\n", ThisTask);
+    FatalError((char *)"async_output.c", 116);
+  }
+  async_output_active = 1;
+  if(ThisTask == 0) {
+    printf("Asynchronous output with at most %i MB of staged files per task\n", AsyncOutputMemoryMB);
+    fflush(stdout);
+  }
+}
+
+//====================================================
+// Open [filename] for writing. The file is staged in
+// memory and written by the output thread when closed
+// with async_output_fclose. [bytes] is an estimate of
+// the size of the file. We wait for the output thread
+// if the staged files would use more than the memory
+// cap, and write the file directly if it alone does
+//====================================================
+FILE *async_output_fopen(char *filename, size_t bytes) {
+  size_t maxbytes = (size_t) AsyncOutputMemoryMB * 1024 * 1024;
+  if(! async_output_active || bytes > maxbytes) return fopen(filename, "w");
+
+  pthread_mutex_lock(&async_output_mutex);
+  while(async_output_pending_bytes + bytes > maxbytes)
+    pthread_cond_wait(&async_output_cond, &async_output_mutex);
+  pthread_mutex_unlock(&async_output_mutex);
+
+  async_output_staged = malloc(sizeof(struct AsyncOutputFile));
+  async_output_staged->data = NULL;
+  async_output_staged->size = 0;
+  async_output_staged->next = NULL;
+  snprintf(async_output_staged->filename, 300, "%s", filename);
+  async_output_stream = open_memstream(&async_output_staged->data, &async_output_staged->size);
+  if(async_output_stream == NULL) {
+    free(async_output_staged);
+    async_output_staged = NULL;
+    return fopen(filename, "w");
+  }
+  return async_output_stream;
+}
+
+//====================================================
+// Close a file opened with async_output_fopen. A
+// staged file is queued for the output thread
+//====================================================
+void async_output_fclose(FILE *fp) {
+  if(fp != async_output_stream || fp == NULL) {
+    fclose(fp);
+    return;
+  }
+  if(fclose(fp) != 0) {
+    printf("\nERROR: Task %i could not stage the file '%s' in memory.\n\n", ThisTask, async_output_staged->filename);
+    FatalError((char *)"async_output.c", 167);
+  }
+
+  pthread_mutex_lock(&async_output_mutex);
+  if(async_output_last == NULL) {
+    async_output_first = async_output_staged;
+  } else {
+    async_output_last->next = async_output_staged;
+  }
+  async_output_last = async_output_staged;
+  async_output_pending_bytes += async_output_staged->size;
+  pthread_cond_broadcast(&async_output_cond);
+  pthread_mutex_unlock(&async_output_mutex);
+
+  async_output_stream = NULL;
+  async_output_staged = NULL;
+}
+
+//====================================================
+// Wait until all staged files are written and stop
+// the output thread. Called at the end of the run
+//====================================================
+void async_output_finalize(void) {
+  if(! async_output_active) return;
+  pthread_mutex_lock(&async_output_mutex);
+  async_output_stop = 1;
+  pthread_cond_broadcast(&async_output_cond);
+  pthread_mutex_unlock(&async_output_mutex);
+  pthread_join(async_output_thread, NULL);
+
+  if(async_output_error) {
+    printf("\nERROR: Task %i could not write the file '%s'.\n\n", ThisTask, async_output_error_file);
+    FatalError((char *)"async_output.c", 199);
+  }
+}
@@ -265,26 +265,23 @@ void MoveParticles(void) {
 }
 
 //==============================
-// Does Cloud-in-Cell assignment.
+// Cloud-in-Cell assignment of the particles on this task to [grid] with [ngrid]
+// cells per dimension. The grid is stored as x-slabs starting at [x_start] with
+// [nzpad] elements in the z-direction and one extra slice on the right. Each 
+// particle adds a total of [weight] to the grid
 //==============================
-void PtoMesh(void) {
-  timer_start(_PtoMesh);
+void CICDeposit(float_kind *grid, int ngrid, int nzpad, int x_start, double weight) {
   unsigned int i;
   unsigned int IX, IY, IZ;
   unsigned int IXneigh, IYneigh, IZneigh;
   double X, Y, Z;
   double TX, TY, TZ;
   double DX, DY, DZ;
-  double scaleBox = (double)Nmesh/Box;
-  double WPAR = pow((double)Nmesh / (double)Nsample,3);
+  double scaleBox = (double)ngrid/Box;
 
-  // Initialize density to -1
-  for(i = 0; i < 2 * Total_size; i++) 
-    density[i] = -1.0;
-  
   for(i = 0; i < NumPart; i++) {
 
-    // Scale positions to be in [0, Nmesh]
+    // Scale positions to be in [0, ngrid]
     X = P[i].Pos[0] * scaleBox;
     Y = P[i].Pos[1] * scaleBox;
     Z = P[i].Pos[2] * scaleBox;
@@ -303,34 +300,48 @@ void PtoMesh(void) {
     TX = 1.0 - DX;
     TY = 1.0 - DY;
     TZ = 1.0 - DZ;
-    DY *= WPAR;
-    TY *= WPAR;
+    DY *= weight;
+    TY *= weight;
 
     // Periodic BC
-    IX -= Local_x_start;
-    if(IY >= (unsigned int)Nmesh) IY = 0;
-    if(IZ >= (unsigned int)Nmesh) IZ = 0;
+    IX -= x_start;
+    if(IY >= (unsigned int)ngrid) IY = 0;
+    if(IZ >= (unsigned int)ngrid) IZ = 0;
 
     // Neighbor gridindex
     // No check for x as we have an additional slice on the right
     IXneigh = IX + 1;
     IYneigh = IY + 1;
     IZneigh = IZ + 1;
-    if(IYneigh >= (unsigned int)Nmesh) IYneigh = 0;
-    if(IZneigh >= (unsigned int)Nmesh) IZneigh = 0;
+    if(IYneigh >= (unsigned int)ngrid) IYneigh = 0;
+    if(IZneigh >= (unsigned int)ngrid) IZneigh = 0;
 
     //====================================================================================
     // Assign density to the 8 cells containing the particle cloud
     //====================================================================================
-    density[(IX*Nmesh+IY)*2*(Nmesh/2+1)+IZ]                += TX*TY*TZ;
-    density[(IX*Nmesh+IY)*2*(Nmesh/2+1)+IZneigh]           += TX*TY*DZ;
-    density[(IX*Nmesh+IYneigh)*2*(Nmesh/2+1)+IZ]           += TX*DY*TZ;
-    density[(IX*Nmesh+IYneigh)*2*(Nmesh/2+1)+IZneigh]      += TX*DY*DZ;
-    density[(IXneigh*Nmesh+IY)*2*(Nmesh/2+1)+IZ]           += DX*TY*TZ;
-    density[(IXneigh*Nmesh+IY)*2*(Nmesh/2+1)+IZneigh]      += DX*TY*DZ;
-    density[(IXneigh*Nmesh+IYneigh)*2*(Nmesh/2+1)+IZ]      += DX*DY*TZ;
-    density[(IXneigh*Nmesh+IYneigh)*2*(Nmesh/2+1)+IZneigh] += DX*DY*DZ;
+    grid[(IX*ngrid+IY)*nzpad+IZ]                += TX*TY*TZ;
+    grid[(IX*ngrid+IY)*nzpad+IZneigh]           += TX*TY*DZ;
+    grid[(IX*ngrid+IYneigh)*nzpad+IZ]           += TX*DY*TZ;
+    grid[(IX*ngrid+IYneigh)*nzpad+IZneigh]      += TX*DY*DZ;
+    grid[(IXneigh*ngrid+IY)*nzpad+IZ]           += DX*TY*TZ;
+    grid[(IXneigh*ngrid+IY)*nzpad+IZneigh]      += DX*TY*DZ;
+    grid[(IXneigh*ngrid+IYneigh)*nzpad+IZ]      += DX*DY*TZ;
+    grid[(IXneigh*ngrid+IYneigh)*nzpad+IZneigh] += DX*DY*DZ;
   }
+}
+
+//==============================
+// Assign the particles to the density grid (the density contrast) with CIC
+//==============================
+void DensityFromParticles(void) {
+  unsigned int i;
+  double WPAR = pow((double)Nmesh / (double)Nsample,3);
+
+  // Initialize density to -1
+  for(i = 0; i < 2 * Total_size; i++) 
+    density[i] = -1.0;
+
+  CICDeposit(density, Nmesh, 2*(Nmesh/2+1), Local_x_start, WPAR);
 
   //====================================================================================
   // Copy across the extra slice from the task on the left and add it to the leftmost slice
@@ -344,19 +355,30 @@ void PtoMesh(void) {
     for (i = 0; i < 2 * alloc_slice; i++) density[i] += (temp_density[i] + 1.0);
   }
   free(temp_density);
+}
+
+//==============================
+// Does Cloud-in-Cell assignment.
+//==============================
+void PtoMesh(void) {
+  timer_start(_PtoMesh);
+
+  DensityFromParticles();
 
   //====================================================================================
-  // If modified gravity is active We take a copy of the density array 
-  // needed to compute the fifth-force
+  // If modified gravity is active with screening we take a copy of the density array 
+  // needed to compute the fifth-force. Without screening the fifth-force only needs
+  // density(k) which we have in P3D after the FFT below
   //====================================================================================
-  if(modified_gravity_active) CopyDensityArray();
+  if(modified_gravity_active && include_screening) CopyDensityArray();
 
   // FFT the density field
   my_fftw_execute(plan);
 
-  // For testing. Compute P(k) every time-step
-  // As currently written this is P(k) in the co-moving frame
-  // compute_power_spectrum(P3D);
+#ifdef COMPUTE_POFK
+  // Compute P(k) at the output steps (or every step) from the density(k) we already have
+  if(PofkComputeNow) compute_power_spectrum(P3D, aexp_global);
+#endif
 
   timer_stop(_PtoMesh);
   return;
@@ -620,33 +642,38 @@ size_t my_fwrite(void *ptr, size_t size, size_t nmemb, FILE * stream) {
   return nwritten;
 }
 
+#ifdef COMPUTE_POFK
 //===========================================================================
-// For testing compute P(k) = <|density(k)|^2>
-// As currently written this is P(k) in the co-moving frame
+// Bin up P(k) = <|density(k)|^2> from the FFT of the density contrast. With
+// los_axis >= 0 we also bin up the quadrupole and hexadecapole with mu the 
+// cosine of the angle between k and the los_axis. The bins are linear or 
+// logarithmic in k from the fundamental mode to the Nyquist frequency. The
+// results are summed over all tasks and put in [kmean], [pofk], [nmodes]
+// and [multipoles] (P0,P2,P4 for each bin, only used if los_axis >= 0)
 //===========================================================================
-void compute_power_spectrum(complex_kind *P3D){
-  int nbins = Nmesh;
-  double *pofk_bin     = malloc(sizeof(double) * nbins);
-  double *pofk_bin_all = malloc(sizeof(double) * nbins);
-  double *n_bin        = malloc(sizeof(double) * nbins);
-  double *n_bin_all    = malloc(sizeof(double) * nbins);
+static void bin_power_spectrum(complex_kind *P3D, int los_axis, double *kmean, double *pofk, double *nmodes, double *multipoles) {
+  int nbins = PofkNbins;
+  double knyquist = Nmesh / 2;
 
-  // FFT normalization factor for |density(k)|^2
-  double fac = 1.0/pow((double) Nmesh, 6);
+  // FFT normalization factor for |density(k)|^2 and the volume
+  double fac = pow(Box * UnitLength_in_cm / 3.085678e24, 3) / pow((double) Nmesh, 6);
 
-  for(int i = 0; i < nbins; i++)
-    pofk_bin[i] = pofk_bin_all[i] = n_bin[i] = n_bin_all[i] = 0.0;
+  for(int i = 0; i < nbins; i++) 
+    kmean[i] = pofk[i] = nmodes[i] = multipoles[3*i] = multipoles[3*i+1] = multipoles[3*i+2] = 0.0;
 
   for (int i = 0; i < Local_nx; i++) {
     int iglobal = i + Local_x_start;
-    for (int j = 0 ; j < (unsigned int)(Nmesh/2+1); j++) {
-      for (int k = 0; k < (unsigned int) (Nmesh/2+1); k++) {
+    for (int j = 0 ; j < Nmesh; j++) {
+      for (int k = 0; k < Nmesh/2+1; k++) {
         unsigned int coord = (i*Nmesh+j)*(Nmesh/2+1)+k;
 
         // Compute k-vector and its norm
-        double d[3] = {iglobal > Nmesh/2 ? iglobal-Nmesh : iglobal, j, k};
-        double kmag2_int = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
-        double kmag_int = sqrt(kmag2_int);
+        double d[3] = {iglobal > Nmesh/2 ? iglobal-Nmesh : iglobal, j > Nmesh/2 ? j-Nmesh : j, k};
+        double kmag_int = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if(kmag_int < 1.0 || kmag_int >= knyquist) continue;
+
+        int nk = PofkLogBinning ? (int)(log(kmag_int) / log(knyquist) * nbins) : (int)((kmag_int - 1.0) / (knyquist - 1.0) * nbins);
+        if(nk < 0 || nk >= nbins) continue;
 
         // Deconvolve window function (CIC)
         double grid_corr = 1.0;
@@ -655,46 +682,150 @@ void compute_power_spectrum(complex_kind *P3D){
         }
         grid_corr = pow(1.0 / grid_corr, 4.0) * fac;
 
-        // Add to bins
-        double pofk = (P3D[coord][0] * P3D[coord][0] + P3D[coord][1] * P3D[coord][1]) * grid_corr;
-        int nk = (int) (kmag_int + 0.5); 
-        if( nk  < nbins && nk > 0 ){
-          pofk_bin[nk] += pofk;
-          n_bin[nk]    += 1.0;
-        }
-
-        // Add the mirror along the y-axis
-        if ((j != (unsigned int)(Nmesh/2)) && (j != 0)) {
-          coord = (i*Nmesh + (Nmesh-j))*(Nmesh/2+1)+k;
-         
-          // Add to bins
-          if( nk  < nbins && nk > 0 ){
-            pofk = (P3D[coord][0] * P3D[coord][0] + P3D[coord][1] * P3D[coord][1]) * grid_corr;
-            pofk_bin[nk] += pofk;
-            n_bin[nk]    += 1.0;
-          }
+        // Add to bins. We only have half the modes: every mode with k > 0 also stands
+        // for its complex conjugate at -k, while the k = 0 plane has both already
+        double weight = (k > 0) ? 2.0 : 1.0;
+        double power = (P3D[coord][0] * P3D[coord][0] + P3D[coord][1] * P3D[coord][1]) * grid_corr;
+        kmean[nk]  += kmag_int * weight;
+        pofk[nk]   += power * weight;
+        nmodes[nk] += weight;
+
+        if(los_axis >= 0) {
+          double mu2 = d[los_axis] * d[los_axis] / (kmag_int * kmag_int);
+          multipoles[3*nk]   += power * weight;
+          multipoles[3*nk+1] += power * weight * 5.0 * (3.0 * mu2 - 1.0) / 2.0;
+          multipoles[3*nk+2] += power * weight * 9.0 * (35.0 * mu2 * mu2 - 30.0 * mu2 + 3.0) / 8.0;
         }
       }
     }
   }
 
   // Communicate
-  MPI_Allreduce(pofk_bin, pofk_bin_all, nbins, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(n_bin,    n_bin_all,    nbins, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, kmean,      nbins,     MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, pofk,       nbins,     MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, nmodes,     nbins,     MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, multipoles, 3 * nbins, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+  // Normalize and subtract shot-noise (only affects the monopole)
+  double shotnoise = PofkSubtractShotnoise ? pow(Box * UnitLength_in_cm / 3.085678e24 / (double) Nsample, 3) : 0.0;
+  for(int i = 0; i < nbins; i++){
+    if(nmodes[i] > 0){
+      kmean[i] = kmean[i] / nmodes[i] * 2.0 * M_PI / (Box * UnitLength_in_cm / 3.085678e24);
+      pofk[i]  = pofk[i] / nmodes[i] - shotnoise;
+      for(int l = 0; l < 3; l++) multipoles[3*i+l] /= nmodes[i];
+      multipoles[3*i] -= shotnoise;
+    }
+  }
+}
+
+//===========================================================================
+// Compute P(k) from the density(k) we have after the FFT in PtoMesh and
+// write it to file. This costs nothing besides the binning. Positions and 
+// P(k) are in the co-moving frame
+//===========================================================================
+void compute_power_spectrum(complex_kind *P3D, double A) {
+  double *kmean      = malloc(sizeof(double) * PofkNbins);
+  double *pofk       = malloc(sizeof(double) * PofkNbins);
+  double *nmodes     = malloc(sizeof(double) * PofkNbins);
+  double *multipoles = malloc(sizeof(double) * PofkNbins * 3);
+  double Z = 1.0 / A - 1.0;
+
+  bin_power_spectrum(P3D, -1, kmean, pofk, nmodes, multipoles);
 
   if(ThisTask == 0){
-    printf("Output P(k) at a = %f \n", aexp_global);
-    for(int i = 1; i < nbins; i++){
-      if(n_bin_all[i] > 0){
-        pofk_bin[i] = pofk_bin_all[i] / n_bin_all[i] - 1.0/pow((double) Nsample, 3);
-      }
-      printf("%8.3f   %8.3f\n", i * 2 * M_PI / Box, pofk_bin[i] * pow( Box, 3 ) );
+    char buf[300];
+    FILE *fp;
+    sprintf(buf, "%s/pofk_%s_z%dp%03d.txt", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000));
+    if(!(fp = fopen(buf, "w"))) {
+      printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+      FatalError((char *)"auxPM.c", 739);
+    }
+    printf("Output P(k) at a = %f to %s\n", A, buf);
+    fprintf(fp, "# k (h/Mpc)    P(k) ((Mpc/h)^3)    Number of modes    [z = %f]\n", Z);
+    for(int i = 0; i < PofkNbins; i++){
+      if(nmodes[i] > 0) fprintf(fp, "%12.6e   %12.6e   %12.0f\n", kmean[i], pofk[i], nmodes[i]);
+    }
+    fclose(fp);
+  }
+
+  // Free memory
+  free(kmean);
+  free(pofk);
+  free(nmodes);
+  free(multipoles);
+}
+
+//===========================================================================
+// Compute the redshift-space multipoles P0, P2 and P4 and write them to 
+// file. The particles are displaced by v/(aH) along the z-axis (so they 
+// stay on the same task), assigned to the density grid and FFTed
+//===========================================================================
+void compute_redshift_space_multipoles(double A, double Dv, double Dv2, int use_2lpt_step) {
+  double Z = 1.0 / A - 1.0;
+  double fac       = Hubble / pow(A,1.5);
+  double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
+  double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
+
+  // Converts a velocity in code units to the displacement in code units
+  double rsdfac = velfac / (100.0 * A * hubble(A)) / lengthfac;
+
+#ifdef MEMORY_MODE
+  density = malloc(2*Total_size*sizeof(float_kind));
+  P3D     = (complex_kind *) density;
+  plan    = my_fftw_mpi_plan_dft_r2c_3d(Nmesh, Nmesh, Nmesh, density, P3D, MPI_COMM_WORLD, FFTW_ESTIMATE);
+#endif
+
+  // Move the particles to redshift-space
+  float_kind *zpos = malloc(sizeof(float_kind) * NumPart + 1);
+  for(unsigned int n = 0; n < NumPart; n++) {
+    zpos[n] = P[n].Pos[2];
+#ifdef SCALEDEPENDENT
+    double vz = fac*(P[n].Vel[2] - sumxyz[2] + (P[n].dDdy[2] + P[n].dD2dy[2] * use_2lpt_step ) * UseCOLA);
+#else
+    double vz = fac*(P[n].Vel[2] - sumxyz[2] + (P[n].D[2] * Dv + P[n].D2[2] * Dv2 * use_2lpt_step ) * UseCOLA);
+#endif
+    P[n].Pos[2] = periodic_wrap(P[n].Pos[2] + vz * rsdfac);
+  }
+
+  DensityFromParticles();
+
+  for(unsigned int n = 0; n < NumPart; n++) P[n].Pos[2] = zpos[n];
+  free(zpos);
+
+  my_fftw_execute(plan);
+
+  double *kmean      = malloc(sizeof(double) * PofkNbins);
+  double *pofk       = malloc(sizeof(double) * PofkNbins);
+  double *nmodes     = malloc(sizeof(double) * PofkNbins);
+  double *multipoles = malloc(sizeof(double) * PofkNbins * 3);
+
+  bin_power_spectrum(P3D, 2, kmean, pofk, nmodes, multipoles);
+
+  if(ThisTask == 0){
+    char buf[300];
+    FILE *fp;
+    sprintf(buf, "%s/pofk_multipoles_%s_z%dp%03d.txt", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000));
+    if(!(fp = fopen(buf, "w"))) {
+      printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+      FatalError((char *)"auxPM.c", 808);
     }
+    printf("Output redshift-space P(k) multipoles at a = %f to %s\n", A, buf);
+    fprintf(fp, "# k (h/Mpc)    P0(k)    P2(k)    P4(k) ((Mpc/h)^3)    Number of modes    [z = %f, line of sight = z-axis]\n", Z);
+    for(int i = 0; i < PofkNbins; i++){
+      if(nmodes[i] > 0) fprintf(fp, "%12.6e   %12.6e   %12.6e   %12.6e   %12.0f\n", kmean[i], multipoles[3*i], multipoles[3*i+1], multipoles[3*i+2], nmodes[i]);
+    }
+    fclose(fp);
   }
 
   // Free memory
-  free(pofk_bin);
-  free(pofk_bin_all);
-  free(n_bin);
-  free(n_bin_all);
+  free(kmean);
+  free(pofk);
+  free(nmodes);
+  free(multipoles);
+
+#ifdef MEMORY_MODE
+  free(density);
+  my_fftw_destroy_plan(plan);
+#endif
 }
+#endif
@@ -0,0 +1,326 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+
+//==========================================================================//
+// This file contains the compressed snapshot format. Each file holds the   //
+// particles of one task sorted by their Lagrangian ID (the particle ID, or //
+// coord_q with SCALEDEPENDENT). The IDs are stored as differences, the     //
+// positions as the displacement from the Lagrangian grid point quantized   //
+// in steps of 2*CompressPosTolerance and the velocities quantized in steps //
+// of 2*CompressVelTolerance, so the error is at most the tolerance. With a //
+// zero tolerance the float values are stored exactly. The numbers are     //
+// delta coded along the particles and entropy coded in blocks with an     //
+// adaptive binary range coder. The reader is in SimplePofk/io_compressed.h //
+//                                                                          //
+// With -DCOMPRESSED_CODER_ONLY only the coder (compress_particle_block) is //
+// compiled, for the round-trip test SimplePofk/test_compressed_roundtrip   //
+//==========================================================================//
+
+#ifdef COMPRESSED_CODER_ONLY
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#else
+#include "vars.h"
+#include "proto.h"
+#endif
+
+#define COMPRESSED_MAGIC      "PICOLAZ1"
+#define COMPRESSED_VERSION    1
+#define COMPRESSED_BLOCK_SIZE 65536
+
+// The number of numbers we store per particle (ID, 3 positions and 3 velocities)
+#define COMPRESSED_NSTREAMS   7
+
+// Probabilities are 11 bit numbers and adapt with a shift of 5 (as in LZMA)
+#define RC_PROB_BITS  11
+#define RC_PROB_INIT  (1 << (RC_PROB_BITS - 1))
+#define RC_MOVE_BITS  5
+#define RC_TOP        (1U << 24)
+
+//====================================================
+// The file header. Followed by the blocks, each 
+// block is [npart] [nbytes] and the coded bytes
+//====================================================
+struct compressed_header {
+  char magic[8];                   // "PICOLAZ1"
+  int  version;                    // Format version
+  int  nsample;                    // The number of particles per dimension (the Lagrangian grid)
+  int  block_size;                 // The maximum number of particles per block
+  int  num_files;                  // The number of files for this snapshot
+  unsigned long long npart;        // The number of particles in this file
+  unsigned long long npart_total;  // The number of particles in all the files
+  double boxsize;                  // The boxsize in Mpc/h
+  double redshift;                 // The redshift of the snapshot
+  double pos_tolerance;            // Maximum error in the positions in Mpc/h (0 = exact)
+  double vel_tolerance;            // Maximum error in the velocities in km/s (0 = exact)
+};
+
+//====================================================
+// Range encoder writing to a memory buffer
+//====================================================
+struct range_encoder {
+  unsigned long long low;
+  unsigned int range;
+  unsigned char cache;
+  unsigned long long cachesize;
+  unsigned char *out;
+  size_t pos;
+};
+
+static void rc_init(struct range_encoder *rc, unsigned char *out) {
+  rc->low       = 0;
+  rc->range     = 0xFFFFFFFFU;
+  rc->cache     = 0;
+  rc->cachesize = 1;
+  rc->out       = out;
+  rc->pos       = 0;
+}
+
+static void rc_shift_low(struct range_encoder *rc) {
+  if((unsigned int) rc->low < 0xFF000000U || (rc->low >> 32) != 0) {
+    unsigned char carry = (unsigned char)(rc->low >> 32);
+    unsigned char temp  = rc->cache;
+    do {
+      rc->out[rc->pos++] = (unsigned char)(temp + carry);
+      temp = 0xFF;
+    } while(--rc->cachesize != 0);
+    rc->cache = (unsigned char)(rc->low >> 24);
+  }
+  rc->cachesize++;
+  rc->low = (rc->low & 0x00FFFFFFULL) << 8;
+}
+
+static inline void rc_encode_bit(struct range_encoder *rc, unsigned short *prob, int bit) {
+  unsigned int bound = (rc->range >> RC_PROB_BITS) * (*prob);
+  if(bit == 0) {
+    rc->range = bound;
+    *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+  } else {
+    rc->low   += bound;
+    rc->range -= bound;
+    *prob -= *prob >> RC_MOVE_BITS;
+  }
+  while(rc->range < RC_TOP) {
+    rc->range <<= 8;
+    rc_shift_low(rc);
+  }
+}
+
+static inline void rc_encode_direct_bit(struct range_encoder *rc, int bit) {
+  rc->range >>= 1;
+  if(bit) rc->low += rc->range;
+  while(rc->range < RC_TOP) {
+    rc->range <<= 8;
+    rc_shift_low(rc);
+  }
+}
+
+static void rc_flush(struct range_encoder *rc) {
+  for(int i = 0; i < 5; i++) rc_shift_low(rc);
+}
+
+//====================================================
+// Encode an unsigned number as the number of bits 
+// (adaptive, one bit-tree per stream) followed by the 
+// bits below the leading one (not adaptive)
+//====================================================
+static void rc_encode_number(struct range_encoder *rc, unsigned short *probs, unsigned long long value) {
+  int nbits = 0;
+  while(nbits < 64 && (value >> nbits) != 0) nbits++;
+
+  int m = 1;
+  for(int i = 6; i >= 0; i--) {
+    int bit = (nbits >> i) & 1;
+    rc_encode_bit(rc, &probs[m], bit);
+    m = (m << 1) | bit;
+  }
+  for(int i = nbits - 2; i >= 0; i--)
+    rc_encode_direct_bit(rc, (int)((value >> i) & 1));
+}
+
+//====================================================
+// Map signed numbers to unsigned ones (0,-1,1,-2,...)
+//====================================================
+static inline unsigned long long zigzag(long long value) {
+  return ((unsigned long long) value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+//====================================================
+// Map a float to an integer with the same ordering
+// (and -0.0 != 0.0) for the exact (tolerance 0) mode
+//====================================================
+static inline long long float_to_ordered(float value) {
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if(bits & 0x80000000U) return -(long long)(bits & 0x7FFFFFFFU) - 1;
+  return (long long) bits;
+}
+
+//====================================================
+// The quantized position of a particle relative to its
+// Lagrangian position q, periodic in the box
+//====================================================
+static inline long long quantize_position(float x, float q, double boxsize, double tolerance) {
+  if(tolerance == 0.0) return float_to_ordered(x) - float_to_ordered(q);
+  double d = (double) x - (double) q;
+  if(d >= 0.5 * boxsize) d -= boxsize;
+  if(d < -0.5 * boxsize) d += boxsize;
+  return llround(d / (2.0 * tolerance));
+}
+
+static inline long long quantize_velocity(float v, double tolerance) {
+  if(tolerance == 0.0) return float_to_ordered(v);
+  return llround((double) v / (2.0 * tolerance));
+}
+
+//====================================================
+// Code a block of [npart] particles sorted by [id] 
+// with positions [pos] and velocities [vel] in the
+// output units. Returns the number of bytes in [out]
+// which must have room for 128 bytes per particle
+//====================================================
+size_t compress_particle_block(unsigned long long *id, float *pos, float *vel, int npart, int nsample, 
+    double boxsize, double pos_tolerance, double vel_tolerance, unsigned char *out) {
+  struct range_encoder rc;
+  unsigned short probs[COMPRESSED_NSTREAMS][128];
+  long long prev[COMPRESSED_NSTREAMS];
+  unsigned long long previd = ~0ULL;
+  double dx = boxsize / (double) nsample;
+
+  for(int s = 0; s < COMPRESSED_NSTREAMS; s++) {
+    for(int i = 0; i < 128; i++) probs[s][i] = RC_PROB_INIT;
+    prev[s] = 0;
+  }
+
+  rc_init(&rc, out);
+  for(int n = 0; n < npart; n++) {
+
+    // The IDs are sorted so the differences are small (0 for neighbouring particles)
+    rc_encode_number(&rc, probs[0], id[n] - previd - 1);
+    previd = id[n];
+
+    // The Lagrangian position of the particle
+    unsigned long long q[3] = {id[n] / ((unsigned long long) nsample * nsample), (id[n] / nsample) % nsample, id[n] % nsample};
+
+    for(int axes = 0; axes < 3; axes++) {
+      long long value = quantize_position(pos[3 * n + axes], (float)(q[axes] * dx), boxsize, pos_tolerance);
+      rc_encode_number(&rc, probs[1 + axes], zigzag(value - prev[1 + axes]));
+      prev[1 + axes] = value;
+    }
+    for(int axes = 0; axes < 3; axes++) {
+      long long value = quantize_velocity(vel[3 * n + axes], vel_tolerance);
+      rc_encode_number(&rc, probs[4 + axes], zigzag(value - prev[4 + axes]));
+      prev[4 + axes] = value;
+    }
+  }
+  rc_flush(&rc);
+
+  return rc.pos;
+}
+
+#ifndef COMPRESSED_CODER_ONLY
+
+//====================================================
+// Sort the particles by their Lagrangian ID
+//====================================================
+struct compressed_sort_data {
+  unsigned long long id;
+  unsigned int index;
+};
+
+static int compare_lagrangian_id(const void *a, const void *b) {
+  unsigned long long ida = ((const struct compressed_sort_data *) a)->id;
+  unsigned long long idb = ((const struct compressed_sort_data *) b)->id;
+  return (ida > idb) - (ida < idb);
+}
+
+//====================================================
+// Write the particles on this task to [fp] in the
+// compressed format. Positions are in Mpc/h and the
+// velocities in km/s as for the GADGET files
+//====================================================
+void write_compressed_particles(FILE *fp, double A, double Dv, double Dv2, int use_2lpt_step) {
+  double fac       = Hubble / pow(A,1.5);
+  double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
+  double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
+
+  struct compressed_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, COMPRESSED_MAGIC, sizeof(hdr.magic));
+  hdr.version       = COMPRESSED_VERSION;
+  hdr.nsample       = Nsample;
+  hdr.block_size    = COMPRESSED_BLOCK_SIZE;
+  hdr.num_files     = NTaskWithN;
+  hdr.npart         = NumPart;
+  hdr.npart_total   = TotNumPart;
+  hdr.boxsize       = Box * lengthfac;
+  hdr.redshift      = 1.0 / A - 1.0;
+  hdr.pos_tolerance = CompressPosTolerance;
+  hdr.vel_tolerance = CompressVelTolerance;
+  my_fwrite(&hdr, sizeof(hdr), 1, fp);
+
+  struct compressed_sort_data *order = malloc(sizeof(struct compressed_sort_data) * NumPart + 1);
+  for(unsigned int n = 0; n < NumPart; n++) {
+    order[n].id    = lagrangian_id(n);
+    order[n].index = n;
+  }
+  qsort(order, NumPart, sizeof(struct compressed_sort_data), compare_lagrangian_id);
+
+  unsigned long long *id = malloc(sizeof(unsigned long long) * COMPRESSED_BLOCK_SIZE);
+  float *pos = malloc(sizeof(float) * 3 * COMPRESSED_BLOCK_SIZE);
+  float *vel = malloc(sizeof(float) * 3 * COMPRESSED_BLOCK_SIZE);
+  unsigned char *out = malloc((size_t) 128 * COMPRESSED_BLOCK_SIZE + 1024);
+
+  for(unsigned int start = 0; start < NumPart; start += COMPRESSED_BLOCK_SIZE) {
+    unsigned int npart_block = NumPart - start < COMPRESSED_BLOCK_SIZE ? NumPart - start : COMPRESSED_BLOCK_SIZE;
+    for(unsigned int i = 0; i < npart_block; i++) {
+      unsigned int n = order[start + i].index;
+      id[i] = order[start + i].id;
+      for(int k = 0; k < 3; k++) {
+        pos[3 * i + k] = (float)(lengthfac*P[n].Pos[k]);
+        // Remember to add the ZA and 2LPT velocities back on and convert to PTHalos velocity units
+#ifdef SCALEDEPENDENT
+        vel[3 * i + k] = (float)(velfac*fac*(P[n].Vel[k] - sumxyz[k] + (P[n].dDdy[k] + P[n].dD2dy[k] * use_2lpt_step ) * UseCOLA));
+#else
+        vel[3 * i + k] = (float)(velfac*fac*(P[n].Vel[k] - sumxyz[k] + (P[n].D[k] * Dv + P[n].D2[k] * Dv2 * use_2lpt_step ) * UseCOLA));
+#endif
+      }
+    }
+
+    unsigned int nbytes = (unsigned int) compress_particle_block(id, pos, vel, npart_block, Nsample, hdr.boxsize, 
+        CompressPosTolerance, CompressVelTolerance, out);
+    my_fwrite(&npart_block, sizeof(npart_block), 1, fp);
+    my_fwrite(&nbytes,      sizeof(nbytes),      1, fp);
+    my_fwrite(out, sizeof(unsigned char), nbytes, fp);
+  }
+
+  free(out);
+  free(vel);
+  free(pos);
+  free(id);
+  free(order);
+}
+
+#endif
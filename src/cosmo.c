@@ -36,22 +36,196 @@
 #include "new_cosmo.h"
 
 //=============================================================
-// Functions for COLA modified time-stepping (used when StdDA=0)
-// This is updated to work with a general cosmology
+// The time-stepping integrals below are needed every step (and
+// for every drift in the lightcone) so we tabulate the
+// cumulative integrals as function of log(a) once in
+// init_time_integral_splines() and look them up. Outside the
+// tables (or before they are made) we use the quadrature
 //=============================================================
-double Sq(double ai,double af,double aRef) {
+#define TIME_INTEGRAL_AMIN      1.0e-5
+#define TIME_INTEGRAL_AMAX      2.01
+#define TIME_INTEGRAL_NPTS      10000
+#define TIME_INTEGRAL_NCHECK    50
+#define TIME_INTEGRAL_TOLERANCE 1.0e-6
+
+struct TimeIntegralSplineContainer{
+  int Splines_Are_Created;
+  int fullT;                    // The values of fullT and nLPT the Sq table is made for
+  double nLPT;
+  double amin, amax;
+  double tmin, tmax;
+  Spline Sq_spline;             // int_1^a fun da as function of log(a)
+  Spline SqStd_spline;          // int_1^a funSqStd da as function of log(a)
+  Spline SphiStd_spline;        // int_1^a funSphiStd da as function of log(a)
+  Spline CosmoTime_spline;      // CosmoTime(a) as function of log(a)
+  Spline AofTime_spline;        // log(a) as function of log(CosmoTime)
+} TimeIntegralSplines;
+
+//=============================================================
+// int_ai^af integrand(a) da using quadrature
+//=============================================================
+double integrate_cosmo_integrand(double (*integrand)(double, void *), double ai, double af) {
   double alpha = 0.0;
   double result, error;
 
   gsl_function F;
   gsl_integration_workspace * w = gsl_integration_workspace_alloc (5000);
 
-  F.function = &fun;
+  F.function = integrand;
   F.params = &alpha;
 
-  gsl_integration_qag(&F, (double)ai, (double)af, 0, 1e-5, 5000, 6, w, &result, &error); 
+  gsl_integration_qag(&F, ai, af, 0, 1e-5, 5000, 6, w, &result, &error); 
   gsl_integration_workspace_free (w);
 
+  return result;
+}
+
+int time_integral_table_covers(double ai, double af) {
+  if(TimeIntegralSplines.Splines_Are_Created == 0) return 0;
+  return (ai >= TimeIntegralSplines.amin && ai <= TimeIntegralSplines.amax && 
+          af >= TimeIntegralSplines.amin && af <= TimeIntegralSplines.amax);
+}
+
+//=============================================================
+// Tabulate the integrals on a grid in log(a) and check the
+// result against the quadrature. If the check fails we free
+// the tables and all calls use the quadrature
+//=============================================================
+void init_time_integral_splines() {
+  int npts = TIME_INTEGRAL_NPTS;
+  double logamin = log(TIME_INTEGRAL_AMIN);
+  double logamax = log(TIME_INTEGRAL_AMAX);
+  double dx = (logamax - logamin) / (double)(npts - 1);
+  double amin = TIME_INTEGRAL_AMIN, amax = TIME_INTEGRAL_AMAX;
+  int i;
+
+  free_time_integral_splines();
+
+  double *x_arr       = malloc(sizeof(double) * npts);
+  double *sq_arr      = malloc(sizeof(double) * npts);
+  double *sqstd_arr   = malloc(sizeof(double) * npts);
+  double *sphistd_arr = malloc(sizeof(double) * npts);
+  double *time_arr    = malloc(sizeof(double) * npts);
+  double *logt_arr    = malloc(sizeof(double) * npts);
+  double *loga_arr    = malloc(sizeof(double) * npts);
+  for(i = 0; i < npts; i++) x_arr[i] = logamin + dx * i;
+
+  // The integrals are accumulated outwards from the node closest to a = 1. The
+  // Sq integrand grows as a^-4 at early times so starting from amin would make
+  // the differences we look up suffer from cancellations
+  int i1 = (int)(-logamin / dx + 0.5);
+  sq_arr[i1]      = integrate_cosmo_integrand(&fun,        1.0, exp(x_arr[i1]));
+  sqstd_arr[i1]   = integrate_cosmo_integrand(&funSqStd,   1.0, exp(x_arr[i1]));
+  sphistd_arr[i1] = integrate_cosmo_integrand(&funSphiStd, 1.0, exp(x_arr[i1]));
+  for(i = i1 + 1; i < npts; i++){
+    double a0 = exp(x_arr[i-1]), a1 = exp(x_arr[i]);
+    sq_arr[i]      = sq_arr[i-1]      + integrate_cosmo_integrand(&fun,        a0, a1);
+    sqstd_arr[i]   = sqstd_arr[i-1]   + integrate_cosmo_integrand(&funSqStd,   a0, a1);
+    sphistd_arr[i] = sphistd_arr[i-1] + integrate_cosmo_integrand(&funSphiStd, a0, a1);
+  }
+  for(i = i1 - 1; i >= 0; i--){
+    double a0 = exp(x_arr[i]), a1 = exp(x_arr[i+1]);
+    sq_arr[i]      = sq_arr[i+1]      - integrate_cosmo_integrand(&fun,        a0, a1);
+    sqstd_arr[i]   = sqstd_arr[i+1]   - integrate_cosmo_integrand(&funSqStd,   a0, a1);
+    sphistd_arr[i] = sphistd_arr[i+1] - integrate_cosmo_integrand(&funSphiStd, a0, a1);
+  }
+
+  time_arr[0] = integrate_cosmo_integrand(&CosmoTimeFun, 1.0e-8, amin);
+  for(i = 1; i < npts; i++)
+    time_arr[i] = time_arr[i-1] + integrate_cosmo_integrand(&CosmoTimeFun, exp(x_arr[i-1]), exp(x_arr[i]));
+
+  // Make the splines. The boundary conditions are the exact derivatives d/dlog(a) = a * integrand
+  create_spline(&TimeIntegralSplines.Sq_spline,        x_arr, sq_arr,      npts, amin * fun(amin, NULL),               amax * fun(amax, NULL),               LINEAR_SPACED_SPLINE);
+  create_spline(&TimeIntegralSplines.SqStd_spline,     x_arr, sqstd_arr,   npts, amin * funSqStd(amin, NULL),          amax * funSqStd(amax, NULL),          LINEAR_SPACED_SPLINE);
+  create_spline(&TimeIntegralSplines.SphiStd_spline,   x_arr, sphistd_arr, npts, amin * funSphiStd(amin, NULL),        amax * funSphiStd(amax, NULL),        LINEAR_SPACED_SPLINE);
+  create_spline(&TimeIntegralSplines.CosmoTime_spline, x_arr, time_arr,    npts, amin * CosmoTimeFun(amin, NULL),      amax * CosmoTimeFun(amax, NULL),      LINEAR_SPACED_SPLINE);
+
+  // The inverse log(a) of log(CosmoTime). We first spline it on the (non-uniform) log(CosmoTime)
+  // values of the grid and then resample it on a uniform grid for O(1) lookups
+  // dlog(a)/dlog(t) = t / (a * dt/da)
+  double logtmin = log(time_arr[0]);
+  double logtmax = log(time_arr[npts-1]);
+  double dlogadlogt_min = time_arr[0]      / (amin * CosmoTimeFun(amin, NULL));
+  double dlogadlogt_max = time_arr[npts-1] / (amax * CosmoTimeFun(amax, NULL));
+  for(i = 0; i < npts; i++) logt_arr[i] = log(time_arr[i]);
+
+  Spline loga_of_logt_spline;
+  create_spline(&loga_of_logt_spline, logt_arr, x_arr, npts, dlogadlogt_min, dlogadlogt_max, ARBITRARY_SPACED_SPLINE);
+  for(i = 0; i < npts; i++)
+    logt_arr[i] = (i == npts-1 ? logtmax : logtmin + (logtmax - logtmin) * i / (double)(npts - 1));
+  spline_lookup_many(&loga_of_logt_spline, logt_arr, loga_arr, npts);
+  free_spline(&loga_of_logt_spline);
+  create_spline(&TimeIntegralSplines.AofTime_spline, logt_arr, loga_arr, npts, dlogadlogt_min, dlogadlogt_max, LINEAR_SPACED_SPLINE);
+
+  TimeIntegralSplines.fullT = fullT;
+  TimeIntegralSplines.nLPT  = nLPT;
+  TimeIntegralSplines.amin  = amin;
+  TimeIntegralSplines.amax  = amax;
+  TimeIntegralSplines.tmin  = time_arr[0];
+  TimeIntegralSplines.tmax  = time_arr[npts-1];
+  TimeIntegralSplines.Splines_Are_Created = 1;
+
+  // Compare to the quadrature for steps of 5% in a in the range 1e-3 <= a <= 1
+  double maxerr = 0.0;
+  for(i = 0; i < TIME_INTEGRAL_NCHECK; i++){
+    double ai = exp(log(1e-3) * (1.0 - i / (double)(TIME_INTEGRAL_NCHECK - 1)));
+    double af = ai * 1.05;
+    double err[5], quad;
+    
+    quad   = integrate_cosmo_integrand(&fun, ai, af);
+    err[0] = fabs(Sq(ai, af, 1.0) / quad - 1.0);
+    quad   = integrate_cosmo_integrand(&funSqStd, ai, af);
+    err[1] = fabs(SqStd(ai, af) / quad - 1.0);
+    quad   = integrate_cosmo_integrand(&funSphiStd, ai, af);
+    err[2] = fabs(SphiStd(ai, af) / quad - 1.0);
+    quad   = integrate_cosmo_integrand(&CosmoTimeFun, 1.0e-8, ai);
+    err[3] = fabs(CosmoTime(ai) / quad - 1.0);
+    err[4] = fabs(AofTime(quad) / ai - 1.0);
+    for(int j = 0; j < 5; j++) 
+      if(err[j] > maxerr || isnan(err[j])) maxerr = err[j];
+  }
+
+  if(ThisTask == 0){
+    printf("Tabulated the time-stepping integrals for %e < a < %e with %i points. Max rel. error wrt. quadrature = %e\n", amin, amax, npts, maxerr);
+    if(!(maxerr < TIME_INTEGRAL_TOLERANCE))
+      printf("WARNING: error larger than the tolerance %e. Using quadrature for the time-stepping integrals\n", TIME_INTEGRAL_TOLERANCE);
+    fflush(stdout);
+  }
+  if(!(maxerr < TIME_INTEGRAL_TOLERANCE)) free_time_integral_splines();
+
+  free(x_arr);
+  free(sq_arr);
+  free(sqstd_arr);
+  free(sphistd_arr);
+  free(time_arr);
+  free(logt_arr);
+  free(loga_arr);
+}
+
+void free_time_integral_splines() {
+  if(TimeIntegralSplines.Splines_Are_Created == 1){
+    free_spline(&TimeIntegralSplines.Sq_spline);
+    free_spline(&TimeIntegralSplines.SqStd_spline);
+    free_spline(&TimeIntegralSplines.SphiStd_spline);
+    free_spline(&TimeIntegralSplines.CosmoTime_spline);
+    free_spline(&TimeIntegralSplines.AofTime_spline);
+  }
+  TimeIntegralSplines.Splines_Are_Created = 0;
+}
+
+//=============================================================
+// Functions for COLA modified time-stepping (used when StdDA=0)
+// This is updated to work with a general cosmology
+//=============================================================
+double Sq(double ai,double af,double aRef) {
+  double result;
+
+  if(time_integral_table_covers(ai, af) && TimeIntegralSplines.fullT == fullT && TimeIntegralSplines.nLPT == nLPT) {
+    result = spline_lookup(&TimeIntegralSplines.Sq_spline, log(af)) - spline_lookup(&TimeIntegralSplines.Sq_spline, log(ai));
+  } else {
+    result = integrate_cosmo_integrand(&fun, ai, af);
+  }
+
   if (fullT == 1) {
     return result/gpQ(aRef);
   } else {
@@ -91,19 +265,9 @@ double DERgpQ(double a) {
 // Functions for Quinn et al time-stepping (used when StdDA=2)
 //============================================================
 double SqStd(double ai,double af) {
-  double alpha = 0.0;
-  double result, error;
-
-  gsl_function F;
-  gsl_integration_workspace * w = gsl_integration_workspace_alloc (5000);
-
-  F.function = &funSqStd;
-  F.params = &alpha;
-
-  gsl_integration_qag(&F,ai,af,0,1e-5,5000,6,w,&result,&error); 
-  gsl_integration_workspace_free (w);
-
-  return result;
+  if(time_integral_table_covers(ai, af))
+    return spline_lookup(&TimeIntegralSplines.SqStd_spline, log(af)) - spline_lookup(&TimeIntegralSplines.SqStd_spline, log(ai));
+  return integrate_cosmo_integrand(&funSqStd, ai, af);
 }
 
 double funSqStd(double a, void * params) {
@@ -111,19 +275,9 @@ double funSqStd(double a, void * params) {
 }
 
 double SphiStd(double ai,double af) {
-  double alpha = 0.0;
-  double result, error;
-
-  gsl_function F;
-  gsl_integration_workspace * w = gsl_integration_workspace_alloc (5000);
-
-  F.function = &funSphiStd;
-  F.params = &alpha;
-
-  gsl_integration_qag (&F,ai,af,0,1e-5,5000,6,w,&result,&error); 
-  gsl_integration_workspace_free (w);
-     
-  return result;
+  if(time_integral_table_covers(ai, af))
+    return spline_lookup(&TimeIntegralSplines.SphiStd_spline, log(af)) - spline_lookup(&TimeIntegralSplines.SphiStd_spline, log(ai));
+  return integrate_cosmo_integrand(&funSphiStd, ai, af);
 }
 
 double funSphiStd(double a, void * params) {       
@@ -143,6 +297,9 @@ struct quadratic_params {
 // Solves y = CosmoTime(a) for a
 //===============================
 double AofTime(double y) {
+  if(TimeIntegralSplines.Splines_Are_Created == 1 && y >= TimeIntegralSplines.tmin && y <= TimeIntegralSplines.tmax)
+    return exp(spline_lookup(&TimeIntegralSplines.AofTime_spline, log(y)));
+
   int status;
   int iter = 0, max_iter = 1000;
   double r = 0.0;
@@ -186,20 +343,10 @@ double AofTimeFun(double a,void * params) {
 //=============================================================     
 double CosmoTime(double af) {
   double ai = 1.0e-8;
-  double alpha = 0.0;
-  double result, error;
 
-  gsl_function F;
-  gsl_integration_workspace * w = gsl_integration_workspace_alloc (5000);
-     
-  F.function = &CosmoTimeFun;
-  F.params = &alpha;
-     
-  gsl_integration_qag (&F,ai,af,0,1e-5,5000,6,w, &result, &error); 
-    
-  gsl_integration_workspace_free (w);
-     
-  return result;
+  if(time_integral_table_covers(af, af))
+    return spline_lookup(&TimeIntegralSplines.CosmoTime_spline, log(af));
+  return integrate_cosmo_integrand(&CosmoTimeFun, ai, af);
 }
 
 double CosmoTimeFun (double a, void * params) { 
@@ -0,0 +1,517 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+
+//==========================================================================//
+// This file contains the MPI-parallel Friends-of-Friends halo finder run   //
+// on P[] in Output(). Each task links the particles in its x-slab with a  //
+// cell-linked list and a union-find, including ghost particles from the   //
+// task on the right (RightTask) that are within the linking length of the //
+// boundary. Groups that cross slabs are merged by propagating the lowest  //
+// particle index along the tasks until nothing changes. The sums for each //
+// group are collected on the task owning the particle with this index,   //
+// which writes the halo catalogue (and the Lagrangian IDs of the members  //
+// with PARTICLE_ID or SCALEDEPENDENT). The halo ID is the lowest global  //
+// index in P[] of a member at this output so it changes between outputs  //
+//==========================================================================//
+
+#include "vars.h"
+#include "proto.h"
+#include "timer.h"
+
+#define FOF_NO_LABEL (~0ULL)
+
+//====================================================
+// The sums over the particles of a group on one task.
+// The positions are relative to a reference particle
+// to deal with the periodic boundary
+//====================================================
+struct fof_partial {
+  unsigned long long label;   // The lowest global particle index in the group
+  unsigned long long npart;   // The number of particles
+  double ref[3];              // The position of a member particle
+  double dx[3];               // Sum of the positions relative to ref
+  double v[3];                // Sum of the velocities
+};
+
+//====================================================
+// Union-find with path halving. The root is always
+// the member with the lowest index
+//====================================================
+static inline int fof_find(int *parent, int i) {
+  while(parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+static inline void fof_union(int *parent, int i, int j) {
+  int ri = fof_find(parent, i), rj = fof_find(parent, j);
+  if(ri < rj) parent[rj] = ri;
+  else if(rj < ri) parent[ri] = rj;
+}
+
+static inline double fof_periodic(double dx) {
+  if(dx >  0.5 * Box) dx -= Box;
+  if(dx < -0.5 * Box) dx += Box;
+  return dx;
+}
+
+//====================================================
+// Send [send_count] elements of [elemsize] bytes to
+// each task and return the elements we receive (in
+// task order) and their number in [nrecv]
+//====================================================
+static void *fof_alltoallv(void *sendbuf, int *send_count, size_t elemsize, int *nrecv, int *recv_count) {
+  int *send_bytes  = malloc(sizeof(int) * NTask);
+  int *recv_bytes  = malloc(sizeof(int) * NTask);
+  int *send_offset = malloc(sizeof(int) * NTask);
+  int *recv_offset = malloc(sizeof(int) * NTask);
+
+  MPI_Alltoall(send_count, 1, MPI_INT, recv_count, 1, MPI_INT, MPI_COMM_WORLD);
+  *nrecv = 0;
+  for(int t = 0, soff = 0; t < NTask; t++) {
+    send_bytes[t]  = send_count[t] * elemsize;
+    recv_bytes[t]  = recv_count[t] * elemsize;
+    send_offset[t] = soff;
+    recv_offset[t] = *nrecv * elemsize;
+    soff   += send_bytes[t];
+    *nrecv += recv_count[t];
+  }
+
+  void *recvbuf = malloc(*nrecv * elemsize + 1);
+  MPI_Alltoallv(sendbuf, send_bytes, send_offset, MPI_BYTE, recvbuf, recv_bytes, recv_offset, MPI_BYTE, MPI_COMM_WORLD);
+
+  free(send_bytes);
+  free(recv_bytes);
+  free(send_offset);
+  free(recv_offset);
+  return recvbuf;
+}
+
+static int compare_fof_partial(const void *a, const void *b) {
+  unsigned long long la = ((const struct fof_partial *) a)->label;
+  unsigned long long lb = ((const struct fof_partial *) b)->label;
+  return (la > lb) - (la < lb);
+}
+
+#if defined(PARTICLE_ID) || defined(SCALEDEPENDENT)
+static int compare_fof_member(const void *a, const void *b) {
+  const unsigned long long *ma = a, *mb = b;
+  if(ma[0] != mb[0]) return (ma[0] > mb[0]) - (ma[0] < mb[0]);
+  return (ma[1] > mb[1]) - (ma[1] < mb[1]);
+}
+#endif
+
+//====================================================
+// Find the FoF halos of the particles on all tasks
+// and write the catalogue. Must be called by all tasks
+//====================================================
+void fof_find_halos(double A, double Dv, double Dv2, int use_2lpt_step) {
+  timer_start(_FoF);
+  double Z         = (1.0/A)-1.0;
+  double fac       = Hubble / pow(A,1.5);
+  double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
+  double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
+  double linklength = FoFLinkingLength * Box / (double) Nsample;
+  double linklength2 = linklength * linklength;
+  double x_lo = Local_x_start * Box / (double) Nmesh;
+  double x_hi = (Local_x_start + Local_nx) * Box / (double) Nmesh;
+  int single_slab = (RightTask == ThisTask);
+  unsigned int i;
+
+  //====================================================
+  // The ghosts only come from the neighbour on the right so all slabs
+  // must be wider than the linking length. The particles must also be 
+  // on the task owning their slab (not the case for the IC output)
+  //====================================================
+  int misplaced = 0;
+  for(i = 0; i < NumPart; i++) {
+    int X = (int)(P[i].Pos[0] * Nmesh / Box);
+    if(X >= Nmesh) X = Nmesh - 1;
+    if(Slab_to_task[X] != ThisTask) misplaced = 1;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &misplaced, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if(misplaced) {
+    if(ThisTask == 0) printf("FoF: particles are not on the task owning their slab, no halo catalogue at z = %f\n", Z);
+    timer_stop(_FoF);
+    return;
+  }
+  for(int t = 0; t < NTask; t++) {
+    if(Local_nx_table[t] > 0 && Local_nx_table[t] * Box / (double) Nmesh < linklength) {
+      if(ThisTask == 0) printf("\nERROR: FoF needs slabs wider than the linking length. Use fewer tasks or a smaller FoFLinkingLength.\n\n");
+      FatalError((char *)"fof.c", 162);
+    }
+  }
+
+  //====================================================
+  // Send the particles within the linking length of our left boundary
+  // to the task on the left and get the ghosts from the task on the right
+  //====================================================
+  int nsent = 0, nghost = 0;
+  int *sent_index = malloc(sizeof(int) * NumPart + 1);
+  if(! single_slab) 
+    for(i = 0; i < NumPart; i++) 
+      if(P[i].Pos[0] < x_lo + linklength) sent_index[nsent++] = i;
+
+  MPI_Status status;
+  MPI_Sendrecv(&nsent, 1, MPI_INT, LeftTask, 0, &nghost, 1, MPI_INT, RightTask, 0, MPI_COMM_WORLD, &status);
+
+  int ntot = NumPart + nghost;
+  double *pos = malloc(sizeof(double) * 3 * ntot + 1);
+  for(i = 0; i < NumPart; i++)
+    for(int k = 0; k < 3; k++) pos[3 * i + k] = P[i].Pos[k];
+
+  double *sendpos = malloc(sizeof(double) * 3 * nsent + 1);
+  for(int n = 0; n < nsent; n++)
+    for(int k = 0; k < 3; k++) sendpos[3 * n + k] = P[sent_index[n]].Pos[k];
+  MPI_Sendrecv(sendpos, 3 * nsent, MPI_DOUBLE, LeftTask, 0, &pos[3 * NumPart], 3 * nghost, MPI_DOUBLE, RightTask, 0, MPI_COMM_WORLD, &status);
+  free(sendpos);
+
+  // The ghosts from the first slab are to the right of the last slab
+  for(int n = NumPart; n < ntot; n++) 
+    if(pos[3 * n] < x_lo) pos[3 * n] += Box;
+
+  //====================================================
+  // Cell-linked list with cells at least as large as the linking length
+  // (and not smaller than the mean particle separation)
+  //====================================================
+  int nc = (int)(Box / linklength);
+  if(nc > Nsample) nc = Nsample;
+  if(nc < 1) nc = 1;
+  double cellsize = Box / (double) nc;
+  int ncx = single_slab ? nc : (int)((x_hi - x_lo + linklength) / cellsize) + 2;
+  size_t ncells = (size_t) ncx * nc * nc;
+
+  int *head = malloc(sizeof(int) * ncells);
+  int *next = malloc(sizeof(int) * ntot + 1);
+  int *cell = malloc(sizeof(int) * ntot + 1);
+  for(size_t c = 0; c < ncells; c++) head[c] = -1;
+  for(int n = 0; n < ntot; n++) {
+    int cx = (int)((pos[3 * n] - (single_slab ? 0.0 : x_lo)) / cellsize);
+    int cy = (int)(pos[3 * n + 1] / cellsize);
+    int cz = (int)(pos[3 * n + 2] / cellsize);
+    if(cx >= ncx) cx = ncx - 1;
+    if(cy >= nc) cy = nc - 1;
+    if(cz >= nc) cz = nc - 1;
+    if(cx < 0) cx = 0;
+    cell[n] = (cx * nc + cy) * nc + cz;
+    next[n] = head[cell[n]];
+    head[cell[n]] = n;
+  }
+
+  //====================================================
+  // Link all pairs closer than the linking length
+  //====================================================
+  int *parent = malloc(sizeof(int) * ntot + 1);
+  for(int n = 0; n < ntot; n++) parent[n] = n;
+
+  for(int n = 0; n < ntot; n++) {
+    int cx = cell[n] / (nc * nc), cy = (cell[n] / nc) % nc, cz = cell[n] % nc;
+    for(int ix = cx - 1; ix <= cx + 1; ix++) {
+      int jx = ix;
+      if(single_slab) jx = (ix + nc) % nc;
+      else if(ix < 0 || ix >= ncx) continue;
+      for(int iy = cy - 1; iy <= cy + 1; iy++) {
+        int jy = (iy + nc) % nc;
+        for(int iz = cz - 1; iz <= cz + 1; iz++) {
+          int jz = (iz + nc) % nc;
+          for(int m = head[(jx * nc + jy) * nc + jz]; m >= 0; m = next[m]) {
+            if(m <= n) continue;
+            double dx = pos[3 * m] - pos[3 * n];
+            if(single_slab) dx = fof_periodic(dx);
+            double dy = fof_periodic(pos[3 * m + 1] - pos[3 * n + 1]);
+            double dz = fof_periodic(pos[3 * m + 2] - pos[3 * n + 2]);
+            if(dx * dx + dy * dy + dz * dz < linklength2) fof_union(parent, n, m);
+          }
+        }
+      }
+    }
+  }
+  free(head);
+  free(next);
+  free(cell);
+
+  //====================================================
+  // Label the groups with the lowest global index of the particles
+  // in them and merge the groups across the slabs by exchanging the
+  // labels of the ghosts until nothing changes
+  //====================================================
+  unsigned long long offset = 0, npart_loc = NumPart;
+  MPI_Exscan(&npart_loc, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if(ThisTask == 0) offset = 0;
+
+  unsigned long long *label = malloc(sizeof(unsigned long long) * ntot + 1);
+  for(int n = 0; n < ntot; n++) label[n] = FOF_NO_LABEL;
+  for(i = 0; i < NumPart; i++) if(fof_find(parent, i) == (int) i) label[i] = offset + i;
+
+  unsigned long long *ghost_label = malloc(sizeof(unsigned long long) * nghost + 1);
+  unsigned long long *sent_label  = malloc(sizeof(unsigned long long) * nsent + 1);
+  int changed = 1, niter = 0;
+  while(changed) {
+    changed = 0;
+
+    // Send the labels of the ghosts to the task that owns them
+    for(int n = 0; n < nghost; n++) ghost_label[n] = label[fof_find(parent, NumPart + n)];
+    MPI_Sendrecv(ghost_label, nghost, MPI_UNSIGNED_LONG_LONG, RightTask, 0, sent_label, nsent, MPI_UNSIGNED_LONG_LONG, LeftTask, 0, MPI_COMM_WORLD, &status);
+    for(int n = 0; n < nsent; n++) {
+      int r = fof_find(parent, sent_index[n]);
+      if(sent_label[n] < label[r]) {
+        label[r] = sent_label[n];
+        changed = 1;
+      }
+    }
+
+    // And the other way
+    for(int n = 0; n < nsent; n++) sent_label[n] = label[fof_find(parent, sent_index[n])];
+    MPI_Sendrecv(sent_label, nsent, MPI_UNSIGNED_LONG_LONG, LeftTask, 0, ghost_label, nghost, MPI_UNSIGNED_LONG_LONG, RightTask, 0, MPI_COMM_WORLD, &status);
+    for(int n = 0; n < nghost; n++) {
+      int r = fof_find(parent, NumPart + n);
+      if(ghost_label[n] < label[r]) {
+        label[r] = ghost_label[n];
+        changed = 1;
+      }
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    niter++;
+  }
+  free(ghost_label);
+  free(sent_label);
+
+  //====================================================
+  // Groups that touch the boundary may continue on other tasks,
+  // the others are complete and are dropped if they are too small
+  //====================================================
+  int *boundary = calloc(ntot + 1, sizeof(int));
+  for(int n = 0; n < nsent; n++) boundary[fof_find(parent, sent_index[n])] = 1;
+  for(int n = NumPart; n < ntot; n++) boundary[fof_find(parent, n)] = 1;
+
+  int *npart_group = calloc(NumPart + 1, sizeof(int));
+  for(i = 0; i < NumPart; i++) npart_group[fof_find(parent, i)]++;
+
+  // The sums for each group on this task
+  int npartial = 0;
+  int *partial_index = malloc(sizeof(int) * NumPart + 1);
+  for(i = 0; i < NumPart; i++) {
+    partial_index[i] = -1;
+    if(fof_find(parent, i) == (int) i && (boundary[i] || npart_group[i] >= FoFMinParticles)) partial_index[i] = npartial++;
+  }
+  struct fof_partial *partial = calloc(npartial + 1, sizeof(struct fof_partial));
+  for(i = 0; i < NumPart; i++) {
+    int r = fof_find(parent, i);
+    int p = partial_index[r];
+    if(p < 0) continue;
+    if(partial[p].npart == 0) {
+      partial[p].label = label[r];
+      for(int k = 0; k < 3; k++) partial[p].ref[k] = P[i].Pos[k];
+    }
+    partial[p].npart++;
+    for(int k = 0; k < 3; k++) {
+      partial[p].dx[k] += fof_periodic(P[i].Pos[k] - partial[p].ref[k]);
+      // Remember to add the ZA and 2LPT velocities back on
+#ifdef SCALEDEPENDENT
+      partial[p].v[k] += fac*(P[i].Vel[k] - sumxyz[k] + (P[i].dDdy[k] + P[i].dD2dy[k] * use_2lpt_step ) * UseCOLA);
+#else
+      partial[p].v[k] += fac*(P[i].Vel[k] - sumxyz[k] + (P[i].D[k] * Dv + P[i].D2[k] * Dv2 * use_2lpt_step ) * UseCOLA);
+#endif
+    }
+  }
+  free(boundary);
+  free(npart_group);
+
+  //====================================================
+  // Send the sums to the task owning the particle with the label
+  //====================================================
+  unsigned long long *offset_table = malloc(sizeof(unsigned long long) * (NTask + 1));
+  MPI_Allgather(&offset, 1, MPI_UNSIGNED_LONG_LONG, offset_table, 1, MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
+  offset_table[NTask] = TotNumPart;
+
+  int *owner = malloc(sizeof(int) * npartial + 1);
+  int *send_count = calloc(NTask, sizeof(int));
+  int *recv_count = calloc(NTask, sizeof(int));
+  for(int p = 0; p < npartial; p++) {
+    int t = 0;
+    while(t < NTask - 1 && offset_table[t + 1] <= partial[p].label) t++;
+    owner[p] = t;
+    send_count[t]++;
+  }
+
+  // Sort the sums by the owner
+  int *send_start = malloc(sizeof(int) * NTask);
+  for(int t = 0, s = 0; t < NTask; t++) {
+    send_start[t] = s;
+    s += send_count[t];
+  }
+  int *send_position = malloc(sizeof(int) * npartial + 1);
+  struct fof_partial *sendbuf = malloc(sizeof(struct fof_partial) * npartial + 1);
+  for(int p = 0; p < npartial; p++) {
+    send_position[p] = send_start[owner[p]]++;
+    sendbuf[send_position[p]] = partial[p];
+  }
+
+  int nrecv;
+  struct fof_partial *recvbuf = fof_alltoallv(sendbuf, send_count, sizeof(struct fof_partial), &nrecv, recv_count);
+  free(sendbuf);
+
+  //====================================================
+  // Combine the sums for each halo
+  //====================================================
+  struct fof_partial *combined = malloc(sizeof(struct fof_partial) * nrecv + 1);
+  memcpy(combined, recvbuf, sizeof(struct fof_partial) * nrecv);
+  qsort(combined, nrecv, sizeof(struct fof_partial), compare_fof_partial);
+
+  int nhalo = 0;
+  for(int n = 0; n < nrecv; ) {
+    struct fof_partial halo = combined[n];
+    int m = n + 1;
+    while(m < nrecv && combined[m].label == halo.label) {
+      for(int k = 0; k < 3; k++) {
+        halo.dx[k] += combined[m].dx[k] + combined[m].npart * fof_periodic(combined[m].ref[k] - halo.ref[k]);
+        halo.v[k]  += combined[m].v[k];
+      }
+      halo.npart += combined[m].npart;
+      m++;
+    }
+    if(halo.npart >= (unsigned long long) FoFMinParticles) combined[nhalo++] = halo;
+    n = m;
+  }
+
+  //====================================================
+  // Write the halo catalogue
+  //====================================================
+  double particle_mass = 2.77536627e11 * Omega * pow(Box * lengthfac, 3) / (double) TotNumPart;
+  char buf[300];
+  FILE *fp;
+  sprintf(buf, "%s/%s_z%dp%03d.fof.%d", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000), ThisTask);
+  if(!(fp = fopen(buf, "w"))) {
+    printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+    FatalError((char *)"fof.c", 408);
+  }
+  fprintf(fp, "# %d halos. Halo ID  Npart  Mass (Msun/h)  x  y  z (Mpc/h)  vx  vy  vz (km/s)\n", nhalo);
+  fprintf(fp, "# The halo ID is only unique within this output. Use the member IDs (Lagrangian IDs) to match halos between outputs\n");
+  for(int h = 0; h < nhalo; h++) {
+    double x[3], v[3];
+    for(int k = 0; k < 3; k++) {
+      x[k] = combined[h].ref[k] + combined[h].dx[k] / combined[h].npart;
+      if(x[k] <  0.0) x[k] += Box;
+      if(x[k] >= Box) x[k] -= Box;
+      v[k] = combined[h].v[k] / combined[h].npart;
+    }
+    fprintf(fp, "%llu %llu %e %f %f %f %f %f %f\n", combined[h].label, combined[h].npart, combined[h].npart * particle_mass,
+        lengthfac * x[0], lengthfac * x[1], lengthfac * x[2], velfac * v[0], velfac * v[1], velfac * v[2]);
+  }
+  fclose(fp);
+
+  int nhalo_tot = nhalo;
+  MPI_Allreduce(MPI_IN_PLACE, &nhalo_tot, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  if(ThisTask == 0) printf("FoF: found %d halos with at least %d particles at z = %f (%d iterations to merge the slabs)\n", nhalo_tot, FoFMinParticles, Z, niter);
+
+#if defined(PARTICLE_ID) || defined(SCALEDEPENDENT)
+  if(FoFWriteMemberIDs) {
+
+    //====================================================
+    // Tell the tasks which of their groups are halos. The answers go
+    // back in the order the sums were received
+    //====================================================
+    int *accepted = malloc(sizeof(int) * nrecv + 1);
+    for(int n = 0; n < nrecv; n++) {
+      int lo = 0, hi = nhalo - 1;
+      accepted[n] = 0;
+      while(lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if(combined[mid].label == recvbuf[n].label) { accepted[n] = 1; break; }
+        if(combined[mid].label < recvbuf[n].label) lo = mid + 1; else hi = mid - 1;
+      }
+    }
+    int nreply;
+    int *reply_count = calloc(NTask, sizeof(int));
+    int *reply = fof_alltoallv(accepted, recv_count, sizeof(int), &nreply, reply_count);
+    free(accepted);
+    free(reply_count);
+
+    //====================================================
+    // Send the (label, ID) of the members of the halos to the owners
+    //====================================================
+    int *member_count = calloc(NTask, sizeof(int));
+    for(i = 0; i < NumPart; i++) {
+      int p = partial_index[fof_find(parent, i)];
+      if(p >= 0 && reply[send_position[p]]) member_count[owner[p]] += 2;
+    }
+    for(int t = 0, s = 0; t < NTask; t++) {
+      send_start[t] = s;
+      s += member_count[t];
+    }
+    unsigned long long *members = malloc(sizeof(unsigned long long) * (send_start[NTask - 1] + member_count[NTask - 1]) + 1);
+    for(i = 0; i < NumPart; i++) {
+      int p = partial_index[fof_find(parent, i)];
+      if(p >= 0 && reply[send_position[p]]) {
+        members[send_start[owner[p]]++] = partial[p].label;
+        members[send_start[owner[p]]++] = lagrangian_id(i);
+      }
+    }
+    free(reply);
+
+    int nmembers;
+    unsigned long long *recv_members = fof_alltoallv(members, member_count, sizeof(unsigned long long), &nmembers, recv_count);
+    nmembers /= 2;
+    qsort(recv_members, nmembers, 2 * sizeof(unsigned long long), compare_fof_member);
+    free(members);
+    free(member_count);
+
+    // For each halo [Halo ID] [Npart] [Npart IDs] in the same order as the catalogue
+    sprintf(buf, "%s/%s_z%dp%03d.fof_ids.%d", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000), ThisTask);
+    if(!(fp = fopen(buf, "w"))) {
+      printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+      FatalError((char *)"fof.c", 484);
+    }
+    unsigned long long nhalo_file = nhalo;
+    my_fwrite(&nhalo_file, sizeof(nhalo_file), 1, fp);
+    for(int h = 0, n = 0; h < nhalo; h++) {
+      my_fwrite(&combined[h].label, sizeof(unsigned long long), 1, fp);
+      my_fwrite(&combined[h].npart, sizeof(unsigned long long), 1, fp);
+      for(unsigned long long m = 0; m < combined[h].npart; m++, n++) 
+        my_fwrite(&recv_members[2 * n + 1], sizeof(unsigned long long), 1, fp);
+    }
+    fclose(fp);
+    free(recv_members);
+  }
+#endif
+
+  free(combined);
+  free(recvbuf);
+  free(send_position);
+  free(send_start);
+  free(send_count);
+  free(recv_count);
+  free(owner);
+  free(offset_table);
+  free(partial);
+  free(partial_index);
+  free(label);
+  free(parent);
+  free(pos);
+  free(sent_index);
+  timer_stop(_FoF);
+}
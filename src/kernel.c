@@ -85,3 +85,85 @@ void read_kernel_table(void) {
 
   return;
 }
+
+//====================================================================
+// Prepare the kernel table for the batched computation in 2LPT.c:
+// check and adjust ker0 = -(kerA + kerB), merge rows with the same
+// exponents (summing the coefficients), sort the rows on ker0 so that
+// rows sharing the final k-factor are contiguous and make the list of
+// distinct exponents kerA/kerB so that every field k^ker * pot is 
+// Fourier transformed only once
+//====================================================================
+
+#define KERNEL_TOLERANCE 0.000000001
+
+static int same_kernel_exponent(double a, double b){
+  return fabs(a - b) < KERNEL_TOLERANCE;
+}
+
+void group_kernel_table(void) {
+  int i, j, n;
+
+  for(i = 0; i < NKernelTable; i++) {
+    double ker0 = KernelTable[i].ker0, kerA = KernelTable[i].kerA, kerB = KernelTable[i].kerB;
+    if(fabs(ker0 + kerA + kerB) < KERNEL_TOLERANCE) {
+      KernelTable[i].ker0 = -(kerA + kerB);
+    } else {
+      if(ThisTask == 0) printf("\nERROR: ker0 + kerA + kerB does not equal 0 in kernel table line %d\n", i);
+      FatalError((char *)"kernel.c", 113);
+    }
+
+    // Order the exponents so that (A,B) and (B,A) are recognized as the same term
+    if(kerA > kerB) {
+      KernelTable[i].kerA = kerB;
+      KernelTable[i].kerB = kerA;
+    }
+  }
+
+  // Merge rows with identical exponents
+  for(i = 0, n = 0; i < NKernelTable; i++) {
+    for(j = 0; j < n; j++) {
+      if(same_kernel_exponent(KernelTable[j].kerA, KernelTable[i].kerA) && 
+          same_kernel_exponent(KernelTable[j].kerB, KernelTable[i].kerB)) break;
+    }
+    if(j < n) {
+      KernelTable[j].Coef += KernelTable[i].Coef;
+    } else {
+      KernelTable[n++] = KernelTable[i];
+    }
+  }
+  if(ThisTask == 0 && n < NKernelTable) printf("Merged %d duplicate lines in the kernel table\n", NKernelTable - n);
+  NKernelTable = n;
+
+  // Sort on ker0 (insertion sort, the table is short)
+  for(i = 1; i < NKernelTable; i++) {
+    struct kern_table row = KernelTable[i];
+    for(j = i - 1; j >= 0 && KernelTable[j].ker0 > row.ker0 + KERNEL_TOLERANCE; j--) KernelTable[j+1] = KernelTable[j];
+    KernelTable[j+1] = row;
+  }
+
+  // The distinct exponents
+  KernelExponents  = (double *)malloc(2 * NKernelTable * sizeof(double));
+  NKernelExponents = 0;
+  for(i = 0; i < NKernelTable; i++) {
+    for(n = 0; n < 2; n++) {
+      double ker = (n == 0 ? KernelTable[i].kerA : KernelTable[i].kerB);
+      for(j = 0; j < NKernelExponents; j++)
+        if(same_kernel_exponent(KernelExponents[j], ker)) break;
+      if(j == NKernelExponents) KernelExponents[NKernelExponents++] = ker;
+      if(n == 0) KernelTable[i].indA = j;
+      else       KernelTable[i].indB = j;
+    }
+  }
+
+  if(ThisTask == 0) {
+    printf("The kernel table has %d terms with %d distinct exponents kerA/kerB\n", NKernelTable, NKernelExponents);
+    for(i = 0; i < NKernelTable; i++) 
+      printf("Values: %lf %lf %lf %lf\n", KernelTable[i].Coef, KernelTable[i].ker0, KernelTable[i].kerA, KernelTable[i].kerB);
+    fflush(stdout);
+  }
+
+  return;
+}
+
+#undef KERNEL_TOLERANCE
@@ -1,5 +1,6 @@
 #include "vars.h"
 #include "proto.h"
+#include "timer.h"
 
 //================================================================================================
 // 
@@ -258,6 +259,46 @@ double nearest_dist(double px, double py, double ix, double iy, double jx, doubl
 }
 
 
+//======================================================================
+// The coarse cell used for culling the replicates a particle is in
+//======================================================================
+static unsigned int lightcone_cell(float_kind * pos, int ncell) {
+  int axes, ic[3];
+  for (axes = 0; axes < 3; axes++) {
+    ic[axes] = (int)(pos[axes]*ncell/Box);
+    if (ic[axes] < 0) ic[axes] = 0;
+    if (ic[axes] >= ncell) ic[axes] = ncell-1;
+  }
+  return (ic[0]*ncell+ic[1])*ncell+ic[2];
+}
+
+//==========================================================================================================================
+// Can a particle in a cell with positions in the bounding box [lo, hi] and a displacement of at most dispmax this step
+// cross the lightcone in replicate (i, j, k)? It must start inside Rcomov_old and end outside Rcomov_new, so the nearest 
+// point of the box must be within Rcomov_old and the furthest point plus the displacement must be beyond Rcomov_new.
+// The positions are computed in the same order as for the particles so the test is never stricter than the one per particle
+//==========================================================================================================================
+static int cell_crosses_lightcone(double * lo, double * hi, double dispmax, int i, int j, int k, double Rcomov_old2, double Rcomov_new) {
+  int axes;
+  double origin[3] = {Origin_x, Origin_y, Origin_z};
+  double rep[3] = {i*Box, j*Box, k*Box};
+  double a, b, dmin2 = 0.0, dmax2 = 0.0;
+
+  for (axes = 0; axes < 3; axes++) {
+    a = lo[axes] - origin[axes] + rep[axes];
+    b = hi[axes] - origin[axes] + rep[axes];
+    if (a > 0.0) {
+      dmin2 += a*a;
+    } else if (b < 0.0) {
+      dmin2 += b*b;
+    }
+    dmax2 += (a*a > b*b) ? a*a : b*b;
+  }
+
+  if (dmin2 > Rcomov_old2) return 0;
+  if ((sqrt(dmax2) + dispmax)*(1.0 + 1.0e-10) <= Rcomov_new) return 0;
+  return 1;
+}
 
 //=========================================================
 // Drift and output the particles for lightcone simulations
@@ -279,13 +320,16 @@ void Drift_Lightcone(double A, double AFF, double AF, double Di, double Di2) {
 
   size_t bytes;
   int NTAB = 1000;                                       // The length of the particle exit time lookup tables (we spline anyway so not really important)
-  int i, j, k, coord, flag, repcount;
-  unsigned int n, * pc, blockmaxlen, blockmaxlenglob;
+  int NCELL = 32;                                        // The number of cells per dimension for culling the replicates of the particles
+  int i, j, k, r, rep, coord, flag, repcount, nrep, nrepactive, ncellrep, axes;
+  int * rep_ijk, * rep_coord, * cellrep;
+  unsigned int n, m, cell, Ncell3, * pc, * order, * cell_start, blockmaxlen, blockmaxlenglob;
   unsigned int outputflag, NumPartMax;
   float * block;
   double dyyy, da1, da2, dv1, dv2;
   double dyyy_tmp, da1_tmp, da2_tmp, AL;
-  double Delta_Pos[3];
+  double Delta_Pos[3], disp2;
+  double * cell_lo, * cell_hi, * cell_disp;
   double boundary = 20.0;
   double fac = Hubble/AF;                                // This differs from snapshot 'fac' by sqrt(AF) as we don't know after runtime what AF is. 
   double lengthfac = UnitLength_in_cm/3.085678e24;       // Convert positions to Mpc/h
@@ -387,15 +431,26 @@ void Drift_Lightcone(double A, double AFF, double AF, double Di, double Di2) {
   // How many particles can we store assuming all tasks replicate the particles by the maximum amount?
   //================================================================================================================
   repcount = 0;
-  pc = (unsigned int *)calloc((Nrep_neg_x+Nrep_pos_x+1)*(Nrep_neg_y+Nrep_pos_y+1)*(Nrep_neg_z+Nrep_pos_z+1),sizeof(unsigned int));
+  nrep = (Nrep_neg_x+Nrep_pos_x+1)*(Nrep_neg_y+Nrep_pos_y+1)*(Nrep_neg_z+Nrep_pos_z+1);
+  pc = (unsigned int *)calloc(nrep,sizeof(unsigned int));
+  rep_ijk = (int *)malloc(3*nrep*sizeof(int));
+  rep_coord = (int *)malloc(nrep*sizeof(int));
+  cellrep = (int *)malloc(nrep*sizeof(int));
   for (i = -Nrep_neg_x; i<=Nrep_pos_x; i++) {
     for (j = -Nrep_neg_y; j<=Nrep_pos_y; j++) {
       for (k = -Nrep_neg_z; k<=Nrep_pos_z; k++) {
         coord = ((i+Nrep_neg_max[0])*(Nrep_neg_max[1]+Nrep_pos_max[1]+1)+(j+Nrep_neg_max[1]))*(Nrep_neg_max[2]+Nrep_pos_max[2]+1)+(k+Nrep_neg_max[2]);
-        if (repflag[coord] == 0) repcount++;
+        if (repflag[coord] == 0) {
+          rep_ijk[3*repcount]   = i;
+          rep_ijk[3*repcount+1] = j;
+          rep_ijk[3*repcount+2] = k;
+          rep_coord[repcount]   = coord;
+          repcount++;
+        }
       }
     }
   }
+  nrepactive = repcount;
   if (repcount == 0) {
     blockmaxlen = NumPartMax;
   } else {
@@ -403,77 +458,127 @@ void Drift_Lightcone(double A, double AFF, double AF, double Di, double Di2) {
   }
   ierr = MPI_Allreduce(&blockmaxlen, &blockmaxlenglob, 1, MPI_UNSIGNED, MPI_MIN, MPI_COMM_WORLD);
 
+  //================================================================================================================
+  // The shell between Rcomov_new and Rcomov_old is thin, so most particles can't cross it in most replicates. We bin 
+  // the particles into NCELL^3 coarse cells and store the bounding box of the positions in each cell and the largest 
+  // displacement this step. The particles are then looped over cell by cell and for each cell we only check the 
+  // replicates in which the bounding box can cross the lightcone
+  //================================================================================================================
+  if (NCELL > Nsample) NCELL = Nsample;
+  Ncell3 = NCELL*NCELL*NCELL;
+  order = (unsigned int *)malloc(NumPart*sizeof(unsigned int)+1);
+  cell_start = (unsigned int *)calloc(Ncell3+1,sizeof(unsigned int));
+  cell_lo = (double *)malloc(3*Ncell3*sizeof(double));
+  cell_hi = (double *)malloc(3*Ncell3*sizeof(double));
+  cell_disp = (double *)calloc(Ncell3,sizeof(double));
+  for (cell = 0; cell < 3*Ncell3; cell++) {
+    cell_lo[cell] =  1.0e30;
+    cell_hi[cell] = -1.0e30;
+  }
+  for(n=0; n<NumPart; n++) {
+    disp2 = 0.0;
+    for (axes = 0; axes < 3; axes++) {
+      Delta_Pos[axes] = (P[n].Vel[axes] - sumxyz[axes]) * dyyy + UseCOLA * (P[n].D[axes] * da1 + P[n].D2[axes] * da2);
+      disp2 += Delta_Pos[axes]*Delta_Pos[axes];
+    }
+
+    // Check that 100Mpc^2/h^2 boundaries is enough
+    if((Delta_Pos[0] > boundary) || (Delta_Pos[1] > boundary) || (Delta_Pos[2] > boundary)) {
+      printf("\nERROR: Particle displacement greater than boundary for lightcone replicate estimate.\n");
+      printf("       increase boundary condition in lightcone.c (line 56)\n\n");
+      FatalError((char *)"lightcone.c", 488);
+    }
+
+    cell = lightcone_cell(P[n].Pos, NCELL);
+    for (axes = 0; axes < 3; axes++) {
+      if (P[n].Pos[axes] < cell_lo[3*cell+axes]) cell_lo[3*cell+axes] = P[n].Pos[axes];
+      if (P[n].Pos[axes] > cell_hi[3*cell+axes]) cell_hi[3*cell+axes] = P[n].Pos[axes];
+    }
+    if (disp2 > cell_disp[cell]) cell_disp[cell] = disp2;
+    cell_start[cell+1]++;
+  }
+  for (cell = 0; cell < Ncell3; cell++) {
+    cell_start[cell+1] += cell_start[cell];
+    cell_disp[cell] = sqrt(cell_disp[cell]);
+  }
+  for(n=0; n<NumPart; n++) {
+    cell = lightcone_cell(P[n].Pos, NCELL);
+    order[cell_start[cell]++] = n;
+  }
+  for (cell = Ncell3; cell > 0; cell--) cell_start[cell] = cell_start[cell-1];
+  cell_start[0] = 0;
+
   // Loop over all particles, modifying the position based on the current replicate
   outputflag = 0;
-  for(n=0; n<NumPartMax; n++) {
+  cell = 0;
+  ncellrep = 0;
+  for(m=0; m<NumPartMax; m++) {
 
     outputflag++;
-    if (n < NumPart) {
-
-      Delta_Pos[0] = (P[n].Vel[0] - sumx) * dyyy + UseCOLA * (P[n].D[0] * da1 + P[n].D2[0] * da2);
-      Delta_Pos[1] = (P[n].Vel[1] - sumy) * dyyy + UseCOLA * (P[n].D[1] * da1 + P[n].D2[1] * da2);   
-      Delta_Pos[2] = (P[n].Vel[2] - sumz) * dyyy + UseCOLA * (P[n].D[2] * da1 + P[n].D2[2] * da2);     
-
-      // Check that 100Mpc^2/h^2 boundaries is enough
-      if((Delta_Pos[0] > boundary) || (Delta_Pos[1] > boundary) || (Delta_Pos[2] > boundary)) {
-        printf("\nERROR: Particle displacement greater than boundary for lightcone replicate estimate.\n");
-        printf("       increase boundary condition in lightcone.c (line 56)\n\n");
-      FatalError((char *)"lightcone.c", 384);
+    if (m < NumPart) {
+      n = order[m];
+
+      // Find the replicates to check when we enter a new cell
+      if ((m == 0) || (m == cell_start[cell+1])) {
+        while (m >= cell_start[cell+1]) cell++;
+        ncellrep = 0;
+        for (r = 0; r < nrepactive; r++) {
+          if (cell_crosses_lightcone(&cell_lo[3*cell], &cell_hi[3*cell], cell_disp[cell], rep_ijk[3*r], rep_ijk[3*r+1], rep_ijk[3*r+2], Rcomov_old2, Rcomov_new)) cellrep[ncellrep++] = r;
+        }
       }
 
-      // Loop over all replicates
-      repcount=0;
-      for (i = -Nrep_neg_x; i<=Nrep_pos_x; i++) {
-        for (j = -Nrep_neg_y; j<=Nrep_pos_y; j++) {
-          for (k = -Nrep_neg_z; k<=Nrep_pos_z; k++) {
-
-            coord = ((i+Nrep_neg_max[0])*(Nrep_neg_max[1]+Nrep_pos_max[1]+1)+(j+Nrep_neg_max[1]))*(Nrep_neg_max[2]+Nrep_pos_max[2]+1)+(k+Nrep_neg_max[2]);
-            if (repflag[coord] == 0) {
-
-              // Did the particle start the timestep inside the lightcone?
-              flag = 0;
-              Xpart = P[n].Pos[0] - Origin_x + (i*Box);
-              Ypart = P[n].Pos[1] - Origin_y + (j*Box);
-              Zpart = P[n].Pos[2] - Origin_z + (k*Box);
-              Rpart_old2 = Xpart*Xpart+Ypart*Ypart+Zpart*Zpart;
+      Delta_Pos[0] = (P[n].Vel[0] - sumxyz[0]) * dyyy + UseCOLA * (P[n].D[0] * da1 + P[n].D2[0] * da2);
+      Delta_Pos[1] = (P[n].Vel[1] - sumxyz[1]) * dyyy + UseCOLA * (P[n].D[1] * da1 + P[n].D2[1] * da2);   
+      Delta_Pos[2] = (P[n].Vel[2] - sumxyz[2]) * dyyy + UseCOLA * (P[n].D[2] * da1 + P[n].D2[2] * da2);     
+
+      // Loop over the replicates where this cell can cross the lightcone
+      for (r = 0; r < ncellrep; r++) {
+        rep = cellrep[r];
+        i = rep_ijk[3*rep];
+        j = rep_ijk[3*rep+1];
+        k = rep_ijk[3*rep+2];
+        coord = rep_coord[rep];
+
+        // Did the particle start the timestep inside the lightcone?
+        flag = 0;
+        Xpart = P[n].Pos[0] - Origin_x + (i*Box);
+        Ypart = P[n].Pos[1] - Origin_y + (j*Box);
+        Zpart = P[n].Pos[2] - Origin_z + (k*Box);
+        Rpart_old2 = Xpart*Xpart+Ypart*Ypart+Zpart*Zpart;
  
-              if (Rpart_old2 <= Rcomov_old2) flag = 1;
+        if (Rpart_old2 <= Rcomov_old2) flag = 1;
 
-              // Have any particles that started inside the lightcone now exited?
-              if (flag) {
-                Xpart += Delta_Pos[0];
-                Ypart += Delta_Pos[1];
-                Zpart += Delta_Pos[2];
-                Rpart_new2 = Xpart*Xpart+Ypart*Ypart+Zpart*Zpart;
+        // Have any particles that started inside the lightcone now exited?
+        if (flag) {
+          Xpart += Delta_Pos[0];
+          Ypart += Delta_Pos[1];
+          Zpart += Delta_Pos[2];
+          Rpart_new2 = Xpart*Xpart+Ypart*Ypart+Zpart*Zpart;
 
-                if (Rpart_new2 > Rcomov_new2) {
+          if (Rpart_new2 > Rcomov_new2) {
   
-                  // Interpolate the particle position. We do this by first calculating the exact time at which
-                  // the particle exited the lightcone, then updating the position to there.
-                  Rpart_old = sqrt(Rpart_old2);
-                  Rpart_new = sqrt(Rpart_new2);
-                  AL = A + (AFF-A)*((Rcomov_old-Rpart_old)/((Rpart_new-Rpart_old)-(Rcomov_new-Rcomov_old)));
-                  da1_tmp = gsl_spline_eval(da1_spline, AL, da1_acc);
-                  da2_tmp = gsl_spline_eval(da2_spline, AL, da2_acc);
-                  dyyy_tmp = gsl_spline_eval(dyyy_spline, AL, dyyy_acc);
-              
-                  // Store the interpolated particle position and velocity.
-                  unsigned int ind = 6*(blockmaxlen*repcount+pc[repcount]);
-                  
-                  block[ind]     = (float)(lengthfac *(P[n].Pos[0] + (P[n].Vel[0] - sumx) * dyyy_tmp + UseCOLA*(P[n].D[0] * da1_tmp + P[n].D2[0] * da2_tmp) + (i*Box)));
-                  block[ind + 1] = (float)(lengthfac *(P[n].Pos[1] + (P[n].Vel[1] - sumy) * dyyy_tmp + UseCOLA*(P[n].D[1] * da1_tmp + P[n].D2[1] * da2_tmp) + (j*Box)));
-                  block[ind + 2] = (float)(lengthfac *(P[n].Pos[2] + (P[n].Vel[2] - sumz) * dyyy_tmp + UseCOLA*(P[n].D[2] * da1_tmp + P[n].D2[2] * da2_tmp) + (k*Box)));
-                  
-                  block[ind + 3] = (float)(velfac*fac*(P[n].Vel[0] - sumx + (P[n].D[0] * dv1 + P[n].D2[0] * dv2) * UseCOLA));
-                  block[ind + 4] = (float)(velfac*fac*(P[n].Vel[1] - sumy + (P[n].D[1] * dv1 + P[n].D2[1] * dv2) * UseCOLA));
-                  block[ind + 5] = (float)(velfac*fac*(P[n].Vel[2] - sumz + (P[n].D[2] * dv1 + P[n].D2[2] * dv2) * UseCOLA));
-                  
-                  pc[repcount]++;   
-                  Noutput[coord]++;
-                }
-              }
-              repcount++;
-            }
+            // Interpolate the particle position. We do this by first calculating the exact time at which
+            // the particle exited the lightcone, then updating the position to there.
+            Rpart_old = sqrt(Rpart_old2);
+            Rpart_new = sqrt(Rpart_new2);
+            AL = A + (AFF-A)*((Rcomov_old-Rpart_old)/((Rpart_new-Rpart_old)-(Rcomov_new-Rcomov_old)));
+            da1_tmp = gsl_spline_eval(da1_spline, AL, da1_acc);
+            da2_tmp = gsl_spline_eval(da2_spline, AL, da2_acc);
+            dyyy_tmp = gsl_spline_eval(dyyy_spline, AL, dyyy_acc);
+        
+            // Store the interpolated particle position and velocity.
+            unsigned int ind = 6*(blockmaxlen*rep+pc[rep]);
+            
+            block[ind]     = (float)(lengthfac *(P[n].Pos[0] + (P[n].Vel[0] - sumxyz[0]) * dyyy_tmp + UseCOLA*(P[n].D[0] * da1_tmp + P[n].D2[0] * da2_tmp) + (i*Box)));
+            block[ind + 1] = (float)(lengthfac *(P[n].Pos[1] + (P[n].Vel[1] - sumxyz[1]) * dyyy_tmp + UseCOLA*(P[n].D[1] * da1_tmp + P[n].D2[1] * da2_tmp) + (j*Box)));
+            block[ind + 2] = (float)(lengthfac *(P[n].Pos[2] + (P[n].Vel[2] - sumxyz[2]) * dyyy_tmp + UseCOLA*(P[n].D[2] * da1_tmp + P[n].D2[2] * da2_tmp) + (k*Box)));
+            
+            block[ind + 3] = (float)(velfac*fac*(P[n].Vel[0] - sumxyz[0] + (P[n].D[0] * dv1 + P[n].D2[0] * dv2) * UseCOLA));
+            block[ind + 4] = (float)(velfac*fac*(P[n].Vel[1] - sumxyz[1] + (P[n].D[1] * dv1 + P[n].D2[1] * dv2) * UseCOLA));
+            block[ind + 5] = (float)(velfac*fac*(P[n].Vel[2] - sumxyz[2] + (P[n].D[2] * dv1 + P[n].D2[2] * dv2) * UseCOLA));
+            
+            pc[rep]++;   
+            Noutput[coord]++;
           }
         }
       }
@@ -497,6 +602,14 @@ void Drift_Lightcone(double A, double AFF, double AF, double Di, double Di2) {
   }
   free(pc);
   free(block);
+  free(rep_ijk);
+  free(rep_coord);
+  free(cellrep);
+  free(order);
+  free(cell_start);
+  free(cell_lo);
+  free(cell_hi);
+  free(cell_disp);
  
   gsl_spline_free(da1_spline);
   gsl_spline_free(da2_spline);
@@ -505,7 +618,7 @@ void Drift_Lightcone(double A, double AFF, double AF, double Di, double Di2) {
   gsl_interp_accel_free(da2_acc);
   gsl_interp_accel_free(dyyy_acc);
 
-  timer_start(_DriftLightcone);
+  timer_stop(_DriftLightcone);
   return;
 }
 
@@ -43,10 +43,19 @@ int main(int argc, char **argv) {
   //======================================
   // Set up MPI
   //======================================
+#ifdef ASYNC_OUTPUT
+  // The output thread does not call MPI, async_output_init checks what we got
+  int provided;
+  ierr = MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#else
   ierr = MPI_Init(&argc, &argv); 
+#endif
   ierr = MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
   ierr = MPI_Comm_size(MPI_COMM_WORLD, &NTask);
   my_fftw_mpi_init();
+#ifdef NODE_SHARED_TABLES
+  init_node_shared_memory();
+#endif
 
   if( (Use2LPT_STEP == 0 || Use2LPT_IC == 0) && ThisTask == 0){
     printf("\n===========================================\n");
@@ -82,8 +91,8 @@ int main(int argc, char **argv) {
   read_parameterfile(argv[1]);
   read_outputs();
   set_units();
-#ifdef LIGHTCONE
-  set_lightcone();
+#ifdef ASYNC_OUTPUT
+  async_output_init(provided);
 #endif
 
   if (UseCOLA){
@@ -98,6 +107,14 @@ int main(int argc, char **argv) {
     nLPT  = -2.5;
   }
 
+  //======================================
+  // Tabulate the time-stepping integrals
+  //======================================
+  init_time_integral_splines();
+#ifdef LIGHTCONE
+  set_lightcone();
+#endif
+
   //======================================
   // Show some info about the simulation
   //======================================
@@ -218,9 +235,19 @@ int main(int argc, char **argv) {
 
     //===========================================================================================
     // Generate IC from scratch and Compute the displacementfield
+    // With UseICCache we read the displacementfield from disk if it has been generated before
+    // The fields are for LCDM so the same cached fields are used for all gravity models
     //===========================================================================================
 
+#ifdef TABLE_CACHE
+    if( ! (UseICCache && ic_cache_load()) ){
+      displacement_fields();
+      if(UseICCache) ic_cache_write();
+    }
+#else
     displacement_fields();
+#endif
+    mg_rescale_displacement_fields();
   }
   
   if(ThisTask == 0){
@@ -236,6 +263,31 @@ int main(int argc, char **argv) {
   // operator L_- from TZE, as initial velocities are in 2LPT.
   //===========================================================================================
 
+#ifdef TWIN_RUN
+  //===========================================================================================
+  // Twin run: the MG simulation and its LCDM twin are created from the same displacement-field.
+  // The fields are normalized at a = 1 so for the LCDM twin we divide them by the MG sigma8
+  // enhancement (squared for 2LPT) to get the same particle positions at early times
+  //===========================================================================================
+  int twin;
+  double twin_sigma8_enhancement = mg_sigma8_enhancement(1.0);
+  twin_run_init();
+  for(twin = 0; twin < 2; twin++) {
+    twin_run_select(twin);
+    Di  = growth_D(A);
+    Di2 = growth_D2(A);
+    Dv  = growth_dDdy(A);
+    Dv2 = growth_dD2dy(A);
+    if(twin == 1) {
+      for (m = 0; m < 3; m++) {
+        for (coord = 0; coord < NumPart; coord++) {
+          ZA[m][coord]  /= twin_sigma8_enhancement;
+          LPT[m][coord] /= twin_sigma8_enhancement * twin_sigma8_enhancement;
+        }
+      }
+    }
+#endif
+
   // Allocate memory for the particles
   P = malloc((int)(ceil(NumPart*Buffer))*sizeof(struct part_data));
 
@@ -309,6 +361,9 @@ int main(int argc, char **argv) {
       }
     }
   }
+#ifdef TWIN_RUN
+  }
+#endif
 
   // Free up some memory
 #ifndef SCALEDEPENDENT
@@ -332,12 +387,23 @@ int main(int argc, char **argv) {
       printf("=============================\n\n");
     }
 
+#ifdef TWIN_RUN
+    for(twin = 0; twin < 2; twin++) {
+      twin_run_select(twin);
+      Dv  = growth_dDdy(A);
+      Dv2 = growth_dD2dy(A);
+#endif
+
     for(int axes = 0; axes < 3; axes++)
       sumxyz[axes] = 0;
 
     // Output particles
     Output(A, AF, AFF, Dv, Dv2);
 
+#ifdef TWIN_RUN
+    }
+#endif
+
     // If this is the only output timestep then simply skip to the end
     if(Noutputs == 1) {
       goto finalize;
@@ -370,6 +436,9 @@ int main(int argc, char **argv) {
   p13     = my_fftw_mpi_plan_dft_c2r_3d(Nmesh, Nmesh, Nmesh, FN13,    N13, MPI_COMM_WORLD, FFTW_ESTIMATE);
 
   // Modified gravity allocation
+#ifdef TWIN_RUN
+  twin_run_select(0);
+#endif
   if(modified_gravity_active) AllocateMGArrays();
 #endif
 
@@ -462,11 +531,35 @@ int main(int argc, char **argv) {
           }
         }
 
+#ifdef TWIN_RUN
+        //================================================================
+        // Take the step for both twins. They share the FFT plans and the 
+        // density and force grids. Only the MG twin needs the fifth-force
+        //================================================================
+        int finished = 0;
+        double AI_step = AI, AF_step = AF;
+        for(twin = 0; twin < 2; twin++) {
+          twin_run_select(twin);
+          AI  = AI_step;
+          AF  = AF_step;
+          Di  = growth_D(A);
+          Di2 = growth_D2(A);
+          if (ThisTask == 0) {
+            printf("Twin %i (%s):\n", twin, modified_gravity_active ? "MG" : "LCDM");
+            fflush(stdout);
+          }
+#endif
+
         //================================================================
         // Copy value of A to global variable. Needed by the mg.h routines
         //================================================================
         aexp_global = A;
 
+#ifdef COMPUTE_POFK
+        // At the output steps the density is computed at the output time
+        PofkComputeNow = PofkEveryStep || ((timeStep == 0) && (i != NoutputStart));
+#endif
+
         //=======================================================
         // Calculate the particle accelerations for this timestep
         //=======================================================
@@ -534,7 +627,14 @@ int main(int argc, char **argv) {
               printf("Iteration %d finished\n------------------\n\n", timeSteptot);
               fflush(stdout);
             }
+#ifdef TWIN_RUN
+            // The other twin must also be output before we finish
+            for (j = 0; j < 3; j++) free(Disp[j]);
+            finished = 1;
+            continue;
+#else
             goto finalize;
+#endif
           }
 
           // =====================================================================================
@@ -575,6 +675,12 @@ int main(int argc, char **argv) {
 #else
         Drift(A, AFF, AF, Di, Di2);
 #endif
+
+#ifdef TWIN_RUN
+        }
+        if(finished) goto finalize;
+#endif
+
         //=================
         // Step in time
         //=================
@@ -616,6 +722,10 @@ finalize:
     free_powertable();
     free_transfertable();
 
+#ifdef TWIN_RUN
+    twin_run_select(0);
+    free(Twin[1].P);
+#endif
     free(P);
     free(OutputList);
     free(Slab_to_task);
@@ -645,11 +755,23 @@ finalize:
 #endif
 
     free_up_splines();
+    free_time_integral_splines();
+#ifdef NODE_SHARED_TABLES
+    free_node_shared_memory();
+#endif
+#ifdef MULTIGRID_SOLVER
+    free_multigrid_solution();
+#endif
 
 #ifdef SCALEDEPENDENT
     free_stored_initial_displacment_field();
 #endif
 
+#ifdef ASYNC_OUTPUT
+    // Wait for the last snapshots to be written
+    async_output_finalize();
+#endif
+
     my_fftw_mpi_cleanup();
 
     timer_print();
@@ -761,19 +883,101 @@ finalize:
     timer_stop(_Drift);
   }
 
+  //==================================================================
+  // Write the float [value] as printf("%12.6f") would into [out] and
+  // return the number of characters. The float is exactly m * 2^e so
+  // the rounding to 6 decimals (half to even) is done with integers
+  //==================================================================
+  static inline int format_float_12_6(char *out, float value){
+    double fr;
+    int e, len = 0;
+    char digits[32];
+
+    if(isnan(value) || isinf(value) || fabs(value) >= 1e12)
+      return sprintf(out, "%12.6f", value);
+
+    // value = mantissa * 2^e with mantissa < 2^24
+    fr = frexp(fabs((double)value), &e);
+    unsigned long long mantissa = (unsigned long long)(fr * 16777216.0) * 1000000ULL;
+    unsigned long long q;
+    e -= 24;
+    if(e >= 0) {
+      q = mantissa << e;
+    } else if(e > -64) {
+      unsigned long long rem  = mantissa & ((1ULL << (-e)) - 1);
+      unsigned long long half = 1ULL << (-e - 1);
+      q = mantissa >> (-e);
+      if(rem > half || (rem == half && (q & 1))) q++;
+    } else {
+      q = 0;
+    }
+
+    // Digits of q in reverse order, at least 7 so we get 0.dddddd
+    int ndigits = 0;
+    do {
+      digits[ndigits++] = '0' + (q % 10);
+      q /= 10;
+    } while(q > 0 || ndigits < 7);
+
+    int width = ndigits + 1 + (signbit(value) ? 1 : 0);
+    for(; width < 12; width++) out[len++] = ' ';
+    if(signbit(value)) out[len++] = '-';
+    while(ndigits > 6) out[len++] = digits[--ndigits];
+    out[len++] = '.';
+    while(ndigits > 0) out[len++] = digits[--ndigits];
+    return len;
+  }
+
+  //==================================================================
+  // Write [value] as printf("%12llu") would into [out] and return the 
+  // number of characters
+  //==================================================================
+  static inline int format_ull_12(char *out, unsigned long long value){
+    char digits[24];
+    int ndigits = 0, len = 0;
+    do {
+      digits[ndigits++] = '0' + (value % 10);
+      value /= 10;
+    } while(value > 0);
+    for(int width = ndigits; width < 12; width++) out[len++] = ' ';
+    while(ndigits > 0) out[len++] = digits[--ndigits];
+    return len;
+  }
+
+#if defined(COMPRESSED_OUTPUT) || defined(SUBSAMPLE_OUTPUT) || (defined(FOF_HALOS) && (defined(PARTICLE_ID) || defined(SCALEDEPENDENT)))
+  //==================================================================
+  // The first particle slab on each task. Used to get the Lagrangian 
+  // ID from coord_q when we don't have PARTICLE_ID
+  //==================================================================
+  static int *Lagrangian_p_start_table = NULL;
+
+  //==================================================================
+  // Must be called by all tasks before lagrangian_id is used
+  //==================================================================
+  void lagrangian_id_prepare(void) {
+    if(Lagrangian_p_start_table == NULL) Lagrangian_p_start_table = malloc(sizeof(int) * NTask);
+    MPI_Allgather(&Local_p_start, 1, MPI_INT, Lagrangian_p_start_table, 1, MPI_INT, MPI_COMM_WORLD);
+  }
+
+  //==================================================================
+  // The index (i*Nsample+j)*Nsample+k of the Lagrangian grid point of 
+  // particle n. The same as the particle ID
+  //==================================================================
+  unsigned long long lagrangian_id(unsigned int n) {
+#ifdef PARTICLE_ID
+    return P[n].ID;
+#else
+    // The index on the task that created the particle plus the particles on the tasks before
+    return (unsigned long long) P[n].coord_q + (unsigned long long) Lagrangian_p_start_table[P[n].init_cpu_id] * Nsample * Nsample;
+#endif
+  }
+#endif
+
   //=================
   // Output the data
   //=================
   void Output(double A, double AF, double AFF, double Dv, double Dv2) {
     timer_start(_WriteOutput);
-    FILE * fp; 
-    char buf[300];
-    int nprocgroup, groupTask, masterTask;
-    unsigned int n;
-    double Z         = (1.0/A)-1.0;
-    double fac       = Hubble / pow(A,1.5);
-    double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
-    double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
 
 #ifdef SCALEDEPENDENT
 
@@ -795,7 +999,50 @@ finalize:
 
 #endif
 
-#ifdef GADGET_STYLE
+#ifdef COMPUTE_POFK
+    if(PofkMultipoles) compute_redshift_space_multipoles(A, Dv, Dv2, Use2LPT_STEP);
+#endif
+
+#if defined(SUBSAMPLE_OUTPUT) || defined(DENSITY_GRID_OUTPUT) || defined(FOF_HALOS)
+
+    // The subsample, the density grid and the halos are written at every output, the full snapshot not always
+    int full_snapshot = write_full_snapshot(A);
+#ifdef SUBSAMPLE_OUTPUT
+    lagrangian_id_prepare();
+    write_subsample_particles(A, Dv, Dv2, Use2LPT_STEP);
+#endif
+#ifdef DENSITY_GRID_OUTPUT
+    write_density_grid(A);
+#endif
+#ifdef FOF_HALOS
+#if defined(PARTICLE_ID) || defined(SCALEDEPENDENT)
+    lagrangian_id_prepare();
+#endif
+    fof_find_halos(A, Dv, Dv2, Use2LPT_STEP);
+#endif
+
+#else
+    int full_snapshot = 1;
+#endif
+
+#ifdef MPIIO_OUTPUT
+
+    // All tasks write to NumOutputFiles files with collective MPI-IO
+    if(full_snapshot) Output_MPIIO(A, Dv, Dv2);
+
+#else
+    FILE * fp; 
+    char buf[300];
+    int nprocgroup, groupTask, masterTask;
+    double Z         = (1.0/A)-1.0;
+#ifndef COMPRESSED_OUTPUT
+    unsigned int n;
+    double fac       = Hubble / pow(A,1.5);
+    double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
+    double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
+#endif
+
+#if defined(GADGET_STYLE) && !defined(COMPRESSED_OUTPUT)
     size_t bytes;
     int k, pc, dummy, blockmaxlen;
     float * block;
@@ -804,20 +1051,38 @@ finalize:
 #endif
 #endif
 
+#ifdef COMPRESSED_OUTPUT
+    lagrangian_id_prepare();
+#endif
+
     nprocgroup = NTask / NumFilesWrittenInParallel;
     if (NTask % NumFilesWrittenInParallel) nprocgroup++;
     masterTask = (ThisTask / nprocgroup) * nprocgroup;
     for(groupTask = 0; groupTask < nprocgroup; groupTask++) {
       if (ThisTask == (masterTask + groupTask)) {
-        if(NumPart > 0) {
+        if(NumPart > 0 && full_snapshot) {
           sprintf(buf, "%s/%s_z%dp%03d.%d", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000), ThisTask);
-          if(!(fp = fopen(buf, "w"))) {
+#ifdef ASYNC_OUTPUT
+          // Stage the file in memory and let the output thread write it. The size
+          // is at most 7 numbers of 13 characters per particle (ASCII with IDs)
+          fp = async_output_fopen(buf, 1024 + (size_t) NumPart * 7 * 13);
+#else
+          fp = fopen(buf, "w");
+#endif
+          if(!fp) {
             printf("\nERROR: Can't write in file '%s'.\n\n", buf);
             FatalError((char *)"main.c", 746);
           }
           fflush(stdout);
 
-#ifdef GADGET_STYLE
+#ifdef COMPRESSED_OUTPUT
+
+          //===============================================================
+          // Positions and velocities with bounded error, IDs from the order
+          //===============================================================
+          write_compressed_particles(fp, A, Dv, Dv2, Use2LPT_STEP);
+
+#elif defined(GADGET_STYLE)
 
           //===============================================================
           // Write a GADGET file
@@ -902,6 +1167,11 @@ finalize:
           // Total number of particle in each file on the first line
           fprintf(fp,"%u\n", NumPart);
 
+          // The lines are formatted by hand (same format as fprintf with %12.6f) 
+          // into a large block which is written with my_fwrite when full
+          size_t textmaxlen = 10*1024*1024, textlen = 0;
+          char *text = malloc(textmaxlen);
+
           for(n = 0; n < NumPart; n++){
             double P_Vel[3];
             for(int axes = 0; axes < 3; axes++) {
@@ -913,23 +1183,37 @@ finalize:
             }
 
             // Output positions in Mpc/h and velocities in km/s
+            float values[6] = {(float)(lengthfac*P[n].Pos[0]), (float)(lengthfac*P[n].Pos[1]), (float)(lengthfac*P[n].Pos[2]),
+                               (float)(velfac*P_Vel[0]),       (float)(velfac*P_Vel[1]),       (float)(velfac*P_Vel[2])};
 #ifdef PARTICLE_ID
-            fprintf(fp,"%12llu %12.6f %12.6f %12.6f %12.6f %12.6f %12.6f\n",
-                P[n].ID, (float)(lengthfac*P[n].Pos[0]), (float)(lengthfac*P[n].Pos[1]), (float)(lengthfac*P[n].Pos[2]),
-                (float)(velfac*P_Vel[0]),      (float)(velfac*P_Vel[1]),       (float)(velfac*P_Vel[2]));
-#else
-            fprintf(fp,"%12.6f %12.6f %12.6f %12.6f %12.6f %12.6f\n",
-                (float)(lengthfac*P[n].Pos[0]), (float)(lengthfac*P[n].Pos[1]), (float)(lengthfac*P[n].Pos[2]),
-                (float)(velfac*P_Vel[0]),       (float)(velfac*P_Vel[1]),       (float)(velfac*P_Vel[2]));
+            textlen += format_ull_12(text + textlen, P[n].ID);
+            text[textlen++] = ' ';
 #endif
+            for(int m = 0; m < 6; m++) {
+              textlen += format_float_12_6(text + textlen, values[m]);
+              text[textlen++] = (m < 5) ? ' ' : '\n';
+            }
+
+            // A line is at most a few hundred characters
+            if(textlen > textmaxlen - 1024) {
+              my_fwrite(text, sizeof(char), textlen, fp);
+              textlen = 0;
+            }
           }
+          if(textlen > 0) my_fwrite(text, sizeof(char), textlen, fp);
+          free(text);
 #endif
+#ifdef ASYNC_OUTPUT
+          async_output_fclose(fp);
+#else
           fclose(fp);
+#endif
         }
       }
       MPI_Barrier(MPI_COMM_WORLD); 
     }
-    Output_Info(A);
+#endif
+    if(full_snapshot) Output_Info(A);
 
 #ifdef SCALEDEPENDENT
 
@@ -951,6 +1235,246 @@ finalize:
     return;
   }
 
+#ifdef MPIIO_OUTPUT
+  //=====================================================================================
+  // The file task i writes to with MPI-IO. Each file gets a group of contiguous tasks
+  //=====================================================================================
+  int output_file_of_task(int i) {
+    return (int)(((long long) i * NumOutputFiles) / NTask);
+  }
+
+  //=====================================================================================
+  // Output_MPIIO formats and writes at most this many particles at a time so the
+  // buffers do not grow with NumPart
+  //=====================================================================================
+#define MPIIO_CHUNK_PARTICLES 1048576
+
+  //=====================================================================================
+  // The number of chunks of MPIIO_CHUNK_PARTICLES the task in [FileComm] with the most
+  // particles needs. The writes are collective so all tasks do this many
+  //=====================================================================================
+  static unsigned long long mpiio_number_of_chunks(MPI_Comm FileComm) {
+    unsigned long long nchunks = (NumPart + MPIIO_CHUNK_PARTICLES - 1) / MPIIO_CHUNK_PARTICLES;
+    MPI_Allreduce(MPI_IN_PLACE, &nchunks, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, FileComm);
+    return nchunks;
+  }
+
+  //=====================================================================================
+  // The particles [nstart, nend) of chunk [c] on this task (empty if we have fewer chunks)
+  //=====================================================================================
+  static inline void mpiio_chunk_range(unsigned long long c, unsigned int *nstart, unsigned int *nend) {
+    unsigned long long start = c * MPIIO_CHUNK_PARTICLES, end = start + MPIIO_CHUNK_PARTICLES;
+    *nstart = (unsigned int)(start < NumPart ? start : NumPart);
+    *nend   = (unsigned int)(end   < NumPart ? end   : NumPart);
+  }
+
+#ifdef GADGET_STYLE
+  //=====================================================================================
+  // Write one GADGET block to the file at [offset] with the record markers around it.
+  // [field] is 0 (positions), 1 (velocities) or 2 (IDs) and has [elemsize] bytes per
+  // particle. The tasks in the file communicator write their particles one after the
+  // other in chunks of MPIIO_CHUNK_PARTICLES. Returns the offset after the block.
+  // Output_MPIIO has checked that the block fits in a record (elemsize * npart_file <= INT_MAX)
+  //=====================================================================================
+  static MPI_Offset write_block_mpiio(MPI_File fh, MPI_Comm FileComm, int FileTask, MPI_Offset offset, int field, int elemsize, 
+      unsigned long long npart_before, unsigned long long npart_file, double lengthfac, double velfac, double fac, double Dv, double Dv2) {
+    MPI_Datatype elemtype;
+    MPI_Type_contiguous(elemsize, MPI_BYTE, &elemtype);
+    MPI_Type_commit(&elemtype);
+
+    int dummy = elemsize * npart_file;
+    if(FileTask == 0) {
+      MPI_File_write_at(fh, offset, &dummy, 1, MPI_INT, MPI_STATUS_IGNORE);
+      MPI_File_write_at(fh, offset + sizeof(int) + (MPI_Offset) npart_file * elemsize, &dummy, 1, MPI_INT, MPI_STATUS_IGNORE);
+    }
+
+    char *block = malloc((size_t) elemsize * MPIIO_CHUNK_PARTICLES);
+    float *blockflt = (float *) block;
+    unsigned long long nchunks = mpiio_number_of_chunks(FileComm);
+    for(unsigned long long c = 0; c < nchunks; c++) {
+      unsigned int nstart, nend;
+      mpiio_chunk_range(c, &nstart, &nend);
+
+      for(unsigned int n = nstart; n < nend; n++) {
+        unsigned int m = n - nstart;
+        if(field == 0) {
+          for(int k = 0; k < 3; k++) blockflt[3 * m + k] = (float)(lengthfac*P[n].Pos[k]);
+        } else if(field == 1) {
+          // Remember to add the ZA and 2LPT velocities back on and convert to PTHalos velocity units
+#ifdef SCALEDEPENDENT
+          for(int k = 0; k < 3; k++) blockflt[3 * m + k] = (float)(velfac*fac*(P[n].Vel[k] - sumxyz[k] + (P[n].dDdy[k] + P[n].dD2dy[k] * Use2LPT_STEP ) * UseCOLA));
+#else
+          for(int k = 0; k < 3; k++) blockflt[3 * m + k] = (float)(velfac*fac*(P[n].Vel[k] - sumxyz[k] + (P[n].D[k] * Dv + P[n].D2[k] * Dv2 * Use2LPT_STEP ) * UseCOLA));
+#endif
+#ifdef PARTICLE_ID
+        } else {
+          ((unsigned long long *) block)[m] = P[n].ID;
+#endif
+        }
+      }
+
+      MPI_Offset offset_chunk = offset + sizeof(int) + (MPI_Offset) (npart_before + nstart) * elemsize;
+      MPI_File_write_at_all(fh, offset_chunk, block, (int)(nend - nstart), elemtype, MPI_STATUS_IGNORE);
+    }
+    free(block);
+
+    MPI_Type_free(&elemtype);
+    return offset + 2 * sizeof(int) + (MPI_Offset) npart_file * elemsize;
+  }
+#else
+  //=====================================================================================
+  // Format the particles [nstart, nend) as ASCII lines into [text] of size [textmaxlen],
+  // which is grown if needed. Returns the number of characters
+  //=====================================================================================
+  static size_t format_particles_ascii(char **text, size_t *textmaxlen, unsigned int nstart, unsigned int nend, 
+      double lengthfac, double velfac, double fac, double Dv, double Dv2) {
+    size_t textlen = 0;
+    for(unsigned int n = nstart; n < nend; n++){
+      double P_Vel[3];
+      for(int axes = 0; axes < 3; axes++) {
+#ifdef SCALEDEPENDENT
+        P_Vel[axes] = fac*(P[n].Vel[axes] - sumxyz[axes] + (P[n].dDdy[axes] + P[n].dD2dy[axes] * Use2LPT_STEP ) * UseCOLA);
+#else
+        P_Vel[axes] = fac*(P[n].Vel[axes] - sumxyz[axes] + (P[n].D[axes] * Dv + P[n].D2[axes] * Dv2) * UseCOLA);
+#endif
+      }
+
+      // Output positions in Mpc/h and velocities in km/s
+      float values[6] = {(float)(lengthfac*P[n].Pos[0]), (float)(lengthfac*P[n].Pos[1]), (float)(lengthfac*P[n].Pos[2]),
+                         (float)(velfac*P_Vel[0]),       (float)(velfac*P_Vel[1]),       (float)(velfac*P_Vel[2])};
+
+      // Numbers that do not fit in 12 characters are rare so we only grow the buffer when needed
+      if(textlen + 1024 > *textmaxlen) *text = realloc(*text, *textmaxlen *= 2);
+#ifdef PARTICLE_ID
+      textlen += format_ull_12(*text + textlen, P[n].ID);
+      (*text)[textlen++] = ' ';
+#endif
+      for(int m = 0; m < 6; m++) {
+        textlen += format_float_12_6(*text + textlen, values[m]);
+        (*text)[textlen++] = (m < 5) ? ' ' : '\n';
+      }
+    }
+    return textlen;
+  }
+#endif
+
+  //=====================================================================================
+  // Write the particles of all tasks to NumOutputFiles files with collective MPI-IO
+  // (MPI_File_write_at_all) instead of one file per task. Each file is written by a group
+  // of contiguous tasks and has the same format as the files from Output: GADGET with a
+  // header (npart and num_files for the file) or ASCII with the number of particles first.
+  // The particles are converted and written in chunks of MPIIO_CHUNK_PARTICLES
+  //=====================================================================================
+  void Output_MPIIO(double A, double Dv, double Dv2) {
+    char buf[300];
+    MPI_Comm FileComm;
+    MPI_File fh;
+    int FileTask;
+    double Z         = (1.0/A)-1.0;
+    double fac       = Hubble / pow(A,1.5);
+    double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
+    double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
+    int filenum      = output_file_of_task(ThisTask);
+
+    MPI_Comm_split(MPI_COMM_WORLD, filenum, ThisTask, &FileComm);
+    MPI_Comm_rank(FileComm, &FileTask);
+
+    // The number of particles in the file and on the tasks before us in the file
+    unsigned long long npart_loc = NumPart, npart_file = 0, npart_before = 0;
+    MPI_Allreduce(&npart_loc, &npart_file, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, FileComm);
+    MPI_Exscan(&npart_loc, &npart_before, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, FileComm);
+    if(FileTask == 0) npart_before = 0;
+
+#ifdef GADGET_STYLE
+    // The GADGET record markers are ints so the largest block (3 floats per particle) must be below 2 GB
+    unsigned long long npart_file_max = 0;
+    MPI_Allreduce(&npart_file, &npart_file_max, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    if(3 * sizeof(float) * npart_file_max > INT_MAX) {
+      if(ThisTask == 0) printf("\nERROR: A file with %llu particles has GADGET records larger than 2 GB. Increase NumOutputFiles.\n\n", npart_file_max);
+      FatalError((char *)"main.c", 1297);
+    }
+#endif
+
+    sprintf(buf, "%s/%s_z%dp%03d.%d", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000), filenum);
+    if(MPI_File_open(FileComm, buf, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+      printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+      FatalError((char *)"main.c", 1216);
+    }
+    MPI_File_set_size(fh, 0);
+
+#ifdef GADGET_STYLE
+
+    //===================
+    // Write header
+    //===================
+    if(FileTask == 0) {
+      int dummy = sizeof(header);
+      set_gadget_header(A, npart_file, NumOutputFiles);
+      MPI_File_write_at(fh, 0, &dummy, 1, MPI_INT, MPI_STATUS_IGNORE);
+      MPI_File_write_at(fh, sizeof(int), &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+      MPI_File_write_at(fh, sizeof(int) + sizeof(header), &dummy, 1, MPI_INT, MPI_STATUS_IGNORE);
+    }
+    MPI_Offset offset = sizeof(header) + 2 * sizeof(int);
+
+    //===================
+    // Write coordinates
+    //===================
+    offset = write_block_mpiio(fh, FileComm, FileTask, offset, 0, 3 * sizeof(float), npart_before, npart_file, lengthfac, velfac, fac, Dv, Dv2);
+
+    //===================
+    // Write velocities
+    //===================
+    offset = write_block_mpiio(fh, FileComm, FileTask, offset, 1, 3 * sizeof(float), npart_before, npart_file, lengthfac, velfac, fac, Dv, Dv2);
+
+#ifdef PARTICLE_ID
+    //===================
+    // Write particle ID
+    //===================
+    offset = write_block_mpiio(fh, FileComm, FileTask, offset, 2, sizeof(unsigned long long), npart_before, npart_file, lengthfac, velfac, fac, Dv, Dv2);
+#endif
+
+#else
+
+    //==========================================================
+    // Output as ASCII. The lines have different lengths so we 
+    // first count the characters of our lines to find where 
+    // they go and then format and write them chunk by chunk
+    //==========================================================
+    size_t textmaxlen = 1024 + (size_t) MPIIO_CHUNK_PARTICLES * 7 * 13;
+    char *text = malloc(textmaxlen);
+    unsigned long long nchunks = mpiio_number_of_chunks(FileComm);
+
+    // Total number of particle in each file on the first line
+    char firstline[64];
+    int firstlinelen = (FileTask == 0) ? sprintf(firstline, "%llu\n", npart_file) : 0;
+
+    unsigned long long textlen_loc = firstlinelen, text_before = 0;
+    for(unsigned long long c = 0; c < nchunks; c++) {
+      unsigned int nstart, nend;
+      mpiio_chunk_range(c, &nstart, &nend);
+      textlen_loc += format_particles_ascii(&text, &textmaxlen, nstart, nend, lengthfac, velfac, fac, Dv, Dv2);
+    }
+    MPI_Exscan(&textlen_loc, &text_before, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, FileComm);
+    if(FileTask == 0) text_before = 0;
+
+    if(FileTask == 0) MPI_File_write_at(fh, 0, firstline, firstlinelen, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_Offset offset = text_before + firstlinelen;
+    for(unsigned long long c = 0; c < nchunks; c++) {
+      unsigned int nstart, nend;
+      mpiio_chunk_range(c, &nstart, &nend);
+      size_t textlen = format_particles_ascii(&text, &textmaxlen, nstart, nend, lengthfac, velfac, fac, Dv, Dv2);
+      MPI_File_write_at_all(fh, offset, text, (int) textlen, MPI_BYTE, MPI_STATUS_IGNORE);
+      offset += textlen;
+    }
+    free(text);
+
+#endif
+
+    MPI_File_close(&fh);
+    MPI_Comm_free(&FileComm);
+  }
+#endif
+
   //=====================================================================================
   // Generate the info file which contains a list of all the output files, 
   // the 8 corners of the slices on those files and the number of particles in the slice
@@ -974,11 +1498,26 @@ finalize:
       fflush(stdout);
       fprintf(fp, "#    FILENUM      XMIN         YMIN        ZMIN         XMAX         YMAX         ZMAX         NPART    \n");
       double y0 = 0.0, z0 = 0.0, y1 = Box, z1 = Box;
+#ifdef MPIIO_OUTPUT
+      // Each file contains the particles of a group of contiguous tasks
+      for (int f = 0; f < NumOutputFiles; f++) {
+        double x0 = Box, x1 = 0.0;
+        unsigned int npart_file = 0;
+        for (int i = 0; i < NTask; i++) {
+          if (output_file_of_task(i) != f) continue;
+          if (Local_p_start_table[i] * (Box / (double)Nsample) < x0) x0 = Local_p_start_table[i] * (Box / (double)Nsample);
+          if ((Local_p_start_table[i] + Local_np_table[i]) * (Box / (double)Nsample) > x1) x1 = (Local_p_start_table[i] + Local_np_table[i]) * (Box / (double)Nsample);
+          npart_file += Noutput_table[i];
+        }
+        fprintf(fp, "%12d %12.6lf %12.6lf %12.6lf %12.6lf %12.6lf %12.6lf %12u\n", f, x0, y0, z0, x1, y1, z1, npart_file);
+      }
+#else
       for (int i = 0; i < NTask; i++) {
         double x0 = Local_p_start_table[i] * (Box / (double)Nsample); 
         double x1 = (Local_p_start_table[i] + Local_np_table[i]) * (Box / (double)Nsample);
         fprintf(fp, "%12d %12.6lf %12.6lf %12.6lf %12.6lf %12.6lf %12.6lf %12u\n", i, x0, y0, z0, x1, y1, z1, Noutput_table[i]);
       }
+#endif
       fclose(fp);
     }
 
@@ -988,3 +1527,52 @@ finalize:
     return;
   }
 
+
+#ifdef TWIN_RUN
+//==========================================================================================
+// Twin run: the MG simulation [0] and its LCDM twin [1] are evolved in the same time loop.
+// The state of the current twin lives in the usual globals (P, NumPart, FileBase, ...) so 
+// the rest of the code is unchanged. twin_run_select stores the current twin and loads another
+//==========================================================================================
+void twin_run_init(void) {
+  for(int twin = 0; twin < 2; twin++) {
+    Twin[twin].P = NULL;
+    Twin[twin].NumPart = NumPart;
+    Twin[twin].modified_gravity_active = (twin == 0) ? modified_gravity_active : 0;
+    for(int axes = 0; axes < 3; axes++) {
+      Twin[twin].sumxyz[axes]  = 0.0;
+      Twin[twin].sumDxyz[axes] = 0.0;
+    }
+  }
+  snprintf(Twin[0].FileBase, sizeof(Twin[0].FileBase), "%s", FileBase);
+
+  // The LCDM twin must not end up with a truncated name (it could then overwrite other files)
+  if(snprintf(Twin[1].FileBase, sizeof(Twin[1].FileBase), "%s_lcdm", FileBase) >= (int) sizeof(Twin[1].FileBase)) {
+    if(ThisTask == 0) printf("\nERROR: FileBase is too long for the LCDM twin output name '%s_lcdm'.\n\n", FileBase);
+    FatalError((char *)"main.c", 1476);
+  }
+  ThisTwin = 0;
+}
+
+void twin_run_select(int twin) {
+  struct twin_state *t = &Twin[ThisTwin];
+  t->P = P;
+  t->NumPart = NumPart;
+  t->modified_gravity_active = modified_gravity_active;
+  for(int axes = 0; axes < 3; axes++) {
+    t->sumxyz[axes]  = sumxyz[axes];
+    t->sumDxyz[axes] = sumDxyz[axes];
+  }
+
+  ThisTwin = twin;
+  t = &Twin[twin];
+  P = t->P;
+  NumPart = t->NumPart;
+  modified_gravity_active = t->modified_gravity_active;
+  strcpy(FileBase, t->FileBase);
+  for(int axes = 0; axes < 3; axes++) {
+    sumxyz[axes]  = t->sumxyz[axes];
+    sumDxyz[axes] = t->sumDxyz[axes];
+  }
+}
+#endif
@@ -115,11 +115,122 @@ void EffDensitykToPhiofk(complex_kind* P3D_densityeffk, complex_kind *P3D_phik){
   }
 }
 
+//=====================================================================
+// The screening factors only depend on time and on one grid quantity x
+// (Phi, delta or |DPhi|^2). With SCREENING_TABLE we tabulate f(a, x) once
+// per step, log-spaced in y = sign * x + shift, and interpolate linearly
+// in log(y). Cells outside the table range are evaluated directly
+//=====================================================================
+
+#define SCREENING_TABLE_SIZE      8192
+#define SCREENING_TABLE_TOLERANCE 1e-3
+
+struct ScreeningTable {
+  double (*screening_function)(double a, double x);
+  double a;                     // The scale factor the table is made for
+  double sign, shift;           // The table is in y = sign * x + shift
+  double ymin, ymax;            // The range of the table
+  double logymin, inv_dlogy;
+  double f[SCREENING_TABLE_SIZE];
+};
+
+void make_screening_table(struct ScreeningTable *t, double (*screening_function)(double, double), double a, 
+    double sign, double shift, double ymin, double ymax){
+  t->screening_function = screening_function;
+  t->a         = a;
+  t->sign      = sign;
+  t->shift     = shift;
+  t->ymin      = ymin;
+  t->ymax      = ymax;
+  t->logymin   = log(ymin);
+  t->inv_dlogy = (SCREENING_TABLE_SIZE - 1) / log(ymax / ymin);
+  
+  for(int i = 0; i < SCREENING_TABLE_SIZE; i++){
+    double y = exp(t->logymin + i / t->inv_dlogy);
+    t->f[i] = screening_function(a, (y - shift) / sign);
+  }
+
+  // Check the accuracy of the interpolation in the middle of the intervals
+  double maxerr = 0.0, ymaxerr = ymin;
+  for(int i = 0; i < SCREENING_TABLE_SIZE - 1; i++){
+    double y   = exp(t->logymin + (i + 0.5) / t->inv_dlogy);
+    double err = fabs(screening_function(a, (y - shift) / sign) - 0.5 * (t->f[i] + t->f[i+1]));
+    if(err > maxerr){
+      maxerr  = err;
+      ymaxerr = y;
+    }
+  }
+  if(maxerr > SCREENING_TABLE_TOLERANCE && ThisTask == 0)
+    printf("===> Warning: screening table interpolation error %e at y = %e is larger than %e\n", maxerr, ymaxerr, SCREENING_TABLE_TOLERANCE);
+}
+
+static inline double lookup_screening_table(struct ScreeningTable *t, double x, long long *noutside){
+  double y = t->sign * x + t->shift;
+  if(y > t->ymin && y < t->ymax){
+    double u = (log(y) - t->logymin) * t->inv_dlogy;
+    int i = (int) u;
+    if(i > SCREENING_TABLE_SIZE - 2) i = SCREENING_TABLE_SIZE - 2;
+    double w = u - i;
+    return t->f[i] + (t->f[i+1] - t->f[i]) * w;
+  }
+
+  // Outside the table (y <= 0 is outside the domain of the table by design)
+  if(y > 0.0) (*noutside)++;
+  return t->screening_function(t->a, x);
+}
+
+//=====================================================================
+// Compute out[j] = factor * in[j] * f(a, x[j]) for all cells where f is 
+// the screening function. The table is in y = sign * x + shift in the 
+// range [ymin, ymax]. Also returns the min, max and mean of f over the cells
+//=====================================================================
+
+void apply_screening_factor(float_kind *out, float_kind *in, float_kind *x, int n, double factor, 
+    double (*screening_function)(double, double), double sign, double shift, double ymin, double ymax,
+    double *minscreen, double *maxscreen, double *avgscreen){
+  double minfac = 1e100, maxfac = -1e100, sumfac = 0.0;
+  long long noutside = 0;
+
+#ifdef SCREENING_TABLE
+  struct ScreeningTable *table = malloc(sizeof(struct ScreeningTable));
+  make_screening_table(table, screening_function, aexp_global, sign, shift, ymin, ymax);
+#endif
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(min:minfac) reduction(max:maxfac) reduction(+:sumfac,noutside)
+#endif
+  for(int j = 0; j < n; j++){
+#ifdef SCREENING_TABLE
+    double screenfac = lookup_screening_table(table, x[j], &noutside);
+#else
+    double screenfac = screening_function(aexp_global, x[j]);
+#endif
+    out[j] = factor * in[j] * screenfac;
+    if(screenfac < minfac) minfac = screenfac;
+    if(screenfac > maxfac) maxfac = screenfac;
+    sumfac += screenfac;
+  }
+
+#ifdef SCREENING_TABLE
+  free(table);
+#endif
+
+  // Report the number of cells that were outside the table (always zero without SCREENING_TABLE)
+  MPI_Allreduce(MPI_IN_PLACE, &noutside, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if(noutside > 0 && ThisTask == 0)
+    printf("===> Screening table: %lld cells outside the table range y = [%e, %e] were evaluated directly\n", noutside, ymin, ymax);
+
+  *minscreen = minfac;
+  *maxscreen = maxfac;
+  *avgscreen = sumfac / (double) n;
+}
+
 //=====================================================================
 // The main driver for any scalar tensor gravity defined by m(a) and
 // beta(a) like f(R) gravity
 //
 // Assuming we have density(k) in P3D when starting this routine
+// and density(x) in mgarray_two if include_screening is set 
 // as CopyDensityArray has been called in PtoMesh
 //=====================================================================
 
@@ -127,13 +238,21 @@ void ComputeFifthForce_PotentialScreening(){
   if(ThisTask == 0)
     printf("\n===> Computing modified gravity potential\n");
 
-  // When no screening we simply just need to call EffDensitykToPhiofk
+  // When no screening we simply just need to call EffDensitykToPhiofk on density(k)
   if( !include_screening ){
-    my_fftw_execute(plan_mg_phik);
     EffDensitykToPhiofk(P3D, P3D_mgarray_two);
     return;
   }
 
+#ifdef MULTIGRID_SOLVER
+  // Solve the full field equation if it's time for it. This gives us the
+  // effective density in mgarray_two and we only need to transform it
+  if(ComputeFifthForce_Multigrid()){
+    my_fftw_execute(plan_mg_phik);
+    return;
+  }
+#endif
+
   //=====================================================================
   // Loop over k-grid and divide by laplacian
   //=====================================================================
@@ -150,9 +269,10 @@ void ComputeFifthForce_PotentialScreening(){
   //=====================================================================
   // Compute density_effective(x) and store it in mgarray_two
   //=====================================================================
-  for(int j  = 0; j < 2*Total_size; j++){
-    mgarray_two[j] *= screening_factor_potential(aexp_global, mgarray_one[j]);
-  }
+  // Tabulated in y = -Phi for 1e-12 < -Phi < 1e2
+  double maxscreen, minscreen, avgscreen;
+  apply_screening_factor(mgarray_two, mgarray_two, mgarray_one, 2*Total_size, 1.0, 
+      screening_factor_potential, -1.0, 0.0, 1e-12, 1e2, &minscreen, &maxscreen, &avgscreen);
 
   //=====================================================================
   // Fourier-transform to get density_eff(k) stored in P3D_mgarray_two
@@ -170,6 +290,7 @@ void ComputeFifthForce_PotentialScreening(){
 //=====================================================================
 // The main driver for DGP like models that screen depending on density
 // Assuming we have density(k) in P3D when starting this routine
+// and density(x) in mgarray_two if include_screening is set 
 // as CopyDensityArray has been called in PtoMesh
 //=====================================================================
 
@@ -216,18 +337,12 @@ void ComputeFifthForce_DensityScreening(){
   //=====================================================================
   // Compute density_effective(x) and store it in mgarray_two
   //=====================================================================
-  double maxscreen = 0.0, minscreen = 1e100, avgscreen = 0.0;
-  for(int j = 0; j < 2 * Total_size; j++){
-    double screenfac = screening_factor_density(aexp_global, mgarray_one[j]);
-    mgarray_two[j] *= coupling * screenfac;
-    if(screenfac > maxscreen) maxscreen = screenfac;
-    if(screenfac < minscreen) minscreen = screenfac;
-    avgscreen += screenfac;
-
-    // Alternative: use smoothed density field also for force, not just for the screening factor
-    // mgarray_two[j] = coupling * mgarray_one[j] * screening_factor_density(aexp_global, mgarray_one[j]);
-  }
-  avgscreen /= (double)(2 * Total_size);
+  // Tabulated in y = 1 + delta for 1e-4 < 1 + delta < 1e6
+  // Alternative: use smoothed density field also for force, not just for the screening factor
+  // by passing mgarray_one as the input grid
+  double maxscreen, minscreen, avgscreen;
+  apply_screening_factor(mgarray_two, mgarray_two, mgarray_one, 2 * Total_size, coupling, 
+      screening_factor_density, 1.0, 1.0, 1e-4, 1e6, &minscreen, &maxscreen, &avgscreen);
   if(ThisTask == 0){
     printf("===> For CPU[0] we have AvgScreenFac = %8.3f  MaxScreenFac = %8.3f  MinScreenFac = %8.3f\n", avgscreen, maxscreen, minscreen);
   }
@@ -355,12 +470,11 @@ void check_real_space_grid(float_kind *grid){
 //=============================================
 // Take a copy of density grid. 
 // We need this to compute effective density
+// Only needed when include_screening is set
 //=============================================
 
 void CopyDensityArray(){
-  for(int i = 0; i < 2*Total_size; i++)
-    mgarray_two[i] = density[i];
-  //memcpy(&mgarray_two[0], &density[0], 2 * Total_size * sizeof(float));
+  memcpy(&mgarray_two[0], &density[0], 2 * Total_size * sizeof(float_kind));
 }
 
 //=============================================
@@ -387,6 +501,11 @@ void FreeMGArrays(){
   free(mgarray_two);
   my_fftw_destroy_plan(plan_mg_phinewton);
   my_fftw_destroy_plan(plan_mg_phik);
+  if(mgarray_gradient != NULL){
+    free(mgarray_gradient);
+    my_fftw_destroy_plan(plan_mg_gradient);
+    mgarray_gradient = NULL;
+  }
 }
 
 //==========================================================
@@ -394,43 +513,76 @@ void FreeMGArrays(){
 // Just added some routines for this for completeness
 // Not tested and there are faster ways to compute this
 // (compute gradient in real-space is probably better)
+//
+// Assumes we have density(k) in P3D and density(x) in
+// mgarray_two if include_screening is set. The three
+// components of DPhi are transformed with one batched
+// FFT (FFTW's howmany = 3) which shares the MPI transposes.
+// With MEMORY_MODE the three grids and the plan are only
+// allocated for the duration of the call
 //==========================================================
 
 void ComputeFifthForce_GradientScreening(){
 
-  // Make temp array to store density
-  float_kind *density_temp = malloc(sizeof(float_kind)*Total_size);
-  for(int i = 0; i < Total_size; i++) density_temp[i] = mgarray_two[i];
+  //=====================================================================
+  // If include_screening is not active just assign phik to be 
+  // the density(k) * coupling
+  //=====================================================================
+  if( ! include_screening ){
+    double coupling = coupling_function(aexp_global);
+    for(int i = 0; i < 2 * Total_size; i++){
+      mgarray_two[i] = density[i] * coupling;
+    }
+    return;
+  }
 
-  for(int i = 0; i < Total_size; i++) mgarray_two[i] = 0.0;
-  Density_to_DPhiNewtonk(P3D, P3D_mgarray_one, 0);
-  my_fftw_execute(plan_mg_phinewton);
-  for(int i = 0; i < Total_size; i++) mgarray_two[i] += mgarray_one[i]*mgarray_one[i];
-  Density_to_DPhiNewtonk(P3D, P3D_mgarray_one, 1);
-  my_fftw_execute(plan_mg_phinewton);
-  for(int i = 0; i < Total_size; i++) mgarray_two[i] += mgarray_one[i]*mgarray_one[i];
-  Density_to_DPhiNewtonk(P3D, P3D_mgarray_one, 2);
-  my_fftw_execute(plan_mg_phinewton);
-  for(int i = 0; i < Total_size; i++) mgarray_two[i] += mgarray_one[i]*mgarray_one[i];
+  // The three components of DPhi (interleaved) and the batched FFT are only 
+  // allocated the first time they are needed (every time with MEMORY_MODE)
+  if(mgarray_gradient == NULL){
+    ptrdiff_t n[3] = {Nmesh, Nmesh, Nmesh};
+    ptrdiff_t ncomplex[3] = {Nmesh, Nmesh, Nmesh/2+1}, local_nx, local_x_start;
+    ptrdiff_t alloc_gradient = my_fftw_mpi_local_size_many(3, ncomplex, 3, MPI_COMM_WORLD, &local_nx, &local_x_start);
+    mgarray_gradient     = (float_kind *)   malloc(2 * alloc_gradient * sizeof(float_kind));
+    P3D_mgarray_gradient = (complex_kind *) mgarray_gradient;
+    plan_mg_gradient     = my_fftw_mpi_plan_many_dft_c2r(3, n, 3, P3D_mgarray_gradient, mgarray_gradient, MPI_COMM_WORLD, FFTW_ESTIMATE);
+  }
 
-  // We now have (DPhi)^2 in units of (h/Mpc)^2 in mgarray_two so we can compute
-  // effective density
-  for(int i = 0; i < Total_size; i++) 
-    mgarray_two[i] = coupling_function(aexp_global) * density_temp[i] * screening_function_gradient(aexp_global, mgarray_one[i]);
-  free(density_temp);
+  // Compute all three components DPhi_i(k) interleaved and transform them together
+  Density_to_DPhiNewtonk_batched(P3D, P3D_mgarray_gradient);
+  my_fftw_execute(plan_mg_gradient);
+
+  // Accumulate |DPhi|^2 in mgarray_one
+  float_kind *dphi2 = mgarray_one;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int i = 0; i < 2 * Total_size; i++) 
+    dphi2[i] = mgarray_gradient[3*i]*mgarray_gradient[3*i] + mgarray_gradient[3*i+1]*mgarray_gradient[3*i+1] + mgarray_gradient[3*i+2]*mgarray_gradient[3*i+2];
+
+#ifdef MEMORY_MODE
+  free(mgarray_gradient);
+  my_fftw_destroy_plan(plan_mg_gradient);
+  mgarray_gradient = NULL;
+#endif
+
+  // We now have (DPhi)^2 in units of (h/Mpc)^2 in dphi2 so we can compute
+  // effective density in place in mgarray_two
+  // Tabulated in y = |DPhi|^2 for 1e-30 < |DPhi|^2 < 1e10
+  double maxscreen, minscreen, avgscreen;
+  apply_screening_factor(mgarray_two, mgarray_two, dphi2, 2 * Total_size, coupling_function(aexp_global),
+      screening_function_gradient, 1.0, 0.0, 1e-30, 1e10, &minscreen, &maxscreen, &avgscreen);
 
   my_fftw_execute(plan_mg_phik);
 }
 
 //=============================================================================
 // For models where screening depend on |DPhi|^2 we here transform from delta(k)
-// to [ D Phi ]_axes(k) which we fourier transformed is in units of 1/Boxsize
+// to [ D Phi ]_axes(k) which we fourier transformed is in units of 1/Boxsize.
+// All three components are computed in one pass over the grid and stored
+// interleaved, DPhi[3*ind + axes], which is the layout of the batched FFT plan_mg_gradient
 //=============================================================================
-void Density_to_DPhiNewtonk(complex_kind *densityk, complex_kind *DPhi_i, int axes){
-  int iglobal, kmin;
-  double RK, KK;
-
-
+void Density_to_DPhiNewtonk_batched(complex_kind *densityk, complex_kind *DPhi){
+  
   // Normalization of the density as when *= -1/k^2 and FFTd gives us Phi(x) in correct units
   // The Phi we compute here is the one that satisfy D_x^2 Phi = 4 pi G a^2 rho(a) delta = 1.5 Omega/a H0^2 delta
   double normfactor = 1.0/pow((double)Nmesh,3);
@@ -438,44 +590,33 @@ void Density_to_DPhiNewtonk(complex_kind *densityk, complex_kind *DPhi_i, int ax
 
   // We need global values for i as opposed to local values
   // Same goes for anything that relies on i (such as RK). 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
   for (int i = 0; i < Local_nx; i++) {
-    iglobal = i + Local_x_start;
-    for (int j = 0; j < (unsigned int)(Nmesh/2+1); j++) {
-      kmin = 0;
-      if ((iglobal == 0) && (j == 0)) {
-        DPhi_i[0][0] = DPhi_i[0][1] = 0.0;
-        kmin = 1;
-      }
-      for (int k = kmin; k < (unsigned int)(Nmesh/2+1); k++) {
+    int iglobal = i + Local_x_start;
+    double kx = (iglobal > Nmesh/2) ? (double)(iglobal - Nmesh) : (double) iglobal;
+    for (int j = 0; j < Nmesh; j++) {
+      double ky = (j > Nmesh/2) ? (double)(j - Nmesh) : (double) j;
+      for (int k = 0; k < Nmesh/2+1; k++) {
         unsigned int ind = (i*Nmesh + j)*(Nmesh/2+1) + k;
-        double d[3];
-        if (iglobal > Nmesh/2) {
-          RK    = (double)(k*k + (Nmesh-iglobal)*(Nmesh-iglobal) + j*j);
-          d[0] = Nmesh - iglobal;
-          d[1] = j;
-          d[2] = k;
-        } else {
-          RK    = (double)(k*k + iglobal*iglobal + j*j);
-          d[0] = iglobal;
-          d[1] = j;
-          d[2] = k;
+        double kz = (double) k;
+        double RK = kx*kx + ky*ky + kz*kz;
+
+        if(RK == 0.0){
+          for(int axes = 0; axes < 3; axes++)
+            DPhi[3*ind+axes][0] = DPhi[3*ind+axes][1] = 0.0;
+          continue;
         }
-        KK = -1.0/RK;
+        double KK = -normfactor/RK;
 
         // Divide by laplacian and multiply by i k_axes
-        DPhi_i[ind][0] = -(normfactor*densityk[ind][1]*KK) * d[axes];
-        DPhi_i[ind][1] =  (normfactor*densityk[ind][0]*KK) * d[axes];
-
-        // Do the mirror along the y axis
-        if ((j != (unsigned int)(Nmesh/2)) && (j != 0)) {
-          ind = (i*Nmesh + (Nmesh-j))*(Nmesh/2+1) + k;
-
-          d[1] = Nmesh - j;
-
-          // Divide by laplacian and multiply by i k_axes
-          DPhi_i[ind][0] = -(normfactor*densityk[ind][1]*KK * d[axes]);
-          DPhi_i[ind][1] =  (normfactor*densityk[ind][0]*KK * d[axes]);
-        }
+        DPhi[3*ind+0][0] = -densityk[ind][1] * KK * kx;
+        DPhi[3*ind+0][1] =  densityk[ind][0] * KK * kx;
+        DPhi[3*ind+1][0] = -densityk[ind][1] * KK * ky;
+        DPhi[3*ind+1][1] =  densityk[ind][0] * KK * ky;
+        DPhi[3*ind+2][0] = -densityk[ind][1] * KK * kz;
+        DPhi[3*ind+2][1] =  densityk[ind][0] * KK * kz;
       }
     }
   }
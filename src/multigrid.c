@@ -0,0 +1,407 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+
+//==========================================================================//
+// This file contains a real-space multigrid solver for the full nonlinear  //
+// field equation of Hu-Sawicky f(R) gravity. It is an alternative to the   //
+// approximate screening method in mg.h and is mainly meant for checking it //
+//                                                                          //
+// We solve for u = log(f_R / fbar_R(a)) (so that f_R keeps its sign):      //
+//                                                                          //
+//   -fbar D^2 e^u - A (e^{-u/(n+1)} - 1) = -B delta                       //
+//                                                                          //
+// with fbar = |fbar_R(a)|, A = a^2 (Omega/a^3 + 4 OmegaLambda) and         //
+// B = Omega / a in units where H0 = c = 1 (lengths in units of c/H0).      //
+// The solver is a FAS multigrid (V- or W-cycles) with nonlinear red-black  //
+// Gauss-Seidel smoothing on the FFTW slab decomposition. Each level holds  //
+// one ghost slice on each side exchanged with LeftTask/RightTask.          //
+//                                                                          //
+// The result is returned as the effective density of the fifth-force,      //
+// delta_eff = -D^2 f_R / (2 * 1.5 Omega / a) in the same units as delta,   //
+// which gives delta/3 * k^2/(k^2 + m^2) in the linear regime.              //
+//                                                                          //
+// The solution is kept between steps and used as the initial guess for     //
+// the next solve so a few cycles per solve are usually enough.             //
+//==========================================================================//
+
+#include "vars.h"
+#include "proto.h"
+
+#define MULTIGRID_MAXLEVELS  20
+#define MULTIGRID_NPRESMOOTH  2
+#define MULTIGRID_NPOSTSMOOTH 2
+#define MULTIGRID_NCOARSE    20
+#define MULTIGRID_MINSIZE     4
+#define MULTIGRID_MAXDU      1.0
+
+struct MultigridLevel {
+  int n;             // Number of cells per dimension
+  int nx;            // Number of x-slices on this task
+  int xstart;        // Global index of the first x-slice on this task
+  double h;          // The cell size in units of c/H0
+  double *u;         // The solution      (nx+2 slices, ghosts at ix = -1 and ix = nx)
+  double *f;         // The source        (nx+2 slices)
+  double *res;       // The residual      (nx+2 slices)
+  double *ubar;      // The restricted fine solution and later the correction (nx+2 slices)
+};
+
+static struct MultigridLevel mglevels[MULTIGRID_MAXLEVELS];
+static int    mgnlevels   = 0;
+static double *mgsolution = NULL;   // The finest level solution which we keep between steps
+static int    mgnsteps    = 0;      // The number of times ComputeFifthForce_Multigrid has been called
+
+// Index of a cell including the ghost slices. ix in [-1, nx]
+static inline int mgindex(struct MultigridLevel *l, int ix, int iy, int iz){
+  return ((ix + 1) * l->n + iy) * l->n + iz;
+}
+
+//====================================================
+// Copy the boundary slices to the ghost slices of
+// the neighbouring tasks
+//====================================================
+static void multigrid_exchange_ghosts(struct MultigridLevel *l, double *grid){
+  MPI_Status status;
+  int nslice = l->n * l->n;
+  if(l->nx == 0) return;
+
+  // Send the last slice right and receive the left ghost from the left
+  ierr = MPI_Sendrecv(&grid[mgindex(l, l->nx - 1, 0, 0)], nslice, MPI_DOUBLE, RightTask, 0,
+                      &grid[mgindex(l, -1, 0, 0)],        nslice, MPI_DOUBLE, LeftTask,  0, MPI_COMM_WORLD, &status);
+
+  // Send the first slice left and receive the right ghost from the right
+  ierr = MPI_Sendrecv(&grid[mgindex(l, 0, 0, 0)],         nslice, MPI_DOUBLE, LeftTask,  1,
+                      &grid[mgindex(l, l->nx, 0, 0)],     nslice, MPI_DOUBLE, RightTask, 1, MPI_COMM_WORLD, &status);
+}
+
+//====================================================
+// The model functions and the parameters of the 
+// equation at the current time
+//====================================================
+static double mg_fbar, mg_A, mg_B, mg_ninv;
+
+static void multigrid_set_parameters(double a){
+  double fac  = Omega / (a * a * a) + 4.0 * (1.0 - Omega);
+  double fac0 = Omega               + 4.0 * (1.0 - Omega);
+  mg_fbar = fofr0 * pow(fac0 / fac, nfofr + 1.0);
+  mg_A    = a * a * fac;
+  mg_B    = Omega / a;
+  mg_ninv = 1.0 / (nfofr + 1.0);
+}
+
+// The discretized operator L(u) in a cell and its derivative wrt u in the cell
+static inline double multigrid_operator(struct MultigridLevel *l, double *u, int ix, int iy, int iz, double *dLdu){
+  int n  = l->n;
+  int iyp = (iy + 1) % n, iym = (iy - 1 + n) % n;
+  int izp = (iz + 1) % n, izm = (iz - 1 + n) % n;
+  double eu   = exp(u[mgindex(l, ix, iy, iz)]);
+  double sum  = exp(u[mgindex(l, ix + 1, iy,  iz)])  + exp(u[mgindex(l, ix - 1, iy,  iz)])
+              + exp(u[mgindex(l, ix,     iyp, iz)])  + exp(u[mgindex(l, ix,     iym, iz)])
+              + exp(u[mgindex(l, ix,     iy,  izp)]) + exp(u[mgindex(l, ix,     iy,  izm)]);
+  double h2   = l->h * l->h;
+  double eR   = exp(-mg_ninv * u[mgindex(l, ix, iy, iz)]);
+  *dLdu = 6.0 * mg_fbar * eu / h2 + mg_A * mg_ninv * eR;
+  return -mg_fbar * (sum - 6.0 * eu) / h2 - mg_A * (eR - 1.0);
+}
+
+//====================================================
+// Nonlinear red-black Gauss-Seidel: one Newton
+// step per cell for each color
+//====================================================
+static void multigrid_smooth(struct MultigridLevel *l, int nsweeps){
+  for(int sweep = 0; sweep < nsweeps; sweep++){
+    for(int color = 0; color < 2; color++){
+      multigrid_exchange_ghosts(l, l->u);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for(int ix = 0; ix < l->nx; ix++){
+        for(int iy = 0; iy < l->n; iy++){
+          int izstart = (l->xstart + ix + iy + color) % 2;
+          for(int iz = izstart; iz < l->n; iz += 2){
+            double dLdu;
+            double res = multigrid_operator(l, l->u, ix, iy, iz, &dLdu) - l->f[mgindex(l, ix, iy, iz)];
+            double du  = -res / dLdu;
+            if(du >  MULTIGRID_MAXDU) du =  MULTIGRID_MAXDU;
+            if(du < -MULTIGRID_MAXDU) du = -MULTIGRID_MAXDU;
+            l->u[mgindex(l, ix, iy, iz)] += du;
+          }
+        }
+      }
+    }
+  }
+  multigrid_exchange_ghosts(l, l->u);
+}
+
+//====================================================
+// Compute the residual f - L(u) in l->res and
+// return the sum of the residual squared
+//====================================================
+static double multigrid_residual(struct MultigridLevel *l){
+  double sum2 = 0.0;
+  multigrid_exchange_ghosts(l, l->u);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:sum2)
+#endif
+  for(int ix = 0; ix < l->nx; ix++){
+    for(int iy = 0; iy < l->n; iy++){
+      for(int iz = 0; iz < l->n; iz++){
+        double dLdu;
+        int ind = mgindex(l, ix, iy, iz);
+        l->res[ind] = l->f[ind] - multigrid_operator(l, l->u, ix, iy, iz, &dLdu);
+        sum2 += l->res[ind] * l->res[ind];
+      }
+    }
+  }
+  return sum2;
+}
+
+//====================================================
+// Restrict a fine grid to the coarse grid by 
+// averaging over the 8 fine cells
+//====================================================
+static void multigrid_restrict(struct MultigridLevel *fine, double *finegrid, struct MultigridLevel *coarse, double *coarsegrid){
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int ix = 0; ix < coarse->nx; ix++){
+    for(int iy = 0; iy < coarse->n; iy++){
+      for(int iz = 0; iz < coarse->n; iz++){
+        double sum = 0.0;
+        for(int dx = 0; dx < 2; dx++)
+          for(int dy = 0; dy < 2; dy++)
+            for(int dz = 0; dz < 2; dz++)
+              sum += finegrid[mgindex(fine, 2*ix + dx, 2*iy + dy, 2*iz + dz)];
+        coarsegrid[mgindex(coarse, ix, iy, iz)] = sum / 8.0;
+      }
+    }
+  }
+}
+
+//====================================================
+// Add the coarse grid correction (coarse->u - coarse->ubar)
+// to the fine grid using trilinear interpolation for
+// cell centered grids (weights 3/4 and 1/4 per dimension)
+//====================================================
+static void multigrid_prolongate_correction(struct MultigridLevel *coarse, struct MultigridLevel *fine){
+  int nc = coarse->n;
+
+  // The correction in coarse->ubar including the ghosts
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int i = 0; i < (coarse->nx + 2) * nc * nc; i++)
+    coarse->ubar[i] = coarse->u[i] - coarse->ubar[i];
+  multigrid_exchange_ghosts(coarse, coarse->ubar);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int ix = 0; ix < fine->nx; ix++){
+    int icx = ix / 2, isx = (ix % 2 == 0) ? -1 : 1;
+    for(int iy = 0; iy < fine->n; iy++){
+      int icy = iy / 2, isy = (iy % 2 == 0) ? -1 : 1;
+      int icyn = (icy + isy + nc) % nc;
+      for(int iz = 0; iz < fine->n; iz++){
+        int icz = iz / 2, isz = (iz % 2 == 0) ? -1 : 1;
+        int iczn = (icz + isz + nc) % nc;
+        double corr = 0.0;
+        for(int ax = 0; ax < 2; ax++){
+          double wx = ax == 0 ? 0.75 : 0.25;
+          int cx = icx + ax * isx;
+          for(int ay = 0; ay < 2; ay++){
+            double wy = ay == 0 ? 0.75 : 0.25;
+            int cy = ay == 0 ? icy : icyn;
+            for(int az = 0; az < 2; az++){
+              double wz = az == 0 ? 0.75 : 0.25;
+              int cz = az == 0 ? icz : iczn;
+              corr += wx * wy * wz * coarse->ubar[mgindex(coarse, cx, cy, cz)];
+            }
+          }
+        }
+        fine->u[mgindex(fine, ix, iy, iz)] += corr;
+      }
+    }
+  }
+}
+
+//====================================================
+// One FAS multigrid cycle starting at level ilevel
+// gamma = 1 gives a V-cycle and gamma = 2 a W-cycle
+//====================================================
+static void multigrid_cycle(int ilevel, int gamma){
+  struct MultigridLevel *fine = &mglevels[ilevel];
+  if(ilevel == mgnlevels - 1){
+    multigrid_smooth(fine, MULTIGRID_NCOARSE);
+    return;
+  }
+  struct MultigridLevel *coarse = &mglevels[ilevel + 1];
+
+  multigrid_smooth(fine, MULTIGRID_NPRESMOOTH);
+
+  // Restrict the solution and the residual
+  multigrid_residual(fine);
+  multigrid_restrict(fine, fine->u,   coarse, coarse->u);
+  multigrid_restrict(fine, fine->res, coarse, coarse->f);
+  multigrid_exchange_ghosts(coarse, coarse->u);
+
+  // The coarse source f_c = L_c(R u) + R(f - L(u)) and keep a copy of R u
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int ix = 0; ix < coarse->nx; ix++){
+    for(int iy = 0; iy < coarse->n; iy++){
+      for(int iz = 0; iz < coarse->n; iz++){
+        double dLdu;
+        int ind = mgindex(coarse, ix, iy, iz);
+        coarse->f[ind]  += multigrid_operator(coarse, coarse->u, ix, iy, iz, &dLdu);
+        coarse->ubar[ind] = coarse->u[ind];
+      }
+    }
+  }
+
+  for(int i = 0; i < gamma; i++)
+    multigrid_cycle(ilevel + 1, gamma);
+
+  multigrid_prolongate_correction(coarse, fine);
+  multigrid_smooth(fine, MULTIGRID_NPOSTSMOOTH);
+}
+
+//====================================================
+// Set up the levels. We coarsen as long as all tasks 
+// have an even number of slices. Tasks without slices
+// have no slices on any level
+//====================================================
+static void multigrid_allocate_levels(void){
+  int n = Nmesh, nx = Local_nx, xstart = Local_x_start;
+  mgnlevels = 0;
+  while(1){
+    struct MultigridLevel *l = &mglevels[mgnlevels++];
+    l->n      = n;
+    l->nx     = nx;
+    l->xstart = xstart;
+    l->h      = Box / INVERSE_H0_MPCH / (double) n;
+    l->u      = (mgnlevels == 1 && mgsolution != NULL) ? mgsolution : malloc(sizeof(double) * (nx + 2) * n * n);
+    l->f      = malloc(sizeof(double) * (nx + 2) * n * n);
+    l->res    = malloc(sizeof(double) * (nx + 2) * n * n);
+    l->ubar   = malloc(sizeof(double) * (nx + 2) * n * n);
+    if(mgnlevels == 1 && mgsolution == NULL){
+      for(int i = 0; i < (nx + 2) * n * n; i++) l->u[i] = 0.0;
+      mgsolution = l->u;
+    }
+
+    // Can we make another level?
+    int can_coarsen = (nx % 2 == 0) && (n / 2 >= MULTIGRID_MINSIZE) && (n % 2 == 0) && (mgnlevels < MULTIGRID_MAXLEVELS);
+    MPI_Allreduce(MPI_IN_PLACE, &can_coarsen, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if(!can_coarsen) break;
+    n /= 2; nx /= 2; xstart /= 2;
+  }
+}
+
+static void multigrid_free_levels(void){
+  for(int i = 0; i < mgnlevels; i++){
+    if(i > 0) free(mglevels[i].u);
+    free(mglevels[i].f);
+    free(mglevels[i].res);
+    free(mglevels[i].ubar);
+  }
+  mgnlevels = 0;
+}
+
+//====================================================
+// Should we use the multigrid solver this step?
+//====================================================
+int multigrid_solve_this_step(void){
+  return (mgnsteps % MultigridSolveEvery == 0);
+}
+
+//====================================================
+// Solve the field equation and store the effective 
+// density of the fifth-force in real space in 
+// mgarray_two. Assumes mgarray_two contains delta(x) 
+// on input. Returns 1 if we solved this step and 0
+// if the approximate method should be used instead
+//====================================================
+int ComputeFifthForce_Multigrid(void){
+  int solve = multigrid_solve_this_step();
+  mgnsteps++;
+  if(!solve) return 0;
+
+  if(ThisTask == 0)
+    printf("\n===> Solving the f(R) field equation with multigrid\n");
+
+  multigrid_set_parameters(aexp_global);
+  multigrid_allocate_levels();
+  struct MultigridLevel *l = &mglevels[0];
+  int n = Nmesh;
+
+  // The source -B delta on the finest level
+  double sum2_source = 0.0;
+  for(int ix = 0; ix < l->nx; ix++){
+    for(int iy = 0; iy < n; iy++){
+      for(int iz = 0; iz < n; iz++){
+        double delta = mgarray_two[(ix * Nmesh + iy) * 2 * (Nmesh/2+1) + iz];
+        l->f[mgindex(l, ix, iy, iz)] = -mg_B * delta;
+        sum2_source += mg_B * mg_B * delta * delta;
+      }
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &sum2_source, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  if(sum2_source == 0.0) sum2_source = 1.0;
+
+  // Do cycles until converged or until we reach the max number of cycles
+  double sum2 = multigrid_residual(l);
+  MPI_Allreduce(MPI_IN_PLACE, &sum2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  double err = sqrt(sum2 / sum2_source);
+  if(ThisTask == 0) printf("===> Multigrid levels = %i  initial residual = %e\n", mgnlevels, err);
+  for(int icycle = 0; icycle < MultigridMaxCycles && err > MultigridEpsilon; icycle++){
+    multigrid_cycle(0, MultigridCycleType);
+
+    sum2 = multigrid_residual(l);
+    MPI_Allreduce(MPI_IN_PLACE, &sum2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    err = sqrt(sum2 / sum2_source);
+    if(ThisTask == 0) printf("===> Multigrid cycle %i  residual = %e\n", icycle + 1, err);
+  }
+
+  // The effective density delta_eff = -(a / (3 Omega)) D^2 f_R = delta/3 - (A / (3 B)) (e^{-u/(n+1)} - 1)
+  for(int ix = 0; ix < l->nx; ix++){
+    for(int iy = 0; iy < n; iy++){
+      for(int iz = 0; iz < n; iz++){
+        int ind = (ix * Nmesh + iy) * 2 * (Nmesh/2+1) + iz;
+        double u = l->u[mgindex(l, ix, iy, iz)];
+        mgarray_two[ind] = mgarray_two[ind] / 3.0 - mg_A / (3.0 * mg_B) * (exp(-mg_ninv * u) - 1.0);
+      }
+    }
+  }
+
+  multigrid_free_levels();
+  return 1;
+}
+
+//====================================================
+// Free the solution we keep between steps
+//====================================================
+void free_multigrid_solution(void){
+  free(mgsolution);
+  mgsolution = NULL;
+}
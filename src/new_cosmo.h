@@ -73,40 +73,64 @@ void compute_phi_of_a(){
     printf("Assuming Phi_ini = %f at aini = %f\n", phi_ini, amin);
   }
 
-  gsl_function F;
-  F.function = &integrand_phiofa;
-  gsl_integration_workspace * w = gsl_integration_workspace_alloc(1000);
+  // The arrays are stored in one table
+  double *phi_table = malloc(3 * npts * sizeof(double));
+  double *x_arr     = &phi_table[0 * npts];
+  double *phi_arr   = &phi_table[1 * npts];
+  double *err_arr   = &phi_table[2 * npts];
+
+  // Use the cached table if we have it
+  int table_is_computed = 0;
+#ifdef TABLE_CACHE
+  double cache_params[3] = {npts, xmin, xmax};
+  unsigned long long cache_hash = table_cache_hash("phi_of_a", cache_params, 3);
+  struct table_cache_map cache_map;
+  double *cached_table = table_cache_load("phi_of_a", cache_hash, 3 * npts, &cache_map);
+  if(cached_table != NULL){
+    memcpy(phi_table, cached_table, 3 * npts * sizeof(double));
+    table_cache_close(&cache_map);
+    table_is_computed = 1;
+  }
+#endif
 
-  double *x_arr   = malloc(npts * sizeof(double));
-  double *phi_arr = malloc(npts * sizeof(double));
-  double *err_arr = malloc(npts * sizeof(double));
+  if(!table_is_computed){
+    gsl_function F;
+    F.function = &integrand_phiofa;
+    gsl_integration_workspace * w = gsl_integration_workspace_alloc(1000);
 
-  phi_arr[0] = phi_ini;
-  x_arr[0] = xmin;
-  err_arr[0] = 0.0;
-  for(int i = 1; i < npts; i++){
-    double xold = xmin + (i-1) * deltax;
-    double xnow = xmin + i * deltax;
+    phi_arr[0] = phi_ini;
+    x_arr[0] = xmin;
+    err_arr[0] = 0.0;
+    for(int i = 1; i < npts; i++){
+      double xold = xmin + (i-1) * deltax;
+      double xnow = xmin + i * deltax;
 
-    double phi_local, error_local;
-    gsl_integration_qag(&F, (double)xold, (double)xnow, 0, 1e-6, 1000, 6, w, &phi_local, &error_local); 
+      double phi_local, error_local;
+      gsl_integration_qag(&F, (double)xold, (double)xnow, 0, 1e-6, 1000, 6, w, &phi_local, &error_local); 
    
-    x_arr[i] = xnow;
-    phi_arr[i] = phi_arr[i-1] + phi_local;
-    err_arr[i] = err_arr[i-1] + error_local;
+      x_arr[i] = xnow;
+      phi_arr[i] = phi_arr[i-1] + phi_local;
+      err_arr[i] = err_arr[i-1] + error_local;
 
-  }
+    }
   
-  // Rescale to phi_crit = phi(a)/2beta(a). For f(R) this becomes 1.5 f_R(a)
-  for(int i = 0; i < npts; i++){
-    double anow = exp(x_arr[i]);
+    // Rescale to phi_crit = phi(a)/2beta(a). For f(R) this becomes 1.5 f_R(a)
+    for(int i = 0; i < npts; i++){
+      double anow = exp(x_arr[i]);
+      phi_arr[i] = phi_arr[i] / (2.0 * beta_of_a(anow));
+      err_arr[i] = err_arr[i] / (2.0 * beta_of_a(anow));
+    }
+    gsl_integration_workspace_free (w);
 
-    phi_arr[i] = phi_arr[i] / (2.0 * beta_of_a(anow));
-    err_arr[i] = err_arr[i] / (2.0 * beta_of_a(anow));
+#ifdef TABLE_CACHE
+    table_cache_write("phi_of_a", cache_hash, &phi_table, 1, 3 * npts);
+#endif
+  }
 
-    if(ThisTask == 0 && i % 100 == 0){
+  if(ThisTask == 0){
+    for(int i = 0; i < npts; i += 100){
+      double anow = exp(x_arr[i]);
       printf("a = %6.3f    Phi_critical = %10.5e   [Est. error in integration = %10.5e %%]\n", anow, phi_arr[i], (err_arr[i] / phi_arr[i])*100.0);
-
     }
   }
 
@@ -115,10 +139,7 @@ void compute_phi_of_a(){
   create_spline(phi_of_a_spline,  x_arr,  phi_arr, npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
 
   // Free up memory
-  gsl_integration_workspace_free (w);
-  free(x_arr);
-  free(phi_arr);
-  free(err_arr);
+  free(phi_table);
 }
 #endif
 
@@ -126,6 +147,20 @@ double Qfactor(double a) {
   return hubble(a)*a*a*a;
 }
 
+//========================================================
+// Split n independent jobs (e.g. k-values to solve the
+// growth ODEs for) as evenly as possible over the tasks.
+// Task i does the jobs [start[i], start[i] + count[i])
+//========================================================
+void split_range_over_tasks(int n, int *start, int *count){
+  int n_per_task = n / NTask;
+  int n_rest     = n % NTask;
+  for(int i = 0; i < NTask; i++){
+    count[i] = n_per_task + (i < n_rest ? 1 : 0);
+    start[i] = (i == 0 ? 0 : start[i-1] + count[i-1]);
+  }
+}
+
 //========================================================
 // Splines needed to store growth-factors and derivatives
 //========================================================
@@ -256,6 +291,10 @@ int ode_second_order_growth_kernel_D2(double x, const double D2[], double dD2dy[
 // First order growth-factor and LCDM fitting-formula
 //====================================================
 double growth_D(double a){
+#ifdef TWIN_RUN
+  // The LCDM twin uses the LCDM growth-factors
+  if(! modified_gravity_active) return growth_DLCDM(a);
+#endif
   return spline_lookup(TimeDependentSplines.D_spline,           log(a) ) / spline_lookup(TimeDependentSplines.D_spline,     log(GROWTH_NORMALIZATION_SCALE_FACTOR) );
 }
 double growth_DLCDM(double a){
@@ -269,6 +308,9 @@ double growth_D_LCDMFit(double a){
 // Derivative of first order growth-factor and LCDM fitting-formula
 //==================================================================
 double growth_dDdy(double a){
+#ifdef TWIN_RUN
+  if(! modified_gravity_active) return growth_dDLCDMdy(a);
+#endif
   return spline_lookup(TimeDependentSplines.dDdy_spline,        log(a) ) / spline_lookup(TimeDependentSplines.D_spline,     log(GROWTH_NORMALIZATION_SCALE_FACTOR) );
 }
 double growth_dDLCDMdy(double a){
@@ -282,6 +324,9 @@ double growth_dDdy_LCDMFit(double a){
 // Second derivative of first order growth-factor and LCDM fitting-formula
 //=========================================================================
 double growth_ddDddy(double a){
+#ifdef TWIN_RUN
+  if(! modified_gravity_active) return growth_ddDLCDMddy(a);
+#endif
   return spline_lookup(TimeDependentSplines.ddDddy_spline,      log(a) ) / spline_lookup(TimeDependentSplines.D_spline,      log(GROWTH_NORMALIZATION_SCALE_FACTOR) );
 }
 double growth_ddDLCDMddy(double a){
@@ -295,6 +340,9 @@ double growth_ddDddy_LCDMFit(double a){
 // Second order growth-factor and LCDM fitting-formula
 //====================================================
 double growth_D2(double a){
+#ifdef TWIN_RUN
+  if(! modified_gravity_active) return growth_D2LCDM(a);
+#endif
   return spline_lookup(TimeDependentSplines.D2_spline,          log(a) ) / spline_lookup(TimeDependentSplines.D2_spline,     log(GROWTH_NORMALIZATION_SCALE_FACTOR) );
 }
 double growth_D2LCDM(double a){
@@ -308,6 +356,9 @@ double growth_D2_LCDMFit(double a){
 // Derivative of second order growth-factor and LCDM fitting-formula
 //==================================================================
 double growth_dD2dy(double a){
+#ifdef TWIN_RUN
+  if(! modified_gravity_active) return growth_dD2LCDMdy(a);
+#endif
   return spline_lookup(TimeDependentSplines.dD2dy_spline,       log(a) ) / spline_lookup(TimeDependentSplines.D2_spline,     log(GROWTH_NORMALIZATION_SCALE_FACTOR) );
 }
 double growth_dD2LCDMdy(double a){
@@ -321,6 +372,9 @@ double growth_dD2dy_LCDMFit(double a){
 // Second order derivative of second order growth-factor and LCDM fitting-formula
 //===============================================================================
 double growth_ddD2ddy(double a){
+#ifdef TWIN_RUN
+  if(! modified_gravity_active) return growth_ddD2LCDMddy(a);
+#endif
   return spline_lookup(TimeDependentSplines.ddD2ddy_spline,     log(a) ) / spline_lookup(TimeDependentSplines.D2_spline,     log(GROWTH_NORMALIZATION_SCALE_FACTOR) );
 }
 double growth_ddD2LCDMddy(double a){
@@ -343,120 +397,145 @@ void solve_for_growth_factors(){
   const double xend   = log(1.0/(1.0 + zend));
   const double deltax = (xend - xini) / (double) (npts-1);
 
-  // Allocate arrays for growth-factors
-  double *x_arr            = malloc(sizeof(double) * npts);
+  // Allocate arrays for growth-factors. All arrays are stored in one table
+  const int narrays        = 13;
+  double *growth_table     = malloc(sizeof(double) * npts * narrays);
+  double *x_arr            = &growth_table[ 0 * npts];
   
   // Modified gravity arrays
-  double *D_arr            = malloc(sizeof(double) * npts);
-  double *dDdy_arr         = malloc(sizeof(double) * npts);
-  double *ddDddy_arr       = malloc(sizeof(double) * npts);
-  double *D2_arr           = malloc(sizeof(double) * npts);
-  double *dD2dy_arr        = malloc(sizeof(double) * npts);
-  double *ddD2ddy_arr      = malloc(sizeof(double) * npts);
+  double *D_arr            = &growth_table[ 1 * npts];
+  double *dDdy_arr         = &growth_table[ 2 * npts];
+  double *ddDddy_arr       = &growth_table[ 3 * npts];
+  double *D2_arr           = &growth_table[ 4 * npts];
+  double *dD2dy_arr        = &growth_table[ 5 * npts];
+  double *ddD2ddy_arr      = &growth_table[ 6 * npts];
   
   // LCDM arrays
-  double *DLCDM_arr        = malloc(sizeof(double) * npts);
-  double *dDLCDMdy_arr     = malloc(sizeof(double) * npts);
-  double *ddDLCDMddy_arr   = malloc(sizeof(double) * npts);
-  double *D2LCDM_arr       = malloc(sizeof(double) * npts);
-  double *dD2LCDMdy_arr    = malloc(sizeof(double) * npts);
-  double *ddD2LCDMddy_arr  = malloc(sizeof(double) * npts);
-
-  //=======================================================================
-  // First order equation we solve below:
-  // D''(x) + D'(x) ( 2  + Exp[x] H'[x]/H[x] ) - 1.5 * Omega * GeffG * exp(-3x) / H^2[x] D(x)
-  // Defining the variable q = D'[x] then we get the system coupled first order system
-  // dq[x]/dx = 1.5 * GeffG(x) * exp(-3x) / H^2[x] D[x] - q[x] ( 2  + Exp[x] H'[x]/H[x] )
-  // dD[x]/dx = q[x]
-  //=======================================================================
+  double *DLCDM_arr        = &growth_table[ 7 * npts];
+  double *dDLCDMdy_arr     = &growth_table[ 8 * npts];
+  double *ddDLCDMddy_arr   = &growth_table[ 9 * npts];
+  double *D2LCDM_arr       = &growth_table[10 * npts];
+  double *dD2LCDMdy_arr    = &growth_table[11 * npts];
+  double *ddD2LCDMddy_arr  = &growth_table[12 * npts];
+
+  // Use the cached table if we have it
+  int table_is_computed = 0;
+#ifdef TABLE_CACHE
+  double cache_params[3] = {npts, xini, xend};
+  unsigned long long cache_hash = table_cache_hash("growth_factors", cache_params, 3);
+  struct table_cache_map cache_map;
+  double *cached_table = table_cache_load("growth_factors", cache_hash, npts * narrays, &cache_map);
+  if(cached_table != NULL){
+    memcpy(growth_table, cached_table, sizeof(double) * npts * narrays);
+    table_cache_close(&cache_map);
+    table_is_computed = 1;
+  }
+#endif
+
+  if(!table_is_computed){
+
+    //=======================================================================
+    // First order equation we solve below:
+    // D''(x) + D'(x) ( 2  + Exp[x] H'[x]/H[x] ) - 1.5 * Omega * GeffG * exp(-3x) / H^2[x] D(x)
+    // Defining the variable q = D'[x] then we get the system coupled first order system
+    // dq[x]/dx = 1.5 * GeffG(x) * exp(-3x) / H^2[x] D[x] - q[x] ( 2  + Exp[x] H'[x]/H[x] )
+    // dD[x]/dx = q[x]
+    //=======================================================================
   
-  //=======================================================================
-  // Second order equation we need to solve (for LCDM)
-  // D2''[x] + (2.0 + H'[x]/H[x]) D2'[x] = 3/2 1/a^3 1/H[x]^2 (D2[x] - D1[x]^2)
-  // 
-  // In the EdS we approx have D2 ~ -3/7 D1^2 and D1 ~ a in the matter era so
-  // D2_ini ~ -3/7 and dD2_ini/dx ~ 2*D2_ini
-  //
-  // NB: Since we normalize at z=0 the factor -3/7 needs to be multiplied 
-  // in to the initial displacement-field when used.
-  //=======================================================================
+    //=======================================================================
+    // Second order equation we need to solve (for LCDM)
+    // D2''[x] + (2.0 + H'[x]/H[x]) D2'[x] = 3/2 1/a^3 1/H[x]^2 (D2[x] - D1[x]^2)
+    // 
+    // In the EdS we approx have D2 ~ -3/7 D1^2 and D1 ~ a in the matter era so
+    // D2_ini ~ -3/7 and dD2_ini/dx ~ 2*D2_ini
+    //
+    // NB: Since we normalize at z=0 the factor -3/7 needs to be multiplied 
+    // in to the initial displacement-field when used.
+    //=======================================================================
   
-  // Set up ODE system
-  double k_value = 0.0;
-  gsl_odeiv2_system sys_D       = {ode_growth_D,     NULL, 4, &k_value};
-  gsl_odeiv2_system sys_DLCDM   = {ode_growth_DLCDM, NULL, 4, &k_value};
-  gsl_odeiv2_driver * ode_D     = gsl_odeiv2_driver_alloc_y_new (&sys_D,     gsl_odeiv2_step_rk2, MY_GSL_HSTART, MY_GSL_EPS, MY_GSL_REL);
-  gsl_odeiv2_driver * ode_DLCDM = gsl_odeiv2_driver_alloc_y_new (&sys_DLCDM, gsl_odeiv2_step_rk2, MY_GSL_HSTART, MY_GSL_EPS, MY_GSL_REL);
-
-  // Initial conditions for growing mode D ~ a so q ~ a
-  double ode_D_x      = xini;
-  double ode_DLCDM_x  = xini;
-  double D_now[4]     = { 1.0, 1.0, -3.0/7.0, -6.0/7.0 };
-  double DLCDM_now[4] = { 1.0, 1.0, -3.0/7.0, -6.0/7.0 };
-  double muini        = GeffoverG(aini, k_value);
-
-  // Store the initial values in array
-  x_arr[0]           = xini;
+    // Set up ODE system
+    double k_value = 0.0;
+    gsl_odeiv2_system sys_D       = {ode_growth_D,     NULL, 4, &k_value};
+    gsl_odeiv2_system sys_DLCDM   = {ode_growth_DLCDM, NULL, 4, &k_value};
+    gsl_odeiv2_driver * ode_D     = gsl_odeiv2_driver_alloc_y_new (&sys_D,     gsl_odeiv2_step_rk2, MY_GSL_HSTART, MY_GSL_EPS, MY_GSL_REL);
+    gsl_odeiv2_driver * ode_DLCDM = gsl_odeiv2_driver_alloc_y_new (&sys_DLCDM, gsl_odeiv2_step_rk2, MY_GSL_HSTART, MY_GSL_EPS, MY_GSL_REL);
+
+    // Initial conditions for growing mode D ~ a so q ~ a
+    double ode_D_x      = xini;
+    double ode_DLCDM_x  = xini;
+    double D_now[4]     = { 1.0, 1.0, -3.0/7.0, -6.0/7.0 };
+    double DLCDM_now[4] = { 1.0, 1.0, -3.0/7.0, -6.0/7.0 };
+    double muini        = GeffoverG(aini, k_value);
+
+    // Store the initial values in array
+    x_arr[0]           = xini;
   
-  D_arr[0]           = D_now[0];
-  dDdy_arr[0]        = D_now[1] * Qfactor(aini) / aini;
-  ddDddy_arr[0]      = 1.5 * muini * Omega * aini * D_now[0];
+    D_arr[0]           = D_now[0];
+    dDdy_arr[0]        = D_now[1] * Qfactor(aini) / aini;
+    ddDddy_arr[0]      = 1.5 * muini * Omega * aini * D_now[0];
       
-  D2_arr[0]          = D_now[2];
-  dD2dy_arr[0]       = D_now[3] * Qfactor(aini) / aini;
-  ddD2ddy_arr[0]     = 1.5 * muini * Omega * aini * (D_now[2] - pow2( D_now[0] ) * Factor_2LPT(aini) );
+    D2_arr[0]          = D_now[2];
+    dD2dy_arr[0]       = D_now[3] * Qfactor(aini) / aini;
+    ddD2ddy_arr[0]     = 1.5 * muini * Omega * aini * (D_now[2] - pow2( D_now[0] ) * Factor_2LPT(aini) );
   
-  DLCDM_arr[0]       = DLCDM_now[0];
-  dDLCDMdy_arr[0]    = DLCDM_now[1] * Qfactor(aini) / aini;
-  ddDLCDMddy_arr[0]  = 1.5 * Omega * aini * DLCDM_now[0];
+    DLCDM_arr[0]       = DLCDM_now[0];
+    dDLCDMdy_arr[0]    = DLCDM_now[1] * Qfactor(aini) / aini;
+    ddDLCDMddy_arr[0]  = 1.5 * Omega * aini * DLCDM_now[0];
   
-  D2LCDM_arr[0]      = DLCDM_now[2];
-  dD2LCDMdy_arr[0]   = DLCDM_now[3] * Qfactor(aini) / aini;
-  ddD2LCDMddy_arr[0] = 1.5 * Omega * aini * (DLCDM_now[2] - pow2( DLCDM_now[0] ) );
+    D2LCDM_arr[0]      = DLCDM_now[2];
+    dD2LCDMdy_arr[0]   = DLCDM_now[3] * Qfactor(aini) / aini;
+    ddD2LCDMddy_arr[0] = 1.5 * Omega * aini * (DLCDM_now[2] - pow2( DLCDM_now[0] ) );
     
-  // Integration in time
-  for(int i = 1; i < npts; i++){
-    double xnow = xini + i * deltax;
-    double anow = exp(xnow);
-    double mu   = GeffoverG(anow, k_value);
-
-    // Integrate up MG growthfactor
-    int status = gsl_odeiv2_driver_apply(ode_D, &ode_D_x, xnow, D_now);
-    if(status != GSL_SUCCESS){
-      printf("Error in integrating first order growth factor at x = %f  D = %f\n", xnow, D_now[0]);
-      MPI_Abort(MPI_COMM_WORLD, 1);
-      exit(1);
-    }
+    // Integration in time
+    for(int i = 1; i < npts; i++){
+      double xnow = xini + i * deltax;
+      double anow = exp(xnow);
+      double mu   = GeffoverG(anow, k_value);
+
+      // Integrate up MG growthfactor
+      int status = gsl_odeiv2_driver_apply(ode_D, &ode_D_x, xnow, D_now);
+      if(status != GSL_SUCCESS){
+        printf("Error in integrating first order growth factor at x = %f  D = %f\n", xnow, D_now[0]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        exit(1);
+      }
     
-    // Integrate up LCDM growth factor
-    int status_LCDM = gsl_odeiv2_driver_apply(ode_DLCDM, &ode_DLCDM_x, xnow, DLCDM_now);
-    if(status_LCDM != GSL_SUCCESS){
-      printf("Error in integrating first order growth factor for LCDM at x = %f  D = %f\n", xnow, DLCDM_now[0]);
-      MPI_Abort(MPI_COMM_WORLD, 1);
-      exit(1);
-    }
+      // Integrate up LCDM growth factor
+      int status_LCDM = gsl_odeiv2_driver_apply(ode_DLCDM, &ode_DLCDM_x, xnow, DLCDM_now);
+      if(status_LCDM != GSL_SUCCESS){
+        printf("Error in integrating first order growth factor for LCDM at x = %f  D = %f\n", xnow, DLCDM_now[0]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        exit(1);
+      }
 
-    // Store values
-    x_arr[i]           = xnow;
+      // Store values
+      x_arr[i]           = xnow;
  
-    D_arr[i]           = D_now[0];
-    dDdy_arr[i]        = D_now[1] * Qfactor(anow) / anow;
-    ddDddy_arr[i]      = 1.5 * mu * Omega * anow * D_now[0];
+      D_arr[i]           = D_now[0];
+      dDdy_arr[i]        = D_now[1] * Qfactor(anow) / anow;
+      ddDddy_arr[i]      = 1.5 * mu * Omega * anow * D_now[0];
     
-    D2_arr[i]          = D_now[2];
-    dD2dy_arr[i]       = D_now[3] * Qfactor(anow) / anow;
-    ddD2ddy_arr[i]     = 1.5 * mu * Omega * anow * (D_now[2] - pow2( D_now[0] ) * Factor_2LPT(anow) );
-
-    // Store values for LCDM
-    DLCDM_arr[i]       = DLCDM_now[0];
-    dDLCDMdy_arr[i]    = DLCDM_now[1] * Qfactor(anow) / anow;
-    ddDLCDMddy_arr[i]  = 1.5 * Omega * anow * DLCDM_now[0];
+      D2_arr[i]          = D_now[2];
+      dD2dy_arr[i]       = D_now[3] * Qfactor(anow) / anow;
+      ddD2ddy_arr[i]     = 1.5 * mu * Omega * anow * (D_now[2] - pow2( D_now[0] ) * Factor_2LPT(anow) );
+
+      // Store values for LCDM
+      DLCDM_arr[i]       = DLCDM_now[0];
+      dDLCDMdy_arr[i]    = DLCDM_now[1] * Qfactor(anow) / anow;
+      ddDLCDMddy_arr[i]  = 1.5 * Omega * anow * DLCDM_now[0];
     
-    D2LCDM_arr[i]      = DLCDM_now[2];
-    dD2LCDMdy_arr[i]   = DLCDM_now[3] * Qfactor(anow) / anow;
-    ddD2LCDMddy_arr[i] = 1.5 * Omega * anow * (DLCDM_now[2] - pow2( DLCDM_now[0] ));
+      D2LCDM_arr[i]      = DLCDM_now[2];
+      dD2LCDMdy_arr[i]   = DLCDM_now[3] * Qfactor(anow) / anow;
+      ddD2LCDMddy_arr[i] = 1.5 * Omega * anow * (DLCDM_now[2] - pow2( DLCDM_now[0] ));
+    }
+    gsl_odeiv2_driver_free(ode_D);
+    gsl_odeiv2_driver_free(ode_DLCDM);
+
+#ifdef TABLE_CACHE
+    table_cache_write("growth_factors", cache_hash, &growth_table, 1, npts * narrays);
+#endif
   }
- 
+
   // Make first order growth factor splines for modifed gravity
   TimeDependentSplines.D_spline            = malloc(sizeof(Spline));
   create_spline(TimeDependentSplines.D_spline,           x_arr, D_arr,           npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
@@ -548,24 +627,8 @@ void solve_for_growth_factors(){
     }
   }
 
-  // Free up modified gravity arrays
-  free(D_arr);
-  free(dDdy_arr);
-  free(ddDddy_arr);
-  free(D2_arr);
-  free(dD2dy_arr);
-  free(ddD2ddy_arr);
-  
-  // Free up LCDM arrays
-  free(DLCDM_arr);
-  free(dDLCDMdy_arr);
-  free(ddDLCDMddy_arr);
-  free(D2LCDM_arr);
-  free(dD2LCDMdy_arr);
-  free(ddD2LCDMddy_arr);
- 
-  // Free up x-array
-  free(x_arr);
+  // Free up the arrays
+  free(growth_table);
 
 #ifdef SCALEDEPENDENT
   
@@ -656,6 +719,20 @@ double mg_pofk_ratio(double k, double a){
 #endif
 }
 
+#ifdef SCALEDEPENDENT
+//=================================================================
+// The growth-factor ratio D(k,a) / D_LCDM(a) tabulated in the k-bins
+// of the splines at a fixed time. The square of the value we get
+// with splinearray_lookup_at_fixed_time is then mg_pofk_ratio(k, a)
+//=================================================================
+void create_mg_growth_ratio_at_fixed_time(double a, SplineArrayAtFixedTime *g){
+  create_splinearray_at_fixed_time(&FirstOrderGrowthFactor_D, log(a), g);
+  double DLCDM = spline_lookup(TimeDependentSplines.DLCDM_spline, log(a));
+  for(int i = 0; i < g->nk; i++)
+    g->y[i] /= DLCDM;
+}
+#endif
+
 //=================================================================
 // Compute sigma8 enhancement at z=0 relative to LCDM
 //=================================================================
@@ -676,20 +753,29 @@ double mg_sigma8_enhancement(double a){
   const double kmax = 100.0;
   const int npts    = 1000;
 
+  // The growth-factor for all k at once
+  double *k_arr = malloc(sizeof(double) * npts);
+  double *D_arr = malloc(sizeof(double) * npts);
+  for(int i = 0; i < npts; i++)
+    k_arr[i] = exp( log(kmin) + log(kmax/kmin) * i / (double)(npts-1) );
+  splinearray_lookup_fixed_time(&FirstOrderGrowthFactor_D, log(a), k_arr, D_arr, npts);
+  double DLCDM = spline_lookup(TimeDependentSplines.DLCDM_spline, log(a));
+
   double integrand      = 0.0;
   double integrand_LCDM = 0.0;
   double dlogk = log(kmax/kmin)/ (double)(npts-1);;
   for(int i = 0; i < npts; i++){
-    double know  = exp( log(kmin) + log(kmax/kmin) * i / (double)(npts-1) );
+    double know  = k_arr[i];
     double kR8   = know * 8.0;
     double w     = 3.0/(kR8*kR8*kR8) * (sin(kR8) - kR8 * cos(kR8));
-    double D     = interpolate_from_splinearray(&FirstOrderGrowthFactor_D,  know, log(a));
-    double DLCDM = spline_lookup(TimeDependentSplines.DLCDM_spline, log(a));
+    double D     = D_arr[i];
     double power = PowerSpec(know);
 
     integrand      += power * w * w * (D / DLCDM) * (D / DLCDM)   * know * know * know * dlogk / (2.0 * M_PI * M_PI);
     integrand_LCDM += power * w * w * know * know * know * dlogk / (2.0 * M_PI * M_PI);
   }
+  free(k_arr);
+  free(D_arr);
   integrand = sqrt(integrand);
   integrand_LCDM = sqrt(integrand_LCDM);
   return integrand / integrand_LCDM;
@@ -733,6 +819,78 @@ void integrate_scale_dependent_growth_ode(double *x_arr, double *d_arr, double *
   gsl_odeiv2_driver_free(ode_D);
 }
 
+//==============================================================================
+// Solve the scale-dependent growth ODEs for [nk] log-spaced k-values in [kmin,kmax]
+// The ODEs for different k are independent so we split the k-values over the
+// MPI tasks (and over the threads within a task if compiled with OpenMP) and 
+// gather the result on all tasks afterwards. The solution is stored in
+// [growth_table] as [ik][quantity][time] where quantity is one of
+// D, dDdy, ddDddy, D2, dD2dy, ddD2ddy
+//==============================================================================
+void solve_scale_dependent_growth_table(double *x_arr, double *growth_table, int npts, int nk, double kmin, double kmax){
+  const int nquantity = 6;
+  int *kstart = malloc(sizeof(int) * NTask);
+  int *kcount = malloc(sizeof(int) * NTask);
+  split_range_over_tasks(nk, kstart, kcount);
+
+  if(ThisTask == 0){
+    printf("Solving scale-dependent growth ODEs for %i k-values over %i tasks\n", nk, NTask);
+    fflush(stdout);
+  }
+
+  // Solve the growth ODEs for the values of k we are responsible for
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int k = kstart[ThisTask]; k < kstart[ThisTask] + kcount[ThisTask]; k++){
+    // Current value of k in h/Mpc
+    double know = exp( log(kmin) + log(kmax/kmin) * k / (double) (nk-1) );
+
+    double *D_arr       = &growth_table[(k * nquantity + 0) * npts];
+    double *dDdy_arr    = &growth_table[(k * nquantity + 1) * npts];
+    double *ddDddy_arr  = &growth_table[(k * nquantity + 2) * npts];
+    double *D2_arr      = &growth_table[(k * nquantity + 3) * npts];
+    double *dD2dy_arr   = &growth_table[(k * nquantity + 4) * npts];
+    double *ddD2ddy_arr = &growth_table[(k * nquantity + 5) * npts];
+    double *q_arr  = dDdy_arr;
+    double *q2_arr = dD2dy_arr;
+    
+    // IC for growing mode
+    D_arr[0]     = 1.0;
+    dDdy_arr[0]  = 1.0;
+    D2_arr[0]    = -3.0/7.0;
+    dD2dy_arr[0] = -6.0/7.0;
+    
+    // Integrate PDE
+    integrate_scale_dependent_growth_ode(x_arr, D_arr, q_arr, D2_arr, q2_arr, know, npts);
+    
+    // Set dDdy and ddDddy
+    for(int i = 0; i < npts; i++){
+      double anow    = exp(x_arr[i]);
+      double mu      = GeffoverG(anow, know);
+      dDdy_arr[i]    = q_arr[i] * Qfactor(anow) / anow;
+      ddDddy_arr[i]  = 1.5 * mu * Omega * anow * D_arr[i];
+      dD2dy_arr[i]   = q2_arr[i] * Qfactor(anow) / anow;
+      ddD2ddy_arr[i] = 1.5 * mu * Omega * anow * (D2_arr[i] - pow2(D_arr[i]) );
+    }
+  }
+
+  // Gather the solution from all tasks
+  int *recvcount = malloc(sizeof(int) * NTask);
+  int *displs    = malloc(sizeof(int) * NTask);
+  for(int i = 0; i < NTask; i++){
+    recvcount[i] = kcount[i] * nquantity * npts;
+    displs[i]    = kstart[i] * nquantity * npts;
+  }
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, growth_table, recvcount, displs, MPI_DOUBLE, MPI_COMM_WORLD);
+
+  // Free up memory
+  free(kstart);
+  free(kcount);
+  free(recvcount);
+  free(displs);
+}
+
 //==============================================================
 // Computes the scale-dependent growth-factor for all values
 // of k and stores it in SplineArray FirstOrderGrowthFactor_X
@@ -789,62 +947,68 @@ void calculate_scale_dependent_growth_factor(){
   SecondOrderGrowthFactor_ddDddy.splinearray = malloc(sizeof(Spline *) * nk);
   SecondOrderGrowthFactor_ddDddy.is_created = 1;
   
-  // Allocate memory
-  double *x_arr      = malloc(sizeof(double) * npts);
-  
-  double *D_arr      = malloc(sizeof(double) * npts);
-  double *dDdy_arr   = malloc(sizeof(double) * npts);
-  double *ddDddy_arr = malloc(sizeof(double) * npts);
-  double *q_arr = dDdy_arr;
-  
-  double *D2_arr      = malloc(sizeof(double) * npts);
-  double *dD2dy_arr   = malloc(sizeof(double) * npts);
-  double *ddD2ddy_arr = malloc(sizeof(double) * npts);
-  double *q2_arr = dD2dy_arr;
-
   // Define x-array to store values in
+  double *x_arr = malloc(sizeof(double) * npts);
   for(int i = 0; i < npts; i++)
     x_arr[i] = xini + (xend - xini) * i/(double) (npts-1);
 
-  // Solve the growth ODEs for each value of k
+  //==============================================================================
+  // The solution is stored in [growth_table] as [ik][quantity][time] where 
+  // quantity is one of D, dDdy, ddDddy, D2, dD2dy, ddD2ddy
+  //==============================================================================
+  const int nquantity = 6;
+  double *growth_table = NULL;
+  int table_is_cached = 0;
+
+  // Use the cached table if we have it
+#ifdef TABLE_CACHE
+  double cache_params[6] = {npts, nk, xini, xend, kmin, kmax};
+  unsigned long long cache_hash = table_cache_hash("scaledependent_growth_factors", cache_params, 6);
+  struct table_cache_map cache_map;
+  growth_table = table_cache_load("scaledependent_growth_factors", cache_hash, nquantity * npts * nk, &cache_map);
+  table_is_cached = (growth_table != NULL);
+#endif
+
+  if(!table_is_cached){
+    growth_table = malloc(sizeof(double) * nquantity * npts * nk);
+    solve_scale_dependent_growth_table(x_arr, growth_table, npts, nk, kmin, kmax);
+#ifdef TABLE_CACHE
+    table_cache_write("scaledependent_growth_factors", cache_hash, &growth_table, 1, nquantity * npts * nk);
+#endif
+  }
+
+  // Create splines
+  SplineArray *growth_splines[6] = {&FirstOrderGrowthFactor_D,  &FirstOrderGrowthFactor_dDdy,  &FirstOrderGrowthFactor_ddDddy,
+                                    &SecondOrderGrowthFactor_D, &SecondOrderGrowthFactor_dDdy, &SecondOrderGrowthFactor_ddDddy};
+#ifdef NODE_SHARED_TABLES
+  // The spline arrays (x, y, y'') are stored once per node as [ik][quantity][3*npts]
+  // The first task on the node makes the splines and the other tasks point to them
+  double *spline_storage = node_shared_malloc(sizeof(double) * 3 * npts * nquantity * nk);
+#endif
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
   for(int k = 0; k < nk; k++){
-    // Current value of k in h/Mpc
-    double know = exp( log(kmin) + log(kmax/kmin) * k / (double) (nk-1) );
-    
-    // IC for growing mode
-    D_arr[0]     = 1.0;
-    dDdy_arr[0]  = 1.0;
-    D2_arr[0]    = -3.0/7.0;
-    dD2dy_arr[0] = -6.0/7.0;
-    
-    // Integrate PDE
-    integrate_scale_dependent_growth_ode(x_arr, D_arr, q_arr, D2_arr, q2_arr, know, npts);
-    
-    // Set dDdy and ddDddy
-    for(int i = 0; i < npts; i++){
-      double anow    = exp(x_arr[i]);
-      double mu      = GeffoverG(anow, know);
-      dDdy_arr[i]    = q_arr[i] * Qfactor(anow) / anow;
-      ddDddy_arr[i]  = 1.5 * mu * Omega * anow * D_arr[i];
-      dD2dy_arr[i]   = q2_arr[i] * Qfactor(anow) / anow;
-      ddD2ddy_arr[i] = 1.5 * mu * Omega * anow * (D2_arr[i] - pow2(D_arr[i]) );
+    for(int q = 0; q < nquantity; q++){
+      double *y_arr = &growth_table[(k * nquantity + q) * npts];
+      growth_splines[q]->splinearray[k] = malloc(sizeof(Spline));
+#ifdef NODE_SHARED_TABLES
+      double *storage = &spline_storage[(k * nquantity + q) * 3 * npts];
+      if(NodeTask == 0)
+        create_spline_in_storage(growth_splines[q]->splinearray[k], x_arr, y_arr, npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE, storage);
+#else
+      create_spline(growth_splines[q]->splinearray[k], x_arr, y_arr, npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
+#endif
     }
-
-    // Create splines
-    FirstOrderGrowthFactor_D.splinearray[k]      = malloc(sizeof(Spline));
-    create_spline(FirstOrderGrowthFactor_D.splinearray[k],       x_arr, D_arr,       npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
-    FirstOrderGrowthFactor_dDdy.splinearray[k]   = malloc(sizeof(Spline));
-    create_spline(FirstOrderGrowthFactor_dDdy.splinearray[k],    x_arr, dDdy_arr,    npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
-    FirstOrderGrowthFactor_ddDddy.splinearray[k] = malloc(sizeof(Spline));
-    create_spline(FirstOrderGrowthFactor_ddDddy.splinearray[k],  x_arr, ddDddy_arr,  npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
-    
-    SecondOrderGrowthFactor_D.splinearray[k]      = malloc(sizeof(Spline));
-    create_spline(SecondOrderGrowthFactor_D.splinearray[k],      x_arr, D2_arr,      npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
-    SecondOrderGrowthFactor_dDdy.splinearray[k]   = malloc(sizeof(Spline));
-    create_spline(SecondOrderGrowthFactor_dDdy.splinearray[k],   x_arr, dD2dy_arr,   npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
-    SecondOrderGrowthFactor_ddDddy.splinearray[k] = malloc(sizeof(Spline));
-    create_spline(SecondOrderGrowthFactor_ddDddy.splinearray[k], x_arr, ddD2ddy_arr, npts, BC_NATURAL_SPLINE, BC_NATURAL_SPLINE, LINEAR_SPACED_SPLINE);
   }
+#ifdef NODE_SHARED_TABLES
+  node_shared_barrier();
+  if(NodeTask != 0){
+    for(int k = 0; k < nk; k++)
+      for(int q = 0; q < nquantity; q++)
+        attach_spline_to_storage(growth_splines[q]->splinearray[k], npts, LINEAR_SPACED_SPLINE, &spline_storage[(k * nquantity + q) * 3 * npts]);
+  }
+#endif
 
   // Output some info about the splines
   if(ThisTask == 0){
@@ -865,14 +1029,10 @@ void calculate_scale_dependent_growth_factor(){
 
   // Free up memory
   free(x_arr);
-
-  free(D_arr);
-  free(dDdy_arr);
-  free(ddDddy_arr);
-  
-  free(D2_arr);
-  free(dD2dy_arr);
-  free(ddD2ddy_arr);
+#ifdef TABLE_CACHE
+  if(table_is_cached) table_cache_close(&cache_map);
+#endif
+  if(!table_is_cached) free(growth_table);
 }
 
 //==================================================================================
@@ -904,6 +1064,36 @@ double growth_ddD2ddy_scaledependent(double k, double a){
            / interpolate_from_splinearray(&SecondOrderGrowthFactor_D,      k, log(GROWTH_NORMALIZATION_SCALE_FACTOR) ) );
 }
 
+//==================================================================================
+// The scale-dependent growth-factors above at a fixed time tabulated in the k-bins
+// of the splines. quantity = 0, 1, 2 gives D, dDdy, ddDddy to order LPTorder. Use
+// splinearray_lookup_at_fixed_time to get the values for many k. The normalization
+// is applied per k-bin so this agrees with growth_*_scaledependent to the accuracy
+// of the linear interpolation in k
+//==================================================================================
+void create_growth_scaledependent_at_fixed_time(int LPTorder, int quantity, double a, SplineArrayAtFixedTime *g){
+  SplineArray *f_norm = (LPTorder == 1 ? &FirstOrderGrowthFactor_D : &SecondOrderGrowthFactor_D);
+  SplineArray *f = NULL;
+  if(LPTorder == 1){
+    if(quantity == 0) f = &FirstOrderGrowthFactor_D;
+    if(quantity == 1) f = &FirstOrderGrowthFactor_dDdy;
+    if(quantity == 2) f = &FirstOrderGrowthFactor_ddDddy;
+  } else if(LPTorder == 2){
+    if(quantity == 0) f = &SecondOrderGrowthFactor_D;
+    if(quantity == 1) f = &SecondOrderGrowthFactor_dDdy;
+    if(quantity == 2) f = &SecondOrderGrowthFactor_ddDddy;
+  }
+  if(f == NULL){
+    printf("Error in create_growth_scaledependent_at_fixed_time: LPTorder = %i quantity = %i not supported\n", LPTorder, quantity);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+    exit(1);
+  }
+
+  create_splinearray_at_fixed_time(f, log(a), g);
+  for(int i = 0; i < g->nk; i++)
+    g->y[i] /= spline_lookup(f_norm->splinearray[i], log(GROWTH_NORMALIZATION_SCALE_FACTOR));
+}
+
 //=================================================================================
 // L(k1,k2,k) = L{ |k1|, |k2|, cos(theta) }
 // We use nk points in the k-directions + ncos points on the circle
@@ -960,7 +1150,6 @@ void solve_for_second_order_kernel(){
 
   // Loop over all combinations of |k1|, |k2|, |k| and phi(k,k1) 
   for(int ik = 0; ik < nk; ik++){
-    printf("Computing for i = %i / %i\n", ik, nk);
     double k = exp(log(kmin) + log(kmax/kmin) * ik / (double)(nk-1));
     for(int ik1 = 0; ik1 < nk; ik1++){
       double k1 = exp(log(kmin) + log(kmax/kmin) * ik1 / (double)(nk-1));
@@ -1030,13 +1219,6 @@ void solve_for_second_order_kernel(){
           g->ddD2ddy[i][index] = tmp_ddD2ddy[i];
         }
 
-        // For testing
-        if(ik==ik1 && (ic == (nphi-1)/2 || ic == 5 || ic == 50) ){
-          double xx = xini + deltax * (ipresent_time_low);
-          printf("cos = %f  Deff = %f    (%f)\n", costheta, tmp_D2[ipresent_time_low], 
-              interpolate_from_splinearray(&SecondOrderGrowthFactor_D, k, xx)*(1.0 - costheta*costheta));
-        }
-
         // Free up memory
         gsl_odeiv2_driver_free(ode_D2_kernel);
       }
@@ -0,0 +1,107 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+
+//==========================================================================//
+// This file contains the routines for storing large read-only tables once  //
+// per node instead of once per task. The memory is allocated with MPI-3    //
+// shared windows (MPI_Win_allocate_shared) on a communicator containing    //
+// the tasks on the same node. The first task on each node (NodeTask = 0)  //
+// owns the memory and all tasks on the node get a pointer to it           //
+//==========================================================================//
+
+#include "vars.h"
+#include "proto.h"
+
+#define NODE_SHARED_MAXWINDOWS 100
+
+static MPI_Win node_shared_windows[NODE_SHARED_MAXWINDOWS];
+static int     node_shared_nwindows = 0;
+
+//====================================================
+// Set up the communicator of tasks on the same node
+//====================================================
+void init_node_shared_memory(void){
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, ThisTask, MPI_INFO_NULL, &NodeComm);
+  MPI_Comm_rank(NodeComm, &NodeTask);
+  MPI_Comm_size(NodeComm, &NodeNTask);
+
+  int nnodes = (NodeTask == 0 ? 1 : 0);
+  MPI_Allreduce(MPI_IN_PLACE, &nnodes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  if(ThisTask == 0){
+    printf("Node-shared tables: %i tasks on %i node(s) (%i tasks on the node of task 0)\n", NTask, nnodes, NodeNTask);
+    fflush(stdout);
+  }
+}
+
+//====================================================
+// Allocate [nbytes] shared by all tasks on the node
+// This is collective over the tasks on the node. The
+// memory is zero-initialized. Only one task per node
+// should write to it (or tasks should write to
+// disjoint parts) followed by node_shared_barrier()
+//====================================================
+void *node_shared_malloc(size_t nbytes){
+  if(node_shared_nwindows == NODE_SHARED_MAXWINDOWS){
+    printf("Error: too many node-shared allocations (max %i)\n", NODE_SHARED_MAXWINDOWS);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+    exit(1);
+  }
+
+  MPI_Win win;
+  void *baseptr;
+  MPI_Aint size = (NodeTask == 0 ? (MPI_Aint) nbytes : 0);
+  int disp_unit = 1;
+  if(MPI_Win_allocate_shared(size, disp_unit, MPI_INFO_NULL, NodeComm, &baseptr, &win) != MPI_SUCCESS){
+    printf("Error: task %i failed to allocate %zu bytes of node-shared memory\n", ThisTask, nbytes);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+    exit(1);
+  }
+
+  // Get the address of the memory owned by the first task on the node
+  MPI_Win_shared_query(win, 0, &size, &disp_unit, &baseptr);
+  node_shared_windows[node_shared_nwindows++] = win;
+
+  if(NodeTask == 0) memset(baseptr, 0, nbytes);
+  node_shared_barrier();
+
+  return baseptr;
+}
+
+//====================================================
+// Make sure writes to node-shared memory are visible
+// to all tasks on the node
+//====================================================
+void node_shared_barrier(void){
+  MPI_Barrier(NodeComm);
+}
+
+//====================================================
+// Free all node-shared memory and the communicator
+//====================================================
+void free_node_shared_memory(void){
+  for(int i = 0; i < node_shared_nwindows; i++)
+    MPI_Win_free(&node_shared_windows[i]);
+  node_shared_nwindows = 0;
+  MPI_Comm_free(&NodeComm);
+}
@@ -0,0 +1,65 @@
+#ifndef INCLUDEPHILOX
+#define INCLUDEPHILOX
+
+//==========================================================================//
+//                                                                          //
+// MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017            //
+//                                                                          //
+// The counter-based random number generator Philox4x32-10 (Salmon et al.  //
+// 2011). The random numbers are a function of a counter and a key only,   //
+// so the random numbers for a mode (i,j,k) can be computed directly on    //
+// any task or thread without a seedtable or a sequential stream           //
+//                                                                          //
+//==========================================================================//
+
+#include <stdint.h>
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+
+static inline void philox4x32_10(uint32_t *ctr, uint32_t *key, uint32_t *out){
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for(int round = 0; round < 10; round++){
+    uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+    uint32_t hi0 = (uint32_t) (p0 >> 32), lo0 = (uint32_t) p0;
+    uint32_t hi1 = (uint32_t) (p1 >> 32), lo1 = (uint32_t) p1;
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+//====================================================
+// The random phase in [0, 2pi) and amplitude in (0,1]
+// of the mode (i,j,k) in the IC for the given seed
+//====================================================
+static inline void philox_random_mode(unsigned int seed, int i, int j, int k, double *phase, double *ampl){
+  uint32_t ctr[4] = {(uint32_t) k, (uint32_t) j, (uint32_t) i, 0};
+  uint32_t key[2] = {(uint32_t) seed, 0x5049434FU};
+  uint32_t out[4];
+  philox4x32_10(ctr, key, out);
+
+  // 53 random bits for each of the two numbers
+  uint64_t r0 = (((uint64_t) out[0] << 32) | out[1]) >> 11;
+  uint64_t r1 = (((uint64_t) out[2] << 32) | out[3]) >> 11;
+  *phase = r0 * (1.0 / 9007199254740992.0) * 2.0 * M_PI;
+  *ampl  = (r1 + 1) * (1.0 / 9007199254740992.0);
+}
+
+#undef PHILOX_M0
+#undef PHILOX_M1
+#undef PHILOX_W0
+#undef PHILOX_W1
+
+#endif
@@ -33,8 +33,20 @@
 
 void Output_Info(double A);
 void Output(double A, double AF, double AFF, double Dv, double Dv2);
+#ifdef MPIIO_OUTPUT
+void Output_MPIIO(double A, double Dv, double Dv2);
+int output_file_of_task(int i);
+#endif
 void Kick(double AI, double AF, double A, double Di);
 void Drift(double A, double AFF, double AF, double Di, double Di2);
+#ifdef TWIN_RUN
+void twin_run_init(void);
+void twin_run_select(int twin);
+#endif
+#if defined(COMPRESSED_OUTPUT) || defined(SUBSAMPLE_OUTPUT) || (defined(FOF_HALOS) && (defined(PARTICLE_ID) || defined(SCALEDEPENDENT)))
+void lagrangian_id_prepare(void);
+unsigned long long lagrangian_id(unsigned int n);
+#endif
 
 //===================================================
 // Modified gravity routines mg.h
@@ -53,11 +65,14 @@ double screening_factor_potential(double a, double phinewton);
 double screening_factor_density(double a, double density);
 double screening_function_gradient(double a, double DPhi2);
 void   DivideByLaplacian(complex_kind *densityk, complex_kind *phinewtonk);
-void   Density_to_DPhiNewtonk(complex_kind *densityk, complex_kind *DPhi_i, int axes);
+void   Density_to_DPhiNewtonk_batched(complex_kind *densityk, complex_kind *DPhi);
 void   EffDensitykToPhiofk(complex_kind* P3D_densityeffk, complex_kind *P3D_phik);
 void   ComputeFifthForce();
 void   ComputeFifthForceDGP();
 void   SmoothDensityField(complex_kind *densityk, complex_kind *densityk_smooth, double Rsmooth);
+void   apply_screening_factor(float_kind *out, float_kind *in, float_kind *x, int n, double factor, 
+                              double (*screening_function)(double, double), double sign, double shift, double ymin, double ymax,
+                              double *minscreen, double *maxscreen, double *avgscreen);
 void   CopyDensityArray();
 void   AllocateMGArrays();
 void   FreeMGArrays();
@@ -69,6 +84,7 @@ void   FreeMGArrays();
 
 void   solve_for_growth_factors();
 void   free_up_splines();
+void   split_range_over_tasks(int n, int *start, int *count);
 
 // Growth factor splines
 double growth_D(double a);
@@ -136,6 +152,7 @@ void   init_modified_version();
 void  integrate_first_order_scale_dependent_growth_ode(double *x_arr, double *d_arr, double *q_arr, double know, int npts);
 void  integrate_second_order_scale_dependent_growth_ode(double *x_arr, double *d_arr, double *q_arr, struct ode_second_order_growth_parameters *ode_D2_params, int npts);
 void   calculate_scale_dependent_growth_factor();
+void   solve_scale_dependent_growth_table(double *x_arr, double *growth_table, int npts, int nk, double kmin, double kmax);
 
 double growth_D_scaledependent(double k, double a);
 double growth_dDdy_scaledependent(double k, double a);
@@ -144,6 +161,8 @@ double growth_ddDddy_scaledependent(double k, double a);
 double growth_D2_scaledependent(double k, double a);
 double growth_dD2dy_scaledependent(double k, double a);
 double growth_ddD2ddy_scaledependent(double k, double a);
+void   create_growth_scaledependent_at_fixed_time(int LPTorder, int quantity, double a, SplineArrayAtFixedTime *g);
+void   create_mg_growth_ratio_at_fixed_time(double a, SplineArrayAtFixedTime *g);
 
 // 2LPT
 void store_initial_displacement_field(complex_kind *(cdisp[3]), complex_kind *(cdisp2[3]));
@@ -178,6 +197,10 @@ double funSphiStd(double a, void * params);
 double Sphi(double ai,double af,double aRef);
 double CosmoTimeFun (double a, void * params);
 double GrowthFactor(double astart, double aend);
+void   init_time_integral_splines();
+void   free_time_integral_splines();
+int    time_integral_table_covers(double ai, double af);
+double integrate_cosmo_integrand(double (*integrand)(double, void *), double ai, double af);
 
 //===================================================
 // auxPM.c
@@ -185,6 +208,12 @@ double GrowthFactor(double astart, double aend);
 
 void Forces(void);
 void PtoMesh(void);
+void DensityFromParticles(void);
+void CICDeposit(float_kind *grid, int ngrid, int nzpad, int x_start, double weight);
+#ifdef COMPUTE_POFK
+void compute_power_spectrum(complex_kind *P3D, double A);
+void compute_redshift_space_multipoles(double A, double Dv, double Dv2, int use_2lpt_step);
+#endif
 void MtoParticles(void);
 void MoveParticles(void);
 void GetDisplacements(void);
@@ -211,6 +240,90 @@ int sort_redshift(const void * Item1, const void * Item2);
 
 #ifdef GENERIC_FNL
 void read_kernel_table(void);
+void group_kernel_table(void);
+#endif
+
+//===================================================
+// table_cache.c
+//===================================================
+
+#ifdef TABLE_CACHE
+struct table_cache_map {
+  void *addr;
+  size_t nbytes;
+};
+unsigned long long table_cache_hash_bytes(unsigned long long hash, const void *data, size_t nbytes);
+unsigned long long table_cache_hash(char *tablename, double *params, int nparams);
+void   table_cache_filename(char *filename, char *tablename, unsigned long long hash);
+double *table_cache_load(char *tablename, unsigned long long hash, size_t ndata, struct table_cache_map *map);
+void   table_cache_close(struct table_cache_map *map);
+void   table_cache_write(char *tablename, unsigned long long hash, double **blocks, int nblocks, size_t blocksize);
+int    ic_cache_load(void);
+void   ic_cache_write(void);
+#endif
+
+//===================================================
+// multigrid.c
+//===================================================
+
+#ifdef MULTIGRID_SOLVER
+int    multigrid_solve_this_step(void);
+int    ComputeFifthForce_Multigrid(void);
+void   free_multigrid_solution(void);
+#endif
+
+//===================================================
+// node_shared.c
+//===================================================
+
+#ifdef NODE_SHARED_TABLES
+void   init_node_shared_memory(void);
+void  *node_shared_malloc(size_t nbytes);
+void   node_shared_barrier(void);
+void   free_node_shared_memory(void);
+#endif
+
+//===================================================
+// async_output.c
+//===================================================
+
+#ifdef ASYNC_OUTPUT
+void   async_output_init(int mpi_thread_level);
+FILE  *async_output_fopen(char *filename, size_t bytes);
+void   async_output_fclose(FILE *fp);
+void   async_output_finalize(void);
+#endif
+
+//===================================================
+// compressed_output.c
+//===================================================
+
+#ifdef COMPRESSED_OUTPUT
+void   write_compressed_particles(FILE *fp, double A, double Dv, double Dv2, int use_2lpt_step);
+size_t compress_particle_block(unsigned long long *id, float *pos, float *vel, int npart, int nsample, 
+    double boxsize, double pos_tolerance, double vel_tolerance, unsigned char *out);
+#endif
+
+//===================================================
+// reduced_output.c
+//===================================================
+
+#if defined(SUBSAMPLE_OUTPUT) || defined(DENSITY_GRID_OUTPUT) || defined(FOF_HALOS)
+int    write_full_snapshot(double A);
+#endif
+#ifdef SUBSAMPLE_OUTPUT
+void   write_subsample_particles(double A, double Dv, double Dv2, int use_2lpt_step);
+#endif
+#ifdef DENSITY_GRID_OUTPUT
+void   write_density_grid(double A);
+#endif
+
+//===================================================
+// fof.c
+//===================================================
+
+#ifdef FOF_HALOS
+void   fof_find_halos(double A, double Dv, double Dv2, int use_2lpt_step);
 #endif
 
 //===================================================
@@ -234,6 +347,8 @@ void set_units(void);
 void initialize_ffts(void);
 void initialize_parts(void);
 void displacement_fields(void);
+void mg_rescale_displacement_fields(void);
+void report_peak_memory(char *where);
 
 //===================================================
 // power.c
@@ -271,6 +386,9 @@ void check_complexgrid(complex_kind *grid, char *desc);
 
 void ReadFilesMakeDisplacementField(void);
 int  ProcessParticlesSingleFile(char *buffer, int npart_loc);
+#ifdef PARALLEL_PARTICLE_READ
+int  ExchangeAndProcessParticles(char *buffer, int npart_loc);
+#endif
 void AssignDisplacementField(complex_kind *(cdisp[3]));
 
 int  read_int(FILE* fp);
@@ -278,18 +396,16 @@ void read_float_vec(FILE* fp, float *buffer, int n);
 void read_int_vec(FILE* fp, int *buffer, int n);
 void read_double_vec(FILE* fp, double *buffer, int n);
 
-int find_maxpart_ramsesfiles(char *filebase, int outnumber, int nfiles);
-int find_maxpart_asciifiles(char *outputdir, char *fileprefix, int nfiles);
-int find_maxpart_gadgetfiles(char *outputdir, char *fileprefix, int nfiles);
-
-int read_ramses_file(char *filebase, int outnumber, int filenum, char *buffer, int *npart_read);
-int read_ascii_file(char *filedir, char *fileprefix, int filenum, char *buffer, int *npart_read);
-int read_gadget_file(char *filedir, char *fileprefix, int filenum, char *buffer, int *npart_read);
+struct ParticleFile;
+void open_particle_file(struct ParticleFile *pf, int filenum);
+int  read_particle_chunk(struct ParticleFile *pf, char *buffer);
+void close_particle_file(struct ParticleFile *pf);
 
 void read_ramses_header(FILE *fp);
 void read_gadget_header(FILE *fp);
 
 void write_gadget_header(FILE *fp, double A);
+void set_gadget_header(double A, unsigned long long npart_file, int num_files);
 
 #ifdef SCALEDEPENDENT
 int    ode_second_order_growth_kernel_D2(double x, const double D2[], double dD2dy[], void *params);
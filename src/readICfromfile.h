@@ -19,6 +19,10 @@
 //
 // Activated if ReadParticlesFromFile == 1
 //
+// With PARALLEL_PARTICLE_READ each task reads only every NTask'th file
+// and the particles are sent to the task owning their slice (MPI_Alltoallv)
+// Otherwise all tasks read all the files
+//
 // -----------------------------------------------------------------
 // For the parameter file we need to add:
 // -----------------------------------------------------------------
@@ -207,96 +211,193 @@ void check_complexgrid(complex_kind *grid, char *desc){
 }
 
 //==================================================================
-// This routine reads a single particle file and bins the particles to the [density] grid
-// Assuming we have allocated the [density] grid and initialized it to [-1] at the start
-// npart_loc is the number of particles in the buffer and the format of the buffer is
-// [x1 x2 .. y1 y2 .. z1 z2 ..]
-// Returns how many particles in the current slice there were in this file
+// Fetch the position in [0,1] of particle [i] in a read buffer
+// For GADGET the format is [x1 y1 z1 x2 y2 z2 ..] (floats) and
+// for RAMSES and ASCII [x1 x2 .. y1 y2 .. z1 z2 ..] (doubles)
 //==================================================================
-int ProcessParticlesSingleFile(char *buffer, int npart_loc) {
-  unsigned int i;
+static inline void fetch_particle_position(char *buffer, int npart_loc, int i, double *x){
+  if(TypeInputParticleFiles == GADGETFILE){
+    float *pos_flt = (float *) buffer;
+    x[0] = (double) pos_flt[3*i];
+    x[1] = (double) pos_flt[3*i + 1];
+    x[2] = (double) pos_flt[3*i + 2];
+  } else {
+    double *pos = (double *) buffer;
+    x[0] = pos[i];
+    x[1] = pos[i + 1*npart_loc];
+    x[2] = pos[i + 2*npart_loc];
+  }
+}
+
+//==================================================================
+// CIC assign a particle with position X,Y,Z in [0,1] to the [density] grid
+// The particle must be in the slice belonging to this CPU
+//==================================================================
+static inline void cic_assign_particle_to_density(double X, double Y, double Z, double WPAR){
   unsigned int IX,IY,IZ;
   int IXneigh,IYneigh,IZneigh;
-  double X,Y,Z;
   double TX,TY,TZ;
   double DX,DY,DZ;
   double scaleBox=(double)Nmesh;
+
+  // Scale particles such that they are in [0, Nmesh]
+  X *= scaleBox;
+  Y *= scaleBox;
+  Z *= scaleBox;
+
+  IX=(unsigned int)X;
+  IY=(unsigned int)Y;
+  IZ=(unsigned int)Z;
+  DX=X-(double)IX;
+  DY=Y-(double)IY;
+  DZ=Z-(double)IZ;
+  TX=1.0-DX;
+  TY=1.0-DY;
+  TZ=1.0-DZ;
+
+  DY *= WPAR;
+  TY *= WPAR;
+
+  IX -= Local_x_start;
+  if(IY >= (unsigned int)Nmesh) IY=0;
+  if(IZ >= (unsigned int)Nmesh) IZ=0;
+
+  IXneigh=IX+1;
+  IYneigh=IY+1;
+  IZneigh=IZ+1;
+  if(IYneigh >= (unsigned int)Nmesh) IYneigh=0;
+  if(IZneigh >= (unsigned int)Nmesh) IZneigh=0;
+
+  density[(IX      * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZ     ] += TX * TY * TZ;
+  density[(IX      * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZneigh] += TX * TY * DZ;
+  density[(IX      * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZ     ] += TX * DY * TZ;
+  density[(IX      * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZneigh] += TX * DY * DZ;
+  density[(IXneigh * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZ     ] += DX * TY * TZ;
+  density[(IXneigh * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZneigh] += DX * TY * DZ;
+  density[(IXneigh * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZ     ] += DX * DY * TZ;
+  density[(IXneigh * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZneigh] += DX * DY * DZ;
+}
+
+//==================================================================
+// This routine reads a single particle file and bins the particles to the [density] grid
+// Assuming we have allocated the [density] grid and initialized it to [-1] at the start
+// npart_loc is the number of particles in the buffer and the format of the buffer is
+// given in fetch_particle_position
+// Returns how many particles in the current slice there were in this file
+//==================================================================
+int ProcessParticlesSingleFile(char *buffer, int npart_loc) {
+  double x[3];
   double WPAR=pow((double)Nmesh/(double)Nsample,3);
   int npart_processed = 0;
-  float *pos_flt = (float *) buffer;
-  double *pos = (double *) buffer;
 
   // Loop over all particles and CIC add to grid
-  for(i = 0; i < npart_loc; i++) {
-
-    // Fetch X in [0,1]
-    if(TypeInputParticleFiles == 3){
-      // Gadget
-      X = (double) pos_flt[3*i];
-    } else {
-      // Ramses and ascii
-      X = pos[i]; 
-    }
+  for(int i = 0; i < npart_loc; i++) {
+    fetch_particle_position(buffer, npart_loc, i, x);
     
     // We must only process particles that are in the slice belonging to this CPU
-    int IXX = (int)(X * scaleBox) - (int)(Local_x_start);
+    int IXX = (int)(x[0] * (double)Nmesh) - (int)(Local_x_start);
     if( IXX >= Local_nx || IXX < 0 )
       continue;
-   
-    // Fetch Y and Z
-    if(TypeInputParticleFiles == 3){
-      // Gadget
-      Y = (double) pos_flt[3*i + 1];
-      Z = (double) pos_flt[3*i + 2];
-    } else {
-      // Ramses and ascii
-      Y = pos[i + 1*npart_loc];
-      Z = pos[i + 2*npart_loc];
-    }
 
     // Increase counter
     npart_processed++;
 
-    // Scale particles such that they are in [0, Nmesh]
-    X *= scaleBox;
-    Y *= scaleBox;
-    Z *= scaleBox;
-
-    IX=(unsigned int)X;
-    IY=(unsigned int)Y;
-    IZ=(unsigned int)Z;
-    DX=X-(double)IX;
-    DY=Y-(double)IY;
-    DZ=Z-(double)IZ;
-    TX=1.0-DX;
-    TY=1.0-DY;
-    TZ=1.0-DZ;
-
-    DY *= WPAR;
-    TY *= WPAR;
-
-    IX -= Local_x_start;
-    if(IY >= (unsigned int)Nmesh) IY=0;
-    if(IZ >= (unsigned int)Nmesh) IZ=0;
-
-    IXneigh=IX+1;
-    IYneigh=IY+1;
-    IZneigh=IZ+1;
-    if(IYneigh >= (unsigned int)Nmesh) IYneigh=0;
-    if(IZneigh >= (unsigned int)Nmesh) IZneigh=0;
-
-    density[(IX      * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZ     ] += TX * TY * TZ;
-    density[(IX      * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZneigh] += TX * TY * DZ;
-    density[(IX      * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZ     ] += TX * DY * TZ;
-    density[(IX      * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZneigh] += TX * DY * DZ;
-    density[(IXneigh * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZ     ] += DX * TY * TZ;
-    density[(IXneigh * Nmesh+IY     ) * 2*(Nmesh/2 + 1) + IZneigh] += DX * TY * DZ;
-    density[(IXneigh * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZ     ] += DX * DY * TZ;
-    density[(IXneigh * Nmesh+IYneigh) * 2*(Nmesh/2 + 1) + IZneigh] += DX * DY * DZ;
+    cic_assign_particle_to_density(x[0], x[1], x[2], WPAR);
+  }
+
+  return npart_processed;
+}
+
+#ifdef PARALLEL_PARTICLE_READ
+//==================================================================
+// The particle files are distributed round-robin over the tasks:
+// file [filenum] (counting from 1) is read by task (filenum-1) % NTask
+//==================================================================
+static inline int particle_file_is_read_by_this_task(int filenum){
+  return (filenum - 1) % NTask == ThisTask;
+}
+
+//==================================================================
+// Wrap a position periodically into [0,1) so that the slice we 
+// route the particle to is the one cic_assign_particle_to_density
+// deposits it in. Values that round up to the edge of the grid 
+// are also wrapped to 0
+//==================================================================
+static inline void wrap_particle_position(double *x){
+  for(int axes = 0; axes < 3; axes++){
+    x[axes] -= floor(x[axes]);
+    if(x[axes] * (double)Nmesh >= (double)Nmesh) x[axes] = 0.0;
+  }
+}
+
+//==================================================================
+// Send the particles in the read buffer to the task that owns their slice
+// and bin the particles we receive to the [density] grid. All tasks must
+// call this (with npart_loc = 0 if they did not read a file)
+// Returns how many particles were binned on this task
+//==================================================================
+int ExchangeAndProcessParticles(char *buffer, int npart_loc) {
+  double x[3];
+  double WPAR=pow((double)Nmesh/(double)Nsample,3);
+  int *send_count  = calloc(NTask, sizeof(int));
+  int *send_offset = malloc(sizeof(int) * NTask);
+  int *recv_count  = malloc(sizeof(int) * NTask);
+  int *recv_offset = malloc(sizeof(int) * NTask);
+  int *dest        = malloc(sizeof(int) * npart_loc);
+
+  // Find the task owning the slice of each particle
+  for(int i = 0; i < npart_loc; i++) {
+    fetch_particle_position(buffer, npart_loc, i, x);
+    wrap_particle_position(x);
+    int slab = (int)(x[0] * (double)Nmesh);
+    if(slab >= Nmesh) slab = Nmesh - 1;
+    if(slab < 0) slab = 0;
+    dest[i] = Slab_to_task[slab];
+    send_count[dest[i]] += 3;
+  }
+
+  ierr = MPI_Alltoall(send_count, 1, MPI_INT, recv_count, 1, MPI_INT, MPI_COMM_WORLD);
+
+  int nsend = 0, nrecv = 0;
+  for(int i = 0; i < NTask; i++) {
+    send_offset[i] = nsend;
+    recv_offset[i] = nrecv;
+    nsend += send_count[i];
+    nrecv += recv_count[i];
+  }
+
+  // Pack the positions as [x1 y1 z1 x2 y2 z2 ...] ordered by destination
+  double *sendbuf = malloc(sizeof(double) * nsend);
+  double *recvbuf = malloc(sizeof(double) * nrecv);
+  for(int i = 0; i < NTask; i++) send_count[i] = 0;
+  for(int i = 0; i < npart_loc; i++) {
+    fetch_particle_position(buffer, npart_loc, i, x);
+    wrap_particle_position(x);
+    int ind = send_offset[dest[i]] + send_count[dest[i]];
+    sendbuf[ind]     = x[0];
+    sendbuf[ind + 1] = x[1];
+    sendbuf[ind + 2] = x[2];
+    send_count[dest[i]] += 3;
   }
 
+  ierr = MPI_Alltoallv(sendbuf, send_count, send_offset, MPI_DOUBLE, recvbuf, recv_count, recv_offset, MPI_DOUBLE, MPI_COMM_WORLD);
+
+  // All the particles we received are in our slice
+  int npart_processed = nrecv / 3;
+  for(int i = 0; i < npart_processed; i++)
+    cic_assign_particle_to_density(recvbuf[3*i], recvbuf[3*i + 1], recvbuf[3*i + 2], WPAR);
+
+  free(recvbuf);
+  free(sendbuf);
+  free(dest);
+  free(recv_offset);
+  free(recv_count);
+  free(send_offset);
+  free(send_count);
+
   return npart_processed;
 }
+#endif
 
 //==================================================================
 // Binary read methods. Read a single int
@@ -394,214 +495,241 @@ void read_gadget_header(FILE *fp){
 }
 
 //==================================================================
-// Read the header of all RAMSES particles files and
-// determine the maximum particle number in them
-// which we use to allocate the read buffer
-//==================================================================
-int find_maxpart_ramsesfiles(char *outputdir, int outnumber, int nfiles){
-  int maxpart = 0;
-  for(int i = 1; i <= nfiles; i++){
-    FILE *fp;
-    char filename[200];
-    sprintf(filename, "%s/part_%05i.out%05i", outputdir, outnumber, i);
-    if( (fp = fopen(filename,"r")) == NULL){
-      printf("Error: cannot open file [%s]\n", filename);
-      MPI_Abort(MPI_COMM_WORLD, 1);
-      exit(1);
-    }
-
-    // Read header
-    read_ramses_header(fp);
-    int npart_loc = ramses_header.npart;
+// The particle files are streamed in chunks of PARTICLE_READ_CHUNK_BYTES
+// (16 MB) so the memory needed does not depend on the size of the files
+// The buffer format of a chunk is given in fetch_particle_position
+//==================================================================
+#define PARTICLE_READ_CHUNK_BYTES (16*1024*1024)
+#define PARTICLE_READ_CHUNK       ((int)(PARTICLE_READ_CHUNK_BYTES / (3*sizeof(double))))
 
-    if(npart_loc > maxpart) maxpart = npart_loc;
+#define ASCII_READ_BLOCK_BYTES    (4*1024*1024)
+#define ASCII_MAX_TOKEN_LENGTH    256
 
-    fclose(fp);
-  }
-  return maxpart;
-}
+struct ParticleFile{
+  FILE *fp;
+  char filename[200];
+  int npart;          // The number of particles in the file
+  int nread;          // The number of particles read so far
+  long pos_start;     // Offset of the first position in the file (RAMSES and GADGET)
+  double normfac;     // Factor to bring the positions to [0,1] (GADGET)
+  char *text;         // Block of the file we parse (ASCII)
+  size_t textlen;     // Number of characters in the block
+  size_t textpos;     // Current position in the block
+  int eof;            // Have we read the whole file into the block
+};
 
 //==================================================================
-// Read the first line of all ascii particles files and
-// determine the maximum particle number in them
-// which we use to allocate the read buffer
-//==================================================================
-int find_maxpart_asciifiles(char *outputdir, char *fileprefix, int nfiles){
-  int maxpart = 0;
-  for(int i = 1; i <= nfiles; i++){
-    FILE *fp;
-    char filename[200];
-    sprintf(filename, "%s/%s.%i", outputdir, fileprefix, i);
-    if( (fp = fopen(filename,"r")) == NULL){
-      printf("Error: cannot open file [%s]\n", filename);
-      MPI_Abort(MPI_COMM_WORLD, 1);
-      exit(1);
+// Parse a decimal number [-]ddd.ddd[e[+-]dd] without strtod. When the
+// digits fit in a mantissa <= 2^53 and |exponent| <= 22 both are exact
+// doubles and the one multiplication (division) rounds correctly. For
+// longer mantissas or larger exponents we fall back to strtod
+//==================================================================
+static inline double parse_double_fast(const char *str, const char **end){
+  static const double pow10_table[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *c = str;
+  unsigned long long mantissa = 0;
+  int ndigits = 0, exp10 = 0, negative = 0, truncated = 0;
+
+  if(*c == '-' || *c == '+') negative = (*c++ == '-');
+  for(; *c >= '0' && *c <= '9'; c++){
+    if(ndigits < 19){
+      mantissa = 10 * mantissa + (*c - '0');
+      if(mantissa > 0) ndigits++;
+    } else {
+      exp10++;
+      truncated = 1;
     }
+  }
+  if(*c == '.'){
+    for(c++; *c >= '0' && *c <= '9'; c++){
+      if(ndigits < 19){
+        mantissa = 10 * mantissa + (*c - '0');
+        if(mantissa > 0) ndigits++;
+        exp10--;
+      } else {
+        truncated = 1;
+      }
+    }
+  }
+  if(*c == 'e' || *c == 'E'){
+    int expsign = 1, expval = 0;
+    c++;
+    if(*c == '-' || *c == '+') expsign = (*c++ == '-') ? -1 : 1;
+    for(; *c >= '0' && *c <= '9'; c++) expval = 10 * expval + (*c - '0');
+    exp10 += expsign * expval;
+  }
+  *end = c;
 
-    // Read header
-    int npart_loc;
-    fscanf(fp, "%i\n", &npart_loc);
-
-    if(npart_loc > maxpart) maxpart = npart_loc;
-
-    fclose(fp);
+  if(truncated || mantissa > (1ULL << 53) || exp10 > 22 || exp10 < -22){
+    char *strtod_end;
+    double value = strtod(str, &strtod_end);
+    *end = strtod_end;
+    return value;
   }
-  return maxpart;
+
+  double value = (double) mantissa;
+  if(exp10 >= 0) value *= pow10_table[exp10];
+  else           value /= pow10_table[-exp10];
+  return negative ? -value : value;
 }
 
 //==================================================================
-// Read the header of all gadget particles files and
-// determine the maximum particle number in them
-// which we use to allocate the read buffer
-//==================================================================
-int find_maxpart_gadgetfiles(char *outputdir, char *fileprefix, int nfiles){
-  int maxpart = 0;
-  for(int i = 0; i < nfiles; i++){
-    FILE *fp;
-    char filename[200];
-    sprintf(filename, "%s/%s.%i", outputdir, fileprefix, i);
-    if( (fp = fopen(filename,"r")) == NULL){
-      printf("Error: cannot open file [%s]\n", filename);
-      MPI_Abort(MPI_COMM_WORLD, 1);
-      exit(1);
-    }
-
-    // Read header
-    read_gadget_header(fp);
-    int npart_loc = gadget_header.npart[1];
-
-    if(npart_loc > maxpart) maxpart = npart_loc;
+// Move the unparsed part of the ASCII block to the start and fill the rest from the file
+//==================================================================
+static void ascii_refill_block(struct ParticleFile *pf){
+  size_t nleft = pf->textlen - pf->textpos;
+  memmove(pf->text, pf->text + pf->textpos, nleft);
+  size_t nnew = fread(pf->text + nleft, 1, ASCII_READ_BLOCK_BYTES - nleft, pf->fp);
+  if(nnew < ASCII_READ_BLOCK_BYTES - nleft) pf->eof = 1;
+  pf->textlen = nleft + nnew;
+  pf->textpos = 0;
+  pf->text[pf->textlen] = '\0';
+}
 
-    fclose(fp);
+//==================================================================
+// Read the next number in an ASCII file. Returns 0 if there are no more numbers
+//==================================================================
+static int ascii_next_double(struct ParticleFile *pf, double *value){
+  for(;;){
+    // Make sure a whole number is in the block before we parse it
+    if(! pf->eof && pf->textlen - pf->textpos < ASCII_MAX_TOKEN_LENGTH) ascii_refill_block(pf);
+
+    char *c = pf->text + pf->textpos;
+    while(*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r') c++;
+    pf->textpos = c - pf->text;
+    if(*c == '\0') return 0;
+    if(pf->textlen - pf->textpos < ASCII_MAX_TOKEN_LENGTH && ! pf->eof) continue;
+
+    const char *end;
+    *value = parse_double_fast(c, &end);
+    if(end == c) return 0;
+    pf->textpos = end - pf->text;
+    return 1;
   }
-  return maxpart;
 }
 
 //==================================================================
-// Reads a single RAMSES file and stores the particle positions in [buffer]
-// Updates [npart_read] with how many particles it was in this file [npart_loc] and returns this
+// Open particle file number [filenum] (counting from 1) and read the header
+// RAMSES: /filedir/part_0000X.out0000[filenum]
+// ASCII:  /filedir/fileprefix.[filenum] with format [numpart; X1 Y1 Z1 mass; X2 Y2 Z2 mass; ...]
+//         with positions in [0,1]. Mass not used.
+// GADGET: /filedir/fileprefix.[filenum-1] (GADGET1 format)
 //==================================================================
-int read_ramses_file(char *filedir, int outnumber, int filenum, char *buffer, int *npart_read){
-  FILE *fp;
-  char filename[200];
-  double *buffer_dbl = (double *) buffer;
+void open_particle_file(struct ParticleFile *pf, int filenum){
+  if(TypeInputParticleFiles == RAMSESFILE){
+    sprintf(pf->filename, "%s/part_%05i.out%05i", InputParticleFileDir, RamsesOutputNumber, filenum);
+  } else if(TypeInputParticleFiles == ASCIIFILE){
+    sprintf(pf->filename, "%s/%s.%i", InputParticleFileDir, InputParticleFilePrefix, filenum);
+  } else {
+    sprintf(pf->filename, "%s/%s.%i", InputParticleFileDir, InputParticleFilePrefix, filenum - 1);
+  }
 
-  // Make filename and open in
-  sprintf(filename, "%s/part_%05i.out%05i", filedir, outnumber, filenum);
-  if( (fp = fopen(filename,"r")) == NULL){
-    printf("Error: cannot open file [%s]\n", filename);
+  if( (pf->fp = fopen(pf->filename,"r")) == NULL){
+    printf("Error: cannot open file [%s]\n", pf->filename);
     MPI_Abort(MPI_COMM_WORLD, 1);
     exit(1);
   }
 
-  // Read header
-  read_ramses_header(fp);
-  int npart_loc = ramses_header.npart;
-
-  // Read particle positions (Buffer Format: [x1 x2 ... xn y1 y2 ... yn z1 z2 ... zn] )
-  read_double_vec(fp, &buffer_dbl[0*npart_loc], npart_loc);
-  read_double_vec(fp, &buffer_dbl[1*npart_loc], npart_loc);
-  read_double_vec(fp, &buffer_dbl[2*npart_loc], npart_loc);
-
-  // Make sure all positions are in [0,1]
-  for(int i = 0; i < 3*npart_loc; i++)
-    if(buffer_dbl[i] >= 1.0) buffer_dbl[i] -= 1.0;
+  // Read header. The positions start after the record marker
+  pf->nread = 0;
+  pf->normfac = 1.0;
+  if(TypeInputParticleFiles == RAMSESFILE){
+    read_ramses_header(pf->fp);
+    pf->npart = ramses_header.npart;
+    pf->pos_start = ftell(pf->fp) + sizeof(int);
+  } else if(TypeInputParticleFiles == ASCIIFILE){
+    double npart_dbl = 0.0;
+    pf->text    = malloc(ASCII_READ_BLOCK_BYTES + 1);
+    pf->textlen = pf->textpos = 0;
+    pf->eof     = 0;
+    ascii_next_double(pf, &npart_dbl);
+    pf->npart = (int) npart_dbl;
+  } else {
+    read_gadget_header(pf->fp);
+    pf->npart = gadget_header.npart[1];
+    pf->normfac = 1.0 / gadget_header.BoxSize;
+    pf->pos_start = ftell(pf->fp) + sizeof(int);
+  }
 
   if(ThisTask == 0) {
-    printf("# Reading RAMSES file: %s\n", filename);
-    printf("First particle X: [%f]  Y: [%f]  Z: [%f]\n", buffer_dbl[0], buffer_dbl[0+npart_loc], buffer_dbl[0+2*npart_loc]);
+    printf("# Reading file: %s  Npart: %i\n", pf->filename, pf->npart);
   }
-
-  fclose(fp);
-
-  // Update how many particles we have read so far
-  *npart_read += npart_loc;
-  return npart_loc;
 }
 
 //==================================================================
-// Assuming ascii-files in format /filedir/fileprefix.X where X = 1, 2, ..., n
-// and that ascii-files have format [numpart; X1 Y1 Z1 mass; X2 Y2 Z2 mass; ...]
-// with positions in [0,1]. Mass not used.
+// Read the next chunk of (at most PARTICLE_READ_CHUNK) particles from the file
+// and store the positions in [0,1] in [buffer]. Returns the number of particles
+// in the chunk (0 when the whole file has been read)
 //==================================================================
-int read_ascii_file(char *filedir, char *fileprefix, int filenum, char *buffer, int *npart_read){
-  FILE *fp;
-  char filename[200];
-  double tmp;
+int read_particle_chunk(struct ParticleFile *pf, char *buffer){
+  int nchunk = pf->npart - pf->nread;
+  if(nchunk > PARTICLE_READ_CHUNK) nchunk = PARTICLE_READ_CHUNK;
+  if(nchunk <= 0) return 0;
+
+  int status = nchunk;
   double *buffer_dbl = (double *) buffer;
+  float  *buffer_flt = (float *)  buffer;
+  if(TypeInputParticleFiles == RAMSESFILE){
 
-  // Make filename and open
-  sprintf(filename, "%s/%s.%i", filedir, fileprefix, filenum);
-  if( (fp = fopen(filename,"r")) == NULL){
-    printf("Error: cannot open file [%s]\n", filename);
-    MPI_Abort(MPI_COMM_WORLD, 1);
-    exit(1);
-  }
+    // The x, y and z positions are stored in three records (Buffer Format: [x1 x2 ... xn y1 y2 ... yn z1 z2 ... zn] )
+    for(int axes = 0; axes < 3; axes++){
+      long offset = pf->pos_start + axes * ((long)pf->npart * sizeof(double) + 2*sizeof(int)) + (long)pf->nread * sizeof(double);
+      fseek(pf->fp, offset, SEEK_SET);
+      if( (int) fread(&buffer_dbl[axes*nchunk], sizeof(double), nchunk, pf->fp) != nchunk ) status = -1;
+    }
 
-  // Read header
-  int npart_loc;
-  fscanf(fp, "%i", &npart_loc);
+  } else if(TypeInputParticleFiles == ASCIIFILE){
 
-  // Read particle positions (Buffer Format: [x1 x2 ... xn y1 y2 ... yn z1 z2 ... zn] )
-  for(int i = 0; i < npart_loc; i++)
-    fscanf(fp, "%lf %lf %lf %lf\n", &buffer_dbl[i + 0*npart_loc], &buffer_dbl[i + 1*npart_loc], &buffer_dbl[i + 2*npart_loc], &tmp);
-  
-  // Make sure all positions are in [0,1]
-  for(int i = 0; i < 3*npart_loc; i++)
-    if(buffer_dbl[i] >= 1.0) buffer_dbl[i] -= 1.0;
+    // Read particle positions (Buffer Format: [x1 x2 ... xn y1 y2 ... yn z1 z2 ... zn] )
+    double tmp;
+    for(int i = 0; i < nchunk; i++){
+      int nvalues = ascii_next_double(pf, &buffer_dbl[i + 0*nchunk]);
+      nvalues    += ascii_next_double(pf, &buffer_dbl[i + 1*nchunk]);
+      nvalues    += ascii_next_double(pf, &buffer_dbl[i + 2*nchunk]);
+      nvalues    += ascii_next_double(pf, &tmp);
+      if(nvalues != 4) status = -1;
+    }
 
-  if(ThisTask == 0) {
-    printf("# Reading ascii file: %s  Npart: %i\n", filename, npart_loc);
-    printf("First particle X: [%f]  Y: [%f]  Z: [%f]\n", buffer_dbl[0], buffer_dbl[0+npart_loc], buffer_dbl[0+2*npart_loc]);
-  }
+  } else {
 
-  fclose(fp);
+    // Read positions (Buffer format: [x1 y1 z1 x2 y2 z2 ...])
+    fseek(pf->fp, pf->pos_start + (long)pf->nread * 3 * sizeof(float), SEEK_SET);
+    if( (int) fread(buffer_flt, sizeof(float), 3*nchunk, pf->fp) != 3*nchunk ) status = -1;
 
-  // Update how many particles we have read so far
-  *npart_read += npart_loc;
-  return npart_loc;
-}
+  }
 
-//==================================================================
-// Reads a single GADGET1 file and stores the particle positions in [buffer]
-// Updates [npart_read] with how many particles it was in this file [npart_loc] and returns this
-//==================================================================
-int read_gadget_file(char *filedir, char *fileprefix, int filenum, char *buffer, int *npart_read){
-  FILE *fp;
-  char filename[200];
-  float *buffer_flt = (float *) buffer;
-  
-  // Make filename and open
-  sprintf(filename, "%s/%s.%i", filedir, fileprefix, filenum );
-  if( (fp = fopen(filename,"r")) == NULL){
-    printf("Error: cannot open file [%s]\n", filename);
-    MPI_Abort(MPI_COMM_WORLD, 1);
+  if(status != nchunk){
+    printf("Error in read_particle_chunk Task [%i] : could not read particles [%i, %i) from file [%s]\n", ThisTask, pf->nread, pf->nread + nchunk, pf->filename);
+    fflush(stdout);
+    MPI_Abort(MPI_COMM_WORLD,1);
     exit(1);
   }
 
-  // Read header
-  read_gadget_header(fp);
-  int npart_loc = gadget_header.npart[1];
-
-  // Read positions (Buffer format: [x1 y1 z1 x2 y2 z2 ...])
-  read_float_vec(fp, buffer_flt, 3*npart_loc);
-
-  // Normalize positions to [0,1]
-  double normfac = 1.0 / gadget_header.BoxSize;
-  for(int i = 0; i < 3*npart_loc; i++){
-    buffer_flt[i] *= normfac;
-    if(buffer_flt[i] >= 1.0) buffer_flt[i] -= 1.0;
+  // Make sure all positions are in [0,1]
+  if(TypeInputParticleFiles == GADGETFILE){
+    for(int i = 0; i < 3*nchunk; i++){
+      buffer_flt[i] *= pf->normfac;
+      if(buffer_flt[i] >= 1.0) buffer_flt[i] -= 1.0;
+    }
+  } else {
+    for(int i = 0; i < 3*nchunk; i++)
+      if(buffer_dbl[i] >= 1.0) buffer_dbl[i] -= 1.0;
   }
 
-  if(ThisTask == 0) {
-    printf("# Reading gadget file: %s  Npart: %i\n", filename, npart_loc);
-    printf("First particle X: [%f]  Y: [%f]  Z: [%f]\n", buffer_flt[0], buffer_flt[0+npart_loc], buffer_flt[0+2*npart_loc]);
+  if(ThisTask == 0 && pf->nread == 0) {
+    double x[3];
+    fetch_particle_position(buffer, nchunk, 0, x);
+    printf("First particle X: [%f]  Y: [%f]  Z: [%f]\n", x[0], x[1], x[2]);
   }
-  fclose(fp);
 
-  // Update how many particles we have read so far
-  *npart_read += npart_loc;
-  return npart_loc;
+  pf->nread += nchunk;
+  return nchunk;
+}
+
+void close_particle_file(struct ParticleFile *pf){
+  if(TypeInputParticleFiles == ASCIIFILE) free(pf->text);
+  fclose(pf->fp);
 }
 
 //==================================================================
@@ -622,37 +750,24 @@ void ReadFilesMakeDisplacementField(void){
     printf("==============================================\n\n");
   }
 
-  // Compute size of buffer needed
-  int maxpart = 0;
-  if(TypeInputParticleFiles == RAMSESFILE){
-    maxpart = find_maxpart_ramsesfiles(InputParticleFileDir, RamsesOutputNumber, NumInputParticleFiles);
-  
-    if(ThisTask == 0) {
-      printf("RAMSES Filedir: [%s] Nfiles: [%i] OutputNumber: [%i] Maxpart_files: [%i]\n", 
-          InputParticleFileDir, NumInputParticleFiles, RamsesOutputNumber, maxpart);
-    }
-  } else if(TypeInputParticleFiles == ASCIIFILE){
-    maxpart = find_maxpart_asciifiles(InputParticleFileDir, InputParticleFilePrefix, NumInputParticleFiles);
-    
-    if(ThisTask == 0) {
-      printf("ASCII Filedir: [%s] Fileprefix: [%s] Nfiles: [%i] Maxpart_files: [%i]\n", 
-          InputParticleFileDir, InputParticleFilePrefix, NumInputParticleFiles, maxpart);
-    }
-  } else if(TypeInputParticleFiles == GADGETFILE) { 
-    maxpart = find_maxpart_gadgetfiles(InputParticleFileDir, InputParticleFilePrefix, NumInputParticleFiles);
-    
-    if(ThisTask == 0) {
-      printf("GADGET Filedir: [%s] Fileprefix: [%s] Nfiles: [%i] Maxpart_files: [%i]\n", 
-          InputParticleFileDir, InputParticleFilePrefix, NumInputParticleFiles, maxpart);
+  if(ThisTask == 0) {
+    if(TypeInputParticleFiles == RAMSESFILE){
+      printf("RAMSES Filedir: [%s] Nfiles: [%i] OutputNumber: [%i]\n", InputParticleFileDir, NumInputParticleFiles, RamsesOutputNumber);
+    } else if(TypeInputParticleFiles == ASCIIFILE){
+      printf("ASCII Filedir: [%s] Fileprefix: [%s] Nfiles: [%i]\n", InputParticleFileDir, InputParticleFilePrefix, NumInputParticleFiles);
+    } else if(TypeInputParticleFiles == GADGETFILE) { 
+      printf("GADGET Filedir: [%s] Fileprefix: [%s] Nfiles: [%i]\n", InputParticleFileDir, InputParticleFilePrefix, NumInputParticleFiles);
     }
-  } else {
+  }
+
+  if(TypeInputParticleFiles != RAMSESFILE && TypeInputParticleFiles != ASCIIFILE && TypeInputParticleFiles != GADGETFILE) {
     printf("Error: unknown file-format [%i]\n", TypeInputParticleFiles);
     MPI_Abort(MPI_COMM_WORLD, 1);
     exit(1);
   }
 
-  // Allocate read buffer
-  char *buffer   = malloc(3*sizeof(double)*maxpart);
+  // Allocate read buffer. The files are read in chunks so this does not depend on the file size
+  char *buffer   = malloc(PARTICLE_READ_CHUNK_BYTES);
   float *pos_flt = (float *)  buffer;
   double *pos    = (double *) buffer;
   
@@ -685,47 +800,74 @@ void ReadFilesMakeDisplacementField(void){
   int npart_read = 0, NumPart_local = 0;
   double maxxyz = -1e100, minxyz = 1e100;
 
-  for(int filenum = 1; filenum <= NumInputParticleFiles; filenum++){
+#ifdef PARALLEL_PARTICLE_READ
+  // Each task reads every NTask'th file and sends the particles to the task owning their slice
+  int filestride = NTask;
+#else
+  int filestride = 1;
+#endif
+
+  for(int firstfile = 1; firstfile <= NumInputParticleFiles; firstfile += filestride){
+    struct ParticleFile pfile;
     int npart_file = 0;
+    int filenum = firstfile;
+#ifdef PARALLEL_PARTICLE_READ
+    filenum += ThisTask;
+#endif
 
-    // Read the files
-    if(TypeInputParticleFiles == RAMSESFILE){
-      npart_file = read_ramses_file(InputParticleFileDir, RamsesOutputNumber, filenum, buffer, &npart_read);
-    } else if(TypeInputParticleFiles == ASCIIFILE){
-      npart_file = read_ascii_file(InputParticleFileDir, InputParticleFilePrefix, filenum, buffer, &npart_read);
-    } else if(TypeInputParticleFiles == GADGETFILE){
-      npart_file = read_gadget_file(InputParticleFileDir, InputParticleFilePrefix, filenum - 1, buffer, &npart_read);
-    }
+    // Open the file (in the last round some tasks might not have a file)
+    int hasfile = (filenum <= NumInputParticleFiles);
+    if(hasfile) open_particle_file(&pfile, filenum);
+
+    // Read and process the particles chunk by chunk
+    int more;
+    do {
+      int npart_chunk = hasfile ? read_particle_chunk(&pfile, buffer) : 0;
+      npart_file += npart_chunk;
+
+      //====================================
+      // Output the particles to a ascii file
+      // if(ThisTask == 0){
+      //   for(int i = 0; i < npart_chunk; i++){
+      //     if(TypeInputParticleFiles == 3)
+      //       fprintf(fp, "%e %e %e 1.0\n", pos_flt[3*i], pos_flt[3*i + 1], pos_flt[3*i + 2]);
+      //     else
+      //       fprintf(fp, "%e %e %e 1.0\n", pos[i], pos[i + npart_chunk], pos[i + 2*npart_chunk]);
+      //   }
+      // }
+      //====================================
+
+      // Process particles [note assuming density array has been init to -1 before running this]
+#ifdef PARALLEL_PARTICLE_READ
+      NumPart_local += ExchangeAndProcessParticles(buffer, npart_chunk);
+#else
+      NumPart_local += ProcessParticlesSingleFile(buffer, npart_chunk);
+#endif
+
+      // Compute min / max
+      for(int j = 0; j < 3*npart_chunk; j++){
+        if(TypeInputParticleFiles == 3){
+          if(pos_flt[j] > maxxyz) maxxyz = (double) pos_flt[j];
+          if(pos_flt[j] < minxyz) minxyz = (double) pos_flt[j];
+        } else {
+          if(pos[j] > maxxyz) maxxyz = pos[j];
+          if(pos[j] < minxyz) minxyz = pos[j];
+        }
+      }
+
+      more = hasfile && (pfile.nread < pfile.npart);
+#ifdef PARALLEL_PARTICLE_READ
+      // The exchange is collective so continue until all tasks are done with their file
+      ierr = MPI_Allreduce(MPI_IN_PLACE, &more, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+#endif
+    } while(more);
+
+    if(hasfile) close_particle_file(&pfile);
+    npart_read += npart_file;
 
     if(ThisTask == 0) {
       printf("Read so far: %i  Part in current file %i\n", npart_read, npart_file); 
     }
-
-    //====================================
-    // Output the particles to a ascii file
-    // if(ThisTask == 0){
-    //   for(int i = 0; i < npart_file; i++){
-    //     if(TypeInputParticleFiles == 3)
-    //       fprintf(fp, "%e %e %e 1.0\n", pos_flt[i], pos_flt[i + npart_file], pos_flt[i + 2*npart_file]);
-    //     else
-    //       fprintf(fp, "%e %e %e 1.0\n", pos[i], pos[i + npart_file], pos[i + 2*npart_file]);
-    //   }
-    // }
-    //====================================
-
-    // Process particles [note assuming density array has been init to -1 before running this]
-    NumPart_local += ProcessParticlesSingleFile(buffer, npart_file);
-
-    // Compute min / max
-    for(int j = 0; j < 3*npart_file; j++){
-      if(TypeInputParticleFiles == 3){
-        if(pos_flt[j] > maxxyz) maxxyz = (double) pos_flt[j];
-        if(pos_flt[j] < minxyz) minxyz = (double) pos_flt[j];
-      } else {
-        if(pos[j] > maxxyz) maxxyz = pos[j];
-        if(pos[j] < minxyz) minxyz = pos[j];
-      }
-    }
   }
  
   //====================================
@@ -733,6 +875,13 @@ void ReadFilesMakeDisplacementField(void){
   // if(ThisTask == 0) fclose(fp);
   //====================================
 
+#ifdef PARALLEL_PARTICLE_READ
+  ierr = MPI_Allreduce(MPI_IN_PLACE, &minxyz,     1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+  ierr = MPI_Allreduce(MPI_IN_PLACE, &maxxyz,     1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  ierr = MPI_Allreduce(MPI_IN_PLACE, &npart_read, 1, MPI_INT,    MPI_SUM, MPI_COMM_WORLD);
+  if(ThisTask == 0) printf("Total number of particles read: %i\n", npart_read);
+#endif
+
   if(ThisTask == 0) {
     printf("Particles in particle files has Min_xyz: [%e]  Max_xyz: [%e]\n", minxyz, maxxyz);
   }
@@ -929,16 +1078,30 @@ void readICFromFile_assign_particles(){
 
 #ifdef GADGET_STYLE
 void write_gadget_header(FILE *fp, double A){
-  double Z = 1.0/A - 1.0;
   int dummy;      
 
+  set_gadget_header(A, NumPart, NTaskWithN);
+
+  dummy = sizeof(header);
+  my_fwrite(&dummy,  sizeof(dummy),  1, fp);
+  my_fwrite(&header, sizeof(header), 1, fp);
+  my_fwrite(&dummy,  sizeof(dummy),  1, fp);
+}
+
+//====================================================
+// Set the GADGET header for a file with [npart_file]
+// particles that is one of [num_files] files
+//====================================================
+void set_gadget_header(double A, unsigned long long npart_file, int num_files){
+  double Z = 1.0/A - 1.0;
+
   // Gadget header stuff
   for(int k = 0; k < 6; k++) {
     header.npart[k]      = 0;
     header.npartTotal[k] = 0;
     header.mass[k]       = 0;
   }
-  header.npart[1]      = NumPart;
+  header.npart[1]      = npart_file;
   header.npartTotal[1] = TotNumPart;
   header.npartTotal[2] = (TotNumPart >> 32);
   header.mass[1]       = (3.0 * Omega * Hubble * Hubble * Box * Box * Box) / (8.0 * PI * G * TotNumPart);
@@ -954,16 +1117,11 @@ void write_gadget_header(FILE *fp, double A){
   header.flag_metals     = 0;
   header.hashtabsize     = 0;
 
-  header.num_files = NTaskWithN;
+  header.num_files = num_files;
 
   header.BoxSize      = Box;
   header.Omega0       = Omega;
   header.OmegaLambda  = 1.0 - Omega;
   header.HubbleParam  = HubbleParam;
-
-  dummy = sizeof(header);
-  my_fwrite(&dummy,  sizeof(dummy),  1, fp);
-  my_fwrite(&header, sizeof(header), 1, fp);
-  my_fwrite(&dummy,  sizeof(dummy),  1, fp);
 }
 #endif
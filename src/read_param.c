@@ -320,6 +320,118 @@ void read_parameterfile(char * fname) {
   id[nt++] = STRING;
 #endif
 
+#ifdef TABLE_CACHE
+  strcpy(tag[nt], "TableCacheDir");
+  addr[nt] = TableCacheDir;
+  id[nt++] = STRING;
+
+  strcpy(tag[nt], "UseICCache");
+  addr[nt] = &UseICCache;
+  id[nt++] = INT;
+#endif
+
+#ifdef MULTIGRID_SOLVER
+  strcpy(tag[nt], "MultigridSolveEvery");
+  addr[nt] = &MultigridSolveEvery;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "MultigridMaxCycles");
+  addr[nt] = &MultigridMaxCycles;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "MultigridCycleType");
+  addr[nt] = &MultigridCycleType;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "MultigridEpsilon");
+  addr[nt] = &MultigridEpsilon;
+  id[nt++] = FLOAT;
+#endif
+
+#ifdef COUNTER_BASED_RNG
+  strcpy(tag[nt], "UseSeedTable");
+  addr[nt] = &UseSeedTable;
+  id[nt++] = INT;
+#endif
+
+#ifdef ASYNC_OUTPUT
+  strcpy(tag[nt], "AsyncOutputMemoryMB");
+  addr[nt] = &AsyncOutputMemoryMB;
+  id[nt++] = INT;
+#endif
+
+#ifdef MPIIO_OUTPUT
+  strcpy(tag[nt], "NumOutputFiles");
+  addr[nt] = &NumOutputFiles;
+  id[nt++] = INT;
+#endif
+
+#ifdef COMPRESSED_OUTPUT
+  strcpy(tag[nt], "CompressPosTolerance");
+  addr[nt] = &CompressPosTolerance;
+  id[nt++] = FLOAT;
+
+  strcpy(tag[nt], "CompressVelTolerance");
+  addr[nt] = &CompressVelTolerance;
+  id[nt++] = FLOAT;
+#endif
+
+#if defined(SUBSAMPLE_OUTPUT) || defined(DENSITY_GRID_OUTPUT) || defined(FOF_HALOS)
+  strcpy(tag[nt], "FullSnapshotInterval");
+  addr[nt] = &FullSnapshotInterval;
+  id[nt++] = INT;
+#endif
+
+#ifdef SUBSAMPLE_OUTPUT
+  strcpy(tag[nt], "SubsampleFraction");
+  addr[nt] = &SubsampleFraction;
+  id[nt++] = FLOAT;
+#endif
+
+#ifdef DENSITY_GRID_OUTPUT
+  strcpy(tag[nt], "DensityGridSize");
+  addr[nt] = &DensityGridSize;
+  id[nt++] = INT;
+#endif
+
+#ifdef FOF_HALOS
+  strcpy(tag[nt], "FoFLinkingLength");
+  addr[nt] = &FoFLinkingLength;
+  id[nt++] = FLOAT;
+
+  strcpy(tag[nt], "FoFMinParticles");
+  addr[nt] = &FoFMinParticles;
+  id[nt++] = INT;
+
+#if defined(PARTICLE_ID) || defined(SCALEDEPENDENT)
+  strcpy(tag[nt], "FoFWriteMemberIDs");
+  addr[nt] = &FoFWriteMemberIDs;
+  id[nt++] = INT;
+#endif
+#endif
+
+#ifdef COMPUTE_POFK
+  strcpy(tag[nt], "PofkNbins");
+  addr[nt] = &PofkNbins;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "PofkLogBinning");
+  addr[nt] = &PofkLogBinning;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "PofkSubtractShotnoise");
+  addr[nt] = &PofkSubtractShotnoise;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "PofkEveryStep");
+  addr[nt] = &PofkEveryStep;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "PofkMultipoles");
+  addr[nt] = &PofkMultipoles;
+  id[nt++] = INT;
+#endif
+
 #ifdef LIGHTCONE
   strcpy(tag[nt], "Origin_x");
   addr[nt] = &Origin_x;
@@ -464,6 +576,92 @@ void read_parameterfile(char * fname) {
    }
 #endif 
 
+#ifdef TABLE_CACHE
+  if (UseICCache != 0 && UseICCache != 1) {
+    if (ThisTask == 0) printf("\nERROR: UseICCache must be 0 (generate the IC every time) or 1 (cache the IC displacement fields).\n\n");
+    FatalError((char *)"read_param.c", 395);
+  }
+#endif
+
+#ifdef MULTIGRID_SOLVER
+  if (MultigridSolveEvery < 1 || MultigridMaxCycles < 0 || (MultigridCycleType != 1 && MultigridCycleType != 2)) {
+    if (ThisTask == 0) printf("\nERROR: MultigridSolveEvery must be >= 1, MultigridMaxCycles >= 0 and MultigridCycleType 1 (V-cycle) or 2 (W-cycle).\n\n");
+    FatalError((char *)"read_param.c", 400);
+  }
+#endif
+
+#ifdef COUNTER_BASED_RNG
+  if (UseSeedTable != 0 && UseSeedTable != 1) {
+    if (ThisTask == 0) printf("\nERROR: UseSeedTable must be 0 (counter-based RNG) or 1 (seedtable as in the standard version).\n\n");
+    FatalError((char *)"read_param.c", 410);
+  }
+#endif
+
+#ifdef ASYNC_OUTPUT
+  if (AsyncOutputMemoryMB < 0) {
+    if (ThisTask == 0) printf("\nERROR: AsyncOutputMemoryMB must be >= 0 (0 means that the files are written directly).\n\n");
+    FatalError((char *)"read_param.c", 415);
+  }
+#endif
+
+#ifdef MPIIO_OUTPUT
+  if (NumOutputFiles < 1 || NumOutputFiles > NTask) {
+    if (ThisTask == 0) printf("\nERROR: NumOutputFiles must be between 1 and the number of tasks (%d).\n\n", NTask);
+    FatalError((char *)"read_param.c", 425);
+  }
+#endif
+
+#if defined(MPIIO_OUTPUT) && defined(GADGET_STYLE)
+  // The GADGET record markers are ints, so the positions in a file (3 floats per particle) must be below 2 GB
+  if (3ULL * sizeof(float) * Nsample * Nsample * Nsample / NumOutputFiles > INT_MAX) {
+    if (ThisTask == 0) printf("\nERROR: With NumOutputFiles = %d the GADGET records in a file are larger than 2 GB. Use at least %llu files.\n\n", 
+        NumOutputFiles, 3ULL * sizeof(float) * Nsample * Nsample * Nsample / INT_MAX + 1);
+    FatalError((char *)"read_param.c", 455);
+  }
+#endif
+
+#ifdef COMPRESSED_OUTPUT
+  if (CompressPosTolerance < 0.0 || CompressVelTolerance < 0.0) {
+    if (ThisTask == 0) printf("\nERROR: CompressPosTolerance and CompressVelTolerance must be >= 0 (0 means that the values are stored exactly).\n\n");
+    FatalError((char *)"read_param.c", 430);
+  }
+#endif
+
+#ifdef SUBSAMPLE_OUTPUT
+  if (SubsampleFraction <= 0.0 || SubsampleFraction > 1.0) {
+    if (ThisTask == 0) printf("\nERROR: SubsampleFraction must be in (0,1].\n\n");
+    FatalError((char *)"read_param.c", 435);
+  }
+#endif
+
+#ifdef DENSITY_GRID_OUTPUT
+  if (DensityGridSize <= 0) {
+    if (ThisTask == 0) printf("\nERROR: DensityGridSize must be positive.\n\n");
+    FatalError((char *)"read_param.c", 440);
+  }
+#endif
+
+#ifdef COMPUTE_POFK
+  if (PofkNbins <= 0) {
+    if (ThisTask == 0) printf("\nERROR: PofkNbins must be positive.\n\n");
+    FatalError((char *)"read_param.c", 445);
+  }
+#endif
+
+#ifdef FOF_HALOS
+  if (FoFLinkingLength <= 0.0 || FoFMinParticles < 1) {
+    if (ThisTask == 0) printf("\nERROR: FoFLinkingLength must be positive and FoFMinParticles at least 1.\n\n");
+    FatalError((char *)"read_param.c", 450);
+  }
+#endif
+
+#ifdef TWIN_RUN
+  if (! modified_gravity_active) {
+    if (ThisTask == 0) printf("\nERROR: TWIN_RUN evolves a modified gravity simulation and its LCDM twin. Set modified_gravity_active = 1.\n\n");
+    FatalError((char *)"read_param.c", 420);
+  }
+#endif
+
 #ifndef GAUSSIAN
   if (Fnl_Redshift < Init_Redshift) {
     if (ThisTask == 0) printf("\nERROR: Fnl_Redshift must be >= Initial Redshift for us to generate non-Gaussian initial conditions.\n\n");
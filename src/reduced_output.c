@@ -0,0 +1,190 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+
+//==========================================================================//
+// This file contains the reduced snapshot outputs written in Output():     //
+// a subsample of the particles selected by hashing the Lagrangian ID      //
+// (so it is the same set at every redshift) and the CIC density contrast  //
+// on a coarse grid. Both are written in binary. The full snapshots can    //
+// be written for only every FullSnapshotInterval'th output                //
+//                                                                          //
+// Subsample file (one per task), all numbers in native byte order:        //
+//   [unsigned long long npart] [double boxsize in Mpc/h] [double redshift] //
+//   [double fraction] [3*npart float positions in Mpc/h]                   //
+//   [3*npart float velocities in km/s] [npart unsigned long long IDs]     //
+//                                                                          //
+// Density file (one per snapshot):                                         //
+//   [int ngrid] [double boxsize in Mpc/h] [double redshift]                //
+//   [ngrid^3 float delta with index (ix*ngrid + iy)*ngrid + iz]            //
+//==========================================================================//
+
+#include "vars.h"
+#include "proto.h"
+
+//====================================================
+// Write the full snapshot at this output? Always at 
+// the last output, otherwise at every 
+// FullSnapshotInterval'th output counting from the 
+// first (0 = only at the last output)
+//====================================================
+int write_full_snapshot(double A) {
+  double Z = 1.0 / A - 1.0;
+  int nout = 0;
+
+  // The index of the output is the closest redshift in the output list
+  for(int i = 1; i < Noutputs; i++) 
+    if(fabs(OutputList[i].Redshift - Z) < fabs(OutputList[nout].Redshift - Z)) nout = i;
+
+  if(nout == Noutputs - 1) return 1;
+  if(FullSnapshotInterval <= 0) return 0;
+  return (nout % FullSnapshotInterval) == 0;
+}
+
+#ifdef SUBSAMPLE_OUTPUT
+//====================================================
+// Hash of the Lagrangian ID (splitmix64) mapped to a
+// number in [0,1). The particle is in the subsample 
+// if this is less than SubsampleFraction
+//====================================================
+static inline double subsample_hash(unsigned long long id) {
+  unsigned long long z = id + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z =  z ^ (z >> 31);
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//====================================================
+// Write the subsample of the particles on this task
+//====================================================
+void write_subsample_particles(double A, double Dv, double Dv2, int use_2lpt_step) {
+  FILE *fp;
+  char buf[300];
+  double Z         = (1.0/A)-1.0;
+  double fac       = Hubble / pow(A,1.5);
+  double lengthfac = UnitLength_in_cm / 3.085678e24;     // Convert positions to Mpc/h
+  double velfac    = UnitVelocity_in_cm_per_s / 1.0e5;   // Convert velocities to km/s
+  double boxsize   = Box * lengthfac;
+  double fraction  = SubsampleFraction;
+  unsigned long long npart = 0;
+  unsigned int n, k;
+
+  unsigned int *index = malloc(sizeof(unsigned int) * NumPart + 1);
+  for(n = 0; n < NumPart; n++)
+    if(subsample_hash(lagrangian_id(n)) < SubsampleFraction) index[npart++] = n;
+
+  sprintf(buf, "%s/%s_z%dp%03d.sub.%d", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000), ThisTask);
+  if(!(fp = fopen(buf, "w"))) {
+    printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+    FatalError((char *)"reduced_output.c", 99);
+  }
+
+  my_fwrite(&npart,    sizeof(npart),    1, fp);
+  my_fwrite(&boxsize,  sizeof(boxsize),  1, fp);
+  my_fwrite(&Z,        sizeof(Z),        1, fp);
+  my_fwrite(&fraction, sizeof(fraction), 1, fp);
+
+  float *block = malloc(sizeof(float) * 3 * npart + 1);
+
+  // Positions in Mpc/h
+  for(n = 0; n < npart; n++)
+    for(k = 0; k < 3; k++) block[3 * n + k] = (float)(lengthfac*P[index[n]].Pos[k]);
+  my_fwrite(block, sizeof(float), 3 * npart, fp);
+
+  // Velocities in km/s. Remember to add the ZA and 2LPT velocities back on
+  for(n = 0; n < npart; n++) {
+    unsigned int m = index[n];
+#ifdef SCALEDEPENDENT
+    for(k = 0; k < 3; k++) block[3 * n + k] = (float)(velfac*fac*(P[m].Vel[k] - sumxyz[k] + (P[m].dDdy[k] + P[m].dD2dy[k] * use_2lpt_step ) * UseCOLA));
+#else
+    for(k = 0; k < 3; k++) block[3 * n + k] = (float)(velfac*fac*(P[m].Vel[k] - sumxyz[k] + (P[m].D[k] * Dv + P[m].D2[k] * Dv2 * use_2lpt_step ) * UseCOLA));
+#endif
+  }
+  my_fwrite(block, sizeof(float), 3 * npart, fp);
+  free(block);
+
+  // The Lagrangian IDs
+  unsigned long long *blockid = malloc(sizeof(unsigned long long) * npart + 1);
+  for(n = 0; n < npart; n++) blockid[n] = lagrangian_id(index[n]);
+  my_fwrite(blockid, sizeof(unsigned long long), npart, fp);
+  free(blockid);
+
+  fclose(fp);
+  free(index);
+}
+#endif
+
+#ifdef DENSITY_GRID_OUTPUT
+//====================================================
+// Assign the particles to a grid of DensityGridSize^3
+// cells with CIC (as in PtoMesh) and write the density
+// contrast. The full grid is summed up on task 0 so
+// it is meant for grids much coarser than Nmesh
+//====================================================
+void write_density_grid(double A) {
+  int ngrid = DensityGridSize;
+  size_t slice = (size_t) ngrid * ngrid;
+  double Z = 1.0 / A - 1.0;
+  double boxsize = Box * UnitLength_in_cm / 3.085678e24;
+  double weight = pow((double) ngrid / (double) Nsample, 3);
+
+  // One extra slice on the right for the particles in the last slice 
+  float_kind *grid = calloc(slice * (ngrid + 1), sizeof(float_kind));
+  CICDeposit(grid, ngrid, ngrid, 0, weight);
+  for(size_t i = 0; i < slice; i++) grid[i] += grid[slice * ngrid + i];
+
+  // Sum up the grids from all tasks one slice at a time on task 0 and write it
+  FILE *fp = NULL;
+  if(ThisTask == 0) {
+    char buf[300];
+    sprintf(buf, "%s/%s_z%dp%03d.density", OutputDir, FileBase, (int)Z, (int)rint((Z-(int)Z)*1000));
+    if(!(fp = fopen(buf, "w"))) {
+      printf("\nERROR: Can't write in file '%s'.\n\n", buf);
+      FatalError((char *)"reduced_output.c", 163);
+    }
+    my_fwrite(&ngrid,   sizeof(ngrid),   1, fp);
+    my_fwrite(&boxsize, sizeof(boxsize), 1, fp);
+    my_fwrite(&Z,       sizeof(Z),       1, fp);
+  }
+
+  float *delta = malloc(sizeof(float) * slice);
+  float_kind *slicesum = malloc(sizeof(float_kind) * slice);
+  for(int ix = 0; ix < ngrid; ix++) {
+#ifdef SINGLE_PRECISION
+    MPI_Reduce(&grid[slice * ix], slicesum, slice, MPI_FLOAT,  MPI_SUM, 0, MPI_COMM_WORLD);
+#else
+    MPI_Reduce(&grid[slice * ix], slicesum, slice, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+    if(ThisTask == 0) {
+      for(size_t i = 0; i < slice; i++) delta[i] = (float)(slicesum[i] - 1.0);
+      my_fwrite(delta, sizeof(float), slice, fp);
+    }
+  }
+  if(ThisTask == 0) fclose(fp);
+
+  free(slicesum);
+  free(delta);
+  free(grid);
+}
+#endif
@@ -0,0 +1,430 @@
+//==========================================================================//
+//  Copyright (c) 2013       Cullan Howlett & Marc Manera,                  //
+//                           Institute of Cosmology and Gravitation,        //
+//                           University of Portsmouth.                      //
+//                                                                          //
+//  MG-PICOLA written by Hans Winther (ICG Portsmouth) March 2017           //
+//                                                                          //
+//  This file is part of PICOLA.                                            //
+//                                                                          //
+//  PICOLA is free software: you can redistribute it and/or modify          //
+//  it under the terms of the GNU General Public License as published by    //
+//  the Free Software Foundation, either version 3 of the License, or       //
+//  (at your option) any later version.                                     //
+//                                                                          //
+//  PICOLA is distributed in the hope that it will be useful,               //
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//  GNU General Public License for more details.                            //
+//                                                                          //
+//  You should have received a copy of the GNU General Public License       //
+//  along with PICOLA.  If not, see <http://www.gnu.org/licenses/>.         //
+//==========================================================================//
+
+//==========================================================================//
+// This file contains the routines for caching the growth-factor tables on  //
+// disk. A table is stored in [TableCacheDir]/name_hash.dat where           //
+// the hash is computed from all the parameters the table depends on. On    //
+// later runs the file is memory-mapped and validated instead of solving    //
+// the ODEs again. If the file is missing or invalid we recompute it.       //
+//                                                                          //
+// NB: the hash only contains parameters, so remove the cached tables if    //
+// the model functions in user_defined_functions.h are changed              //
+//==========================================================================//
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vars.h"
+#include "proto.h"
+
+#define TABLE_CACHE_MAGIC   0x4843414354504d47ULL   // "GMPTCACH"
+#define TABLE_CACHE_VERSION 1ULL
+
+// The header of the file. The data (ndata doubles) follows and the
+// file ends with the magic number again to catch incomplete writes
+struct table_cache_header {
+  unsigned long long magic;
+  unsigned long long version;
+  unsigned long long hash;
+  unsigned long long ndata;
+};
+
+//====================================================
+// FNV-1a hash of a block of bytes
+//====================================================
+unsigned long long table_cache_hash_bytes(unsigned long long hash, const void *data, size_t nbytes){
+  const unsigned char *bytes = (const unsigned char *) data;
+  if(hash == 0) hash = 14695981039346656037ULL;
+  for(size_t i = 0; i < nbytes; i++){
+    hash ^= (unsigned long long) bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+//====================================================
+// The hash of the name and the parameters of a table
+//====================================================
+static unsigned long long table_cache_hash_params(char *tablename, double *params, int nparams){
+  unsigned long long hash = 0;
+  unsigned long long version = TABLE_CACHE_VERSION;
+  hash = table_cache_hash_bytes(hash, &version, sizeof(version));
+  hash = table_cache_hash_bytes(hash, tablename, strlen(tablename));
+  hash = table_cache_hash_bytes(hash, params, sizeof(double) * nparams);
+  return hash;
+}
+
+//====================================================
+// Add the model, the cosmology and all the modified
+// gravity parameters to the hash
+//====================================================
+static unsigned long long table_cache_hash_model(unsigned long long hash){
+
+#define FLOAT  1
+#define STRING 2
+#define INT    3
+#define MAXTAGS 300
+
+  // The model we are running
+  char model[200] = "";
+#if defined(FOFRGRAVITY)
+  strcat(model, "FOFRGRAVITY");
+#elif defined(DGPGRAVITY)
+  strcat(model, "DGPGRAVITY");
+#elif defined(MBETAMODEL)
+  strcat(model, "MBETAMODEL");
+#endif
+#ifdef SCALEDEPENDENT
+  strcat(model, "_SCALEDEPENDENT");
+#endif
+  hash = table_cache_hash_bytes(hash, model, strlen(model));
+
+  // Cosmological parameters
+  hash = table_cache_hash_bytes(hash, &Omega, sizeof(Omega));
+
+  // All the modified gravity parameters we read from the parameterfile
+  void *addr[MAXTAGS];
+  char tag[MAXTAGS][50];
+  int id[MAXTAGS];
+  int nt = 0;
+  read_mg_parameters(addr, tag, id, &nt);
+  for(int i = 0; i < nt; i++){
+    hash = table_cache_hash_bytes(hash, tag[i], strlen(tag[i]));
+    if(id[i] == FLOAT)  hash = table_cache_hash_bytes(hash, addr[i], sizeof(double));
+    if(id[i] == INT)    hash = table_cache_hash_bytes(hash, addr[i], sizeof(int));
+    if(id[i] == STRING) hash = table_cache_hash_bytes(hash, addr[i], strlen((char *) addr[i]));
+  }
+
+#undef FLOAT
+#undef STRING
+#undef INT
+#undef MAXTAGS
+
+  return hash;
+}
+
+//====================================================
+// The hash of a table: the name, the parameters
+// defining the table (size, time and k-range), the
+// cosmology and all the modified gravity parameters
+//====================================================
+unsigned long long table_cache_hash(char *tablename, double *params, int nparams){
+  return table_cache_hash_model(table_cache_hash_params(tablename, params, nparams));
+}
+
+void table_cache_filename(char *filename, char *tablename, unsigned long long hash){
+  sprintf(filename, "%s/%s_%016llx.dat", TableCacheDir, tablename, hash);
+}
+
+//====================================================
+// Memory-map a cache file holding [ndata] elements of
+// [datasize] bytes. Returns a pointer to the data if
+// the file exists and is valid on all tasks and NULL 
+// otherwise. If check_finite is set the data are 
+// doubles that must not be nan or inf
+//====================================================
+static void *table_cache_load_file(char *filename, unsigned long long hash, size_t ndata, size_t datasize, int check_finite, struct table_cache_map *map){
+  size_t nbytes = sizeof(struct table_cache_header) + datasize * ndata + sizeof(unsigned long long);
+  map->addr   = NULL;
+  map->nbytes = 0;
+
+  int valid = 0;
+  int fd = open(filename, O_RDONLY);
+  if(fd >= 0){
+    struct stat st;
+    if(fstat(fd, &st) == 0 && (size_t) st.st_size == nbytes){
+      void *addr = mmap(NULL, nbytes, PROT_READ, MAP_SHARED, fd, 0);
+      if(addr != MAP_FAILED){
+        struct table_cache_header *header = (struct table_cache_header *) addr;
+        char *data = (char *) (header + 1);
+        unsigned long long footer;
+        memcpy(&footer, data + datasize * ndata, sizeof(footer));
+
+        valid = (header->magic == TABLE_CACHE_MAGIC && header->version == TABLE_CACHE_VERSION &&
+                 header->hash == hash && header->ndata == ndata && footer == TABLE_CACHE_MAGIC);
+        for(size_t i = 0; check_finite && valid && i < ndata; i++)
+          if(isnan(((double *) data)[i]) || isinf(((double *) data)[i])) valid = 0;
+
+        if(valid){
+          map->addr   = addr;
+          map->nbytes = nbytes;
+        } else {
+          munmap(addr, nbytes);
+        }
+      }
+    }
+    close(fd);
+  }
+
+  // All tasks must agree on using the cache
+  int valid_all = 0;
+  MPI_Allreduce(&valid, &valid_all, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if(!valid_all){
+    if(valid) table_cache_close(map);
+    return NULL;
+  }
+  return (void *) ((struct table_cache_header *) map->addr + 1);
+}
+
+//====================================================
+// Memory-map a cached table. Returns a pointer to the
+// [ndata] doubles if the file exists and is valid on
+// all tasks and NULL otherwise. The mapping is released
+// with table_cache_close
+//====================================================
+double *table_cache_load(char *tablename, unsigned long long hash, size_t ndata, struct table_cache_map *map){
+  char filename[1000];
+  table_cache_filename(filename, tablename, hash);
+
+  double *data = (double *) table_cache_load_file(filename, hash, ndata, sizeof(double), 1, map);
+  if(ThisTask == 0){
+    if(data == NULL) printf("Table cache: no valid table %s found. Computing it\n", filename);
+    else             printf("Table cache: using table %s\n", filename);
+    fflush(stdout);
+  }
+  return data;
+}
+
+void table_cache_close(struct table_cache_map *map){
+  if(map->addr != NULL) munmap(map->addr, map->nbytes);
+  map->addr   = NULL;
+  map->nbytes = 0;
+}
+
+//====================================================
+// Write [nblocks] blocks of [blocksize] bytes to a cache
+// file holding [ndata] elements. We write to a temporary
+// file and rename it so other jobs never see a partially
+// written file. Returns 1 on success
+//====================================================
+static int table_cache_write_file(char *filename, unsigned long long hash, void **blocks, int nblocks, size_t blocksize, size_t ndata){
+  char tmpname[1100];
+  sprintf(tmpname, "%s.tmp%d", filename, (int) getpid());
+
+  FILE *fp = fopen(tmpname, "w");
+  if(fp == NULL) return 0;
+
+  struct table_cache_header header;
+  header.magic   = TABLE_CACHE_MAGIC;
+  header.version = TABLE_CACHE_VERSION;
+  header.hash    = hash;
+  header.ndata   = (unsigned long long) ndata;
+
+  int ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+  for(int i = 0; ok && i < nblocks; i++)
+    ok = (fwrite(blocks[i], 1, blocksize, fp) == blocksize);
+  ok = ok && (fwrite(&header.magic, sizeof(header.magic), 1, fp) == 1);
+  ok = (fclose(fp) == 0) && ok;
+
+  if(ok && rename(tmpname, filename) == 0) return 1;
+  remove(tmpname);
+  return 0;
+}
+
+//====================================================
+// Write a table to the cache. The data is given as
+// [nblocks] blocks of [blocksize] doubles. Only task 0
+// writes. Failing to write is not fatal
+//====================================================
+void table_cache_write(char *tablename, unsigned long long hash, double **blocks, int nblocks, size_t blocksize){
+  if(ThisTask != 0) return;
+
+  char filename[1000];
+  table_cache_filename(filename, tablename, hash);
+
+  if(table_cache_write_file(filename, hash, (void **) blocks, nblocks, sizeof(double) * blocksize, (size_t) nblocks * blocksize)){
+    printf("Table cache: wrote table %s\n", filename);
+  } else {
+    printf("Table cache: WARNING failed to write %s\n", filename);
+  }
+  fflush(stdout);
+}
+
+//====================================================
+// The initial displacement fields. Every task stores 
+// its own part in [TableCacheDir]/ic_taskN_hash.dat
+// These are ZA and LPT for the particles or, with
+// SCALEDEPENDENT, the k-space fields cdisp_store and
+// cdisp2_store. Without SCALEDEPENDENT the Gaussian 
+// fields are for LCDM (they are rescaled to the MG P(k)
+// after loading them with mg_rescale_displacement_fields)
+// so the hash does not contain the model and the MG 
+// parameters and the same fields are used for all models.
+// With SCALEDEPENDENT the 2LPT field depends on the MG 
+// P(k) and the non-gaussian IC depend on the growth-factor
+// so there we include them
+//====================================================
+
+#define IC_CACHE_NBLOCKS 6
+
+static unsigned long long ic_cache_hash_file(unsigned long long hash, char *filename){
+  FILE *fp = fopen(filename, "r");
+  if(fp == NULL) return hash;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), fp)) > 0) hash = table_cache_hash_bytes(hash, buf, n);
+  fclose(fp);
+  return hash;
+}
+
+static unsigned long long ic_cache_hash(void){
+  double params[] = { (double) Seed, (double) Nsample, (double) Nmesh, (double) NTask, Box, Omega,
+    Sigma8, ShapeGamma, PrimordialIndex, OmegaBaryon, HubbleParam, UnitLength_in_cm, InputSpectrum_UnitLength_in_cm,
+    Fnl, FnlTime, (double) SphereMode, (double) WhichSpectrum, (double) WhichTransfer,
+#ifdef COUNTER_BASED_RNG
+    (double) UseSeedTable,
+#else
+    -1.0,
+#endif
+    (double) sizeof(float_kind), (double) sizeof(ZA[0][0]) };
+  unsigned long long hash = table_cache_hash_params((char *)"ic", params, sizeof(params) / sizeof(double));
+
+  // The type of non-gaussianity, the random number generator and the fields we store
+  char options[200] = "";
+#if defined(GAUSSIAN)
+  strcat(options, "GAUSSIAN");
+#endif
+#if !defined(GAUSSIAN) || defined(SCALEDEPENDENT)
+  hash = table_cache_hash_model(hash);
+#endif
+#if defined(LOCAL_FNL)
+  strcat(options, "LOCAL_FNL");
+#elif defined(EQUIL_FNL)
+  strcat(options, "EQUIL_FNL");
+#elif defined(ORTHO_FNL)
+  strcat(options, "ORTHO_FNL");
+#elif defined(GENERIC_FNL)
+  strcat(options, "GENERIC_FNL");
+  hash = ic_cache_hash_file(hash, FileWithInputKernel);
+#endif
+#ifdef COUNTER_BASED_RNG
+  strcat(options, "_COUNTER_BASED_RNG");
+#endif
+#ifdef SCALEDEPENDENT
+  strcat(options, "_SCALEDEPENDENT");
+#endif
+  hash = table_cache_hash_bytes(hash, options, strlen(options));
+
+  // The input power spectrum / transfer function
+  if(WhichSpectrum == 1) hash = ic_cache_hash_file(hash, FileWithInputSpectrum);
+  if(WhichTransfer == 1) hash = ic_cache_hash_file(hash, FileWithInputTransfer);
+
+  return hash;
+}
+
+// The blocks of data we store and their size in bytes
+static size_t ic_cache_blocks(void **blocks){
+#ifdef SCALEDEPENDENT
+  for(int axes = 0; axes < 3; axes++){
+    blocks[axes]     = cdisp_store[axes];
+    blocks[3 + axes] = cdisp2_store[axes];
+  }
+  return sizeof(complex_kind) * Total_size;
+#else
+  for(int axes = 0; axes < 3; axes++){
+    blocks[axes]     = ZA[axes];
+    blocks[3 + axes] = LPT[axes];
+  }
+  return sizeof(ZA[0][0]) * NumPart;
+#endif
+}
+
+static void ic_cache_filename(char *filename, unsigned long long hash){
+  char tablename[100];
+  sprintf(tablename, "ic_task%d", ThisTask);
+  table_cache_filename(filename, tablename, hash);
+}
+
+//====================================================
+// Load the displacement fields from the cache. Returns
+// 1 if they were found (and are then allocated and set
+// as after displacement_fields) and 0 otherwise
+//====================================================
+int ic_cache_load(void){
+  char filename[1000];
+  unsigned long long hash = ic_cache_hash();
+  ic_cache_filename(filename, hash);
+
+  // Allocate the arrays displacement_fields would allocate
+  void *blocks[IC_CACHE_NBLOCKS];
+  for(int axes = 0; axes < 3; axes++){
+#ifdef SCALEDEPENDENT
+    cdisp_store[axes]  = malloc(sizeof(complex_kind) * Total_size);
+    cdisp2_store[axes] = malloc(sizeof(complex_kind) * Total_size);
+    disp_store[axes]   = (float_kind *) cdisp_store[axes];
+    disp2_store[axes]  = (float_kind *) cdisp2_store[axes];
+#else
+    ZA[axes]  = malloc(sizeof(ZA[0][0]) * NumPart);
+    LPT[axes] = malloc(sizeof(LPT[0][0]) * NumPart);
+#endif
+  }
+  size_t blocksize = ic_cache_blocks(blocks);
+
+  struct table_cache_map map;
+  char *data = (char *) table_cache_load_file(filename, hash, IC_CACHE_NBLOCKS * blocksize, 1, 0, &map);
+  if(data == NULL){
+    for(int i = 0; i < IC_CACHE_NBLOCKS; i++) free(blocks[i]);
+    if(ThisTask == 0){
+      printf("IC cache: no valid displacement fields found. Generating them\n");
+      fflush(stdout);
+    }
+    return 0;
+  }
+
+  for(int i = 0; i < IC_CACHE_NBLOCKS; i++)
+    memcpy(blocks[i], data + i * blocksize, blocksize);
+  table_cache_close(&map);
+
+  if(ThisTask == 0){
+    printf("IC cache: using the displacement fields in %s/ic_task*_%016llx.dat\n", TableCacheDir, hash);
+    fflush(stdout);
+  }
+  return 1;
+}
+
+//====================================================
+// Store the displacement fields. Every task writes its
+// own file. Failing to write is not fatal
+//====================================================
+void ic_cache_write(void){
+  char filename[1000];
+  unsigned long long hash = ic_cache_hash();
+  ic_cache_filename(filename, hash);
+
+  void *blocks[IC_CACHE_NBLOCKS];
+  size_t blocksize = ic_cache_blocks(blocks);
+  int ok = table_cache_write_file(filename, hash, blocks, IC_CACHE_NBLOCKS, blocksize, IC_CACHE_NBLOCKS * blocksize);
+
+  int ok_all = 0;
+  MPI_Allreduce(&ok, &ok_all, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if(ThisTask == 0){
+    if(ok_all) printf("IC cache: wrote the displacement fields to %s/ic_task*_%016llx.dat\n", TableCacheDir, hash);
+    else       printf("IC cache: WARNING failed to write the displacement fields to %s\n", TableCacheDir);
+    fflush(stdout);
+  }
+}
+
+#undef IC_CACHE_NBLOCKS
@@ -8,7 +8,7 @@ static const char * CatName[]= {"Init        ",
                                 "TimeStepping"
                                };
 
-#define nSubCategory 15
+#define nSubCategory 16
 static const char * SubName[]= {"",                      
                                 "Kick                 ",            
                                 "Drift                ",         
@@ -23,7 +23,8 @@ static const char * SubName[]= {"",
                                 "NonGaussianIC        ", 
                                 "DisplacementFields   ",
                                 "OutputLightcone      ",
-                                "DriftLightcone       "
+                                "DriftLightcone       ",
+                                "FoF                  "
                                };
 static int initialized = 0;
 static enum Category Cat;
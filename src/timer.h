@@ -22,7 +22,8 @@ enum SubCategory {
                   _NonGaussianIC, 
                   _DisplacementFields, 
                   _OutputLightcone, 
-                  _DriftLightcone
+                  _DriftLightcone, 
+                  _FoF
                  };
 
 void timer_set_category(enum Category new_cat);
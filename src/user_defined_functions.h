@@ -335,9 +335,9 @@ double GeffoverG(double a, double k){
 //=============================================
 // Compute the fifth-force
 // Have to be called right after PtoMesh is run
-// as this routine assumes we have density(x)
-// stored in mgarray_two and density(k) stored
-// in P3D
+// as this routine assumes we have density(k)
+// stored in P3D and (with screening) density(x)
+// stored in mgarray_two
 //=============================================
 
 void ComputeFifthForce(){
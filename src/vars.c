@@ -95,6 +95,9 @@ complex_kind * P3D_mgarray_one;   // k-space arrays
 complex_kind * P3D_mgarray_two;   // ...
 plan_kind plan_mg_phinewton;      // FFT plans
 plan_kind plan_mg_phik;           // ...
+float_kind * mgarray_gradient = NULL; // The three components of DPhi (interleaved) for gradient screening
+complex_kind * P3D_mgarray_gradient;  // k-space array
+plan_kind plan_mg_gradient;           // Batched FFT of the three components
 
 //===================================================
 // Units
@@ -140,6 +143,8 @@ struct Outputs * OutputList;   // The output redshifts of the simulation and the
 //===================================================
 int NKernelTable;                 // The length of the kernel lookup table
 struct kern_table * KernelTable;  // The kernel lookup table
+int NKernelExponents;             // The number of distinct exponents kerA/kerB in the table
+double * KernelExponents;         // The distinct exponents kerA/kerB
 #endif
 
 //===================================================
@@ -171,6 +176,11 @@ float_kind * LPT[3];     // Vectors to hold the 2LPT displacements before partic
 
 struct part_data *P;
 
+#ifdef TWIN_RUN
+struct twin_state Twin[2];  // The MG simulation [0] and its LCDM twin [1]
+int ThisTwin;               // The twin currently in the globals
+#endif
+
 //===================================================
 // Simulation variables
 //===================================================
@@ -238,6 +248,96 @@ int  RamsesOutputNumber;
 int  TypeInputParticleFiles;
 int  ReadParticlesFromFile;
 
+#ifdef TABLE_CACHE
+//===================================================
+// Cache of growth-factor tables on disk
+//===================================================
+char TableCacheDir[500];  // The directory with the cached tables (must exist)
+int UseICCache;           // Also cache the IC displacement fields (1) or not (0)
+#endif
+
+#ifdef MULTIGRID_SOLVER
+//===================================================
+// Multigrid solver for the f(R) field equation
+//===================================================
+int MultigridSolveEvery;   // Use the multigrid solver every this many steps (approximate screening otherwise)
+int MultigridMaxCycles;    // The maximum number of cycles per solve
+int MultigridCycleType;    // 1 = V-cycle, 2 = W-cycle
+double MultigridEpsilon;   // Stop when the rms residual relative to the rms source is below this
+#endif
+
+#ifdef COUNTER_BASED_RNG
+//===================================================
+// Counter-based random numbers for the IC
+//===================================================
+int UseSeedTable;          // 1 = use the seedtable phases of the standard version, 0 = counter-based RNG
+#endif
+
+#ifdef NODE_SHARED_TABLES
+//===================================================
+// Tables stored once per node
+//===================================================
+MPI_Comm NodeComm;        // The tasks on the same node as this task
+int NodeTask;             // The rank of this task on the node
+int NodeNTask;            // The number of tasks on the node
+#endif
+
+#ifdef ASYNC_OUTPUT
+//===================================================
+// Asynchronous snapshot output
+//===================================================
+int AsyncOutputMemoryMB;  // The maximum memory per task used by staged files not yet written
+#endif
+
+#ifdef MPIIO_OUTPUT
+//===================================================
+// Collective MPI-IO snapshot output
+//===================================================
+int NumOutputFiles;       // The number of files per snapshot (1 <= NumOutputFiles <= NTask)
+#endif
+
+#ifdef COMPRESSED_OUTPUT
+//===================================================
+// Compressed snapshot output
+//===================================================
+double CompressPosTolerance;  // The maximum error in the positions in Mpc/h (0 = exact)
+double CompressVelTolerance;  // The maximum error in the velocities in km/s (0 = exact)
+#endif
+
+#if defined(SUBSAMPLE_OUTPUT) || defined(DENSITY_GRID_OUTPUT) || defined(FOF_HALOS)
+//===================================================
+// Subsample, density grid and halo outputs
+//===================================================
+int FullSnapshotInterval;     // Write the full snapshot at every FullSnapshotInterval'th output (0 = only the last)
+#endif
+#ifdef SUBSAMPLE_OUTPUT
+double SubsampleFraction;     // The fraction of the particles in the subsample
+#endif
+#ifdef DENSITY_GRID_OUTPUT
+int DensityGridSize;          // The number of cells per dimension in the density grid
+#endif
+
+#ifdef FOF_HALOS
+//===================================================
+// Friends-of-Friends halos
+//===================================================
+double FoFLinkingLength;      // The linking length in units of the mean particle separation
+int FoFMinParticles;          // The minimum number of particles in a halo
+int FoFWriteMemberIDs;        // Write the IDs of the particles in the halos (needs PARTICLE_ID or SCALEDEPENDENT)
+#endif
+
+#ifdef COMPUTE_POFK
+//===================================================
+// In-situ power spectrum
+//===================================================
+int PofkNbins;                // The number of k-bins from the fundamental mode to the Nyquist frequency
+int PofkLogBinning;           // Logarithmic (1) or linear (0) bins in k
+int PofkSubtractShotnoise;    // Subtract the shot-noise 1/nbar from P(k) and P0(k)
+int PofkEveryStep;            // Compute P(k) at every step (1) or only at the outputs (0)
+int PofkMultipoles;           // Compute the redshift-space multipoles at the outputs
+int PofkComputeNow = 0;       // Compute P(k) in the next call to PtoMesh
+#endif
+
 //==============================================================================
 // FFTW Wrappers to avoid having SINGLE_PRECISION-defines messing up the code
 //==============================================================================
@@ -260,6 +360,20 @@ inline plan_kind my_fftw_mpi_plan_dft_c2r_3d(int nx, int ny, int nz, complex_kin
 #endif
   timer_stop(_FFT);
 }
+inline plan_kind my_fftw_mpi_plan_many_dft_c2r(int rnk, const ptrdiff_t *n, ptrdiff_t howmany, complex_kind *imgrid, float_kind *regrid, MPI_Comm comm, unsigned flags){
+#ifdef SINGLE_PRECISION
+  return fftwf_mpi_plan_many_dft_c2r(rnk, n, howmany, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, imgrid, regrid, comm, flags);
+#else
+  return fftw_mpi_plan_many_dft_c2r(rnk, n, howmany, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, imgrid, regrid, comm, flags);
+#endif
+}
+inline plan_kind my_fftw_mpi_plan_many_dft_r2c(int rnk, const ptrdiff_t *n, ptrdiff_t howmany, float_kind *regrid, complex_kind *imgrid, MPI_Comm comm, unsigned flags){
+#ifdef SINGLE_PRECISION
+  return fftwf_mpi_plan_many_dft_r2c(rnk, n, howmany, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, regrid, imgrid, comm, flags);
+#else
+  return fftw_mpi_plan_many_dft_r2c(rnk, n, howmany, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, regrid, imgrid, comm, flags);
+#endif
+}
 inline void my_fftw_destroy_plan(fftw_plan fftwplan){
 #ifdef SINGLE_PRECISION
   fftwf_destroy_plan(fftwplan);
@@ -297,6 +411,13 @@ inline ptrdiff_t my_fftw_mpi_local_size_3d(int nx, int ny, int nz, MPI_Comm comm
   return fftw_mpi_local_size_3d(nx, ny, nz, comm, locnx, locxstart);
 #endif
 }
+inline ptrdiff_t my_fftw_mpi_local_size_many(int rnk, const ptrdiff_t *n, ptrdiff_t howmany, MPI_Comm comm, ptrdiff_t *locnx, ptrdiff_t *locxstart){
+#ifdef SINGLE_PRECISION
+  return fftwf_mpi_local_size_many(rnk, n, howmany, FFTW_MPI_DEFAULT_BLOCK, comm, locnx, locxstart);
+#else
+  return fftw_mpi_local_size_many(rnk, n, howmany, FFTW_MPI_DEFAULT_BLOCK, comm, locnx, locxstart);
+#endif
+}
 
 inline int mymod(int i, int N){
   int res = i % N;
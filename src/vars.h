@@ -27,6 +27,7 @@
 
 #include <time.h>
 #include <math.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -144,6 +145,9 @@ extern complex_kind *P3D_mgarray_one;   // k-space arrays
 extern complex_kind *P3D_mgarray_two;   // ...                                          
 extern plan_kind plan_mg_phinewton;     // FFT plans                                    
 extern plan_kind plan_mg_phik;          // ...                                          
+extern float_kind *mgarray_gradient;    // The three components of DPhi (interleaved) for gradient screening
+extern complex_kind *P3D_mgarray_gradient; // k-space array
+extern plan_kind plan_mg_gradient;      // Batched FFT of the three components
 
 //===================================================
 // Units
@@ -216,7 +220,11 @@ extern struct kern_table {         // The kernel lookup table
   double ker0;
   double kerA;
   double kerB;
+  int indA;                        // The index of kerA and kerB in KernelExponents
+  int indB;
 } *KernelTable;
+extern int NKernelExponents;       // The number of distinct exponents kerA/kerB in the table
+extern double *KernelExponents;    // The distinct exponents kerA/kerB
 #endif
 
 //===================================================
@@ -300,6 +308,23 @@ extern struct part_data {
 
 #endif
 
+#ifdef TWIN_RUN
+//===================================================
+// Twin run: the state of the MG simulation [0] and of
+// its LCDM twin [1]. The current one lives in the
+// globals above and is swapped by twin_run_select
+//===================================================
+extern struct twin_state {
+  struct part_data *P;              // The particles
+  unsigned int NumPart;             // The number of particles on this processor
+  int modified_gravity_active;      // [1] is MG [0] is LCDM
+  char FileBase[500];               // The base output filename
+  double sumxyz[3];
+  double sumDxyz[3];
+} Twin[2];
+extern int ThisTwin;                // The twin currently in the globals
+#endif
+
 //===================================================
 // Simulation variables
 //===================================================
@@ -362,15 +387,108 @@ extern int  ReadParticlesFromFile;
 #define ASCIIFILE  2
 #define GADGETFILE 3
 
+#ifdef TABLE_CACHE
+//===================================================
+// Cache of growth-factor tables on disk
+//===================================================
+extern char TableCacheDir[500];  // The directory with the cached tables (must exist)
+extern int UseICCache;           // Also cache the IC displacement fields (1) or not (0)
+#endif
+
+#ifdef MULTIGRID_SOLVER
+//===================================================
+// Multigrid solver for the f(R) field equation
+//===================================================
+extern int MultigridSolveEvery;   // Use the multigrid solver every this many steps (approximate screening otherwise)
+extern int MultigridMaxCycles;    // The maximum number of cycles per solve
+extern int MultigridCycleType;    // 1 = V-cycle, 2 = W-cycle
+extern double MultigridEpsilon;   // Stop when the rms residual relative to the rms source is below this
+#endif
+
+#ifdef COUNTER_BASED_RNG
+//===================================================
+// Counter-based random numbers for the IC
+//===================================================
+extern int UseSeedTable;          // 1 = use the seedtable phases of the standard version, 0 = counter-based RNG
+#endif
+
+#ifdef NODE_SHARED_TABLES
+//===================================================
+// Tables stored once per node
+//===================================================
+extern MPI_Comm NodeComm;        // The tasks on the same node as this task
+extern int NodeTask;             // The rank of this task on the node
+extern int NodeNTask;            // The number of tasks on the node
+#endif
+
+#ifdef ASYNC_OUTPUT
+//===================================================
+// Asynchronous snapshot output
+//===================================================
+extern int AsyncOutputMemoryMB;  // The maximum memory per task used by staged files not yet written
+#endif
+
+#ifdef MPIIO_OUTPUT
+//===================================================
+// Collective MPI-IO snapshot output
+//===================================================
+extern int NumOutputFiles;       // The number of files per snapshot (1 <= NumOutputFiles <= NTask)
+#endif
+
+#ifdef COMPRESSED_OUTPUT
+//===================================================
+// Compressed snapshot output
+//===================================================
+extern double CompressPosTolerance;  // The maximum error in the positions in Mpc/h (0 = exact)
+extern double CompressVelTolerance;  // The maximum error in the velocities in km/s (0 = exact)
+#endif
+
+#if defined(SUBSAMPLE_OUTPUT) || defined(DENSITY_GRID_OUTPUT) || defined(FOF_HALOS)
+//===================================================
+// Subsample, density grid and halo outputs
+//===================================================
+extern int FullSnapshotInterval;     // Write the full snapshot at every FullSnapshotInterval'th output (0 = only the last)
+#endif
+#ifdef SUBSAMPLE_OUTPUT
+extern double SubsampleFraction;     // The fraction of the particles in the subsample
+#endif
+#ifdef DENSITY_GRID_OUTPUT
+extern int DensityGridSize;          // The number of cells per dimension in the density grid
+#endif
+
+#ifdef FOF_HALOS
+//===================================================
+// Friends-of-Friends halos
+//===================================================
+extern double FoFLinkingLength;      // The linking length in units of the mean particle separation
+extern int FoFMinParticles;          // The minimum number of particles in a halo
+extern int FoFWriteMemberIDs;        // Write the IDs of the particles in the halos (needs PARTICLE_ID or SCALEDEPENDENT)
+#endif
+
+#ifdef COMPUTE_POFK
+//===================================================
+// In-situ power spectrum
+//===================================================
+extern int PofkNbins;                // The number of k-bins from the fundamental mode to the Nyquist frequency
+extern int PofkLogBinning;           // Logarithmic (1) or linear (0) bins in k
+extern int PofkSubtractShotnoise;    // Subtract the shot-noise 1/nbar from P(k) and P0(k)
+extern int PofkEveryStep;            // Compute P(k) at every step (1) or only at the outputs (0)
+extern int PofkMultipoles;           // Compute the redshift-space multipoles at the outputs
+extern int PofkComputeNow;           // Compute P(k) in the next call to PtoMesh
+#endif
+
 //===================================================
 // FFTW wrappers
 //===================================================
 extern plan_kind my_fftw_mpi_plan_dft_r2c_3d(int nx, int ny, int nz, float_kind   *regrid, complex_kind *imgrid,  MPI_Comm comm, unsigned flags);
 extern plan_kind my_fftw_mpi_plan_dft_c2r_3d(int nx, int ny, int nz, complex_kind *imgrid, float_kind   *regrid,  MPI_Comm comm, unsigned flags);
+extern plan_kind my_fftw_mpi_plan_many_dft_c2r(int rnk, const ptrdiff_t *n, ptrdiff_t howmany, complex_kind *imgrid, float_kind *regrid, MPI_Comm comm, unsigned flags);
+extern plan_kind my_fftw_mpi_plan_many_dft_r2c(int rnk, const ptrdiff_t *n, ptrdiff_t howmany, float_kind *regrid, complex_kind *imgrid, MPI_Comm comm, unsigned flags);
 extern void my_fftw_destroy_plan(fftw_plan fftwplan);
 extern void my_fftw_execute(fftw_plan fftwplan);
 extern void my_fftw_mpi_cleanup();
 extern void my_fftw_mpi_init();
 extern ptrdiff_t my_fftw_mpi_local_size_3d(int nx, int ny, int nz, MPI_Comm comm, ptrdiff_t *Local_nx, ptrdiff_t *Local_x_start);
+extern ptrdiff_t my_fftw_mpi_local_size_many(int rnk, const ptrdiff_t *n, ptrdiff_t howmany, MPI_Comm comm, ptrdiff_t *Local_nx, ptrdiff_t *Local_x_start);
 
 extern int mymod(int i, int N);